@@ -22,15 +22,36 @@
 
 #include "abstractmergenode.h"
 
+#include <algorithm>
+
 AbstractMergeNode::AbstractMergeNode()
 {
 }
 
+void AbstractMergeNode::describe(Description &description)
+{
+    for (Port *input : _inputs) {
+        description.inputs.push_back(std::make_pair("addInput", input));
+    }
+}
+
 AbstractNode::Port *AbstractMergeNode::output()
 {
     return &_output;
 }
 
+std::vector<AbstractNode::Port *> AbstractMergeNode::inputs()
+{
+    return _inputs;
+}
+
+bool AbstractMergeNode::replaceInput(Port *port, Port *by)
+{
+    std::replace(_inputs.begin(), _inputs.end(), port, by);
+
+    return true;
+}
+
 void AbstractMergeNode::addInput(Port *input)
 {
     unsigned int dim = input->value.rows();
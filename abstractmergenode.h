@@ -38,7 +38,10 @@ class AbstractMergeNode : public AbstractNode
          */
         void addInput(Port *input);
 
+        virtual void describe(Description &description);
         virtual Port *output();
+        virtual std::vector<Port *> inputs();
+        virtual bool replaceInput(Port *port, Port *by);
         virtual void update();
         virtual void clearError();
 
@@ -21,6 +21,19 @@
  */
 
 #include "abstractnetworknode.h"
+#include "activation.h"
+#include "densesum.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <set>
+#include <stdexcept>
+#include <typeinfo>
+
+AbstractNetworkNode::AbstractNetworkNode()
+: _pool(nullptr)
+{
+}
 
 AbstractNetworkNode::~AbstractNetworkNode()
 {
@@ -32,6 +45,522 @@ AbstractNetworkNode::~AbstractNetworkNode()
 void AbstractNetworkNode::addNode(AbstractNode *node)
 {
     _nodes.push_back(node);
+
+    invalidateLevels();
+}
+
+void AbstractNetworkNode::sortNodes()
+{
+    int count = _nodes.size();
+    std::vector<std::vector<Port *>> produced(count);
+    std::vector<std::vector<int>> dependents(count);
+    std::vector<int> dependencies(count, 0);
+
+    for (int i=0; i<count; ++i) {
+        _nodes[i]->collectPorts(produced[i]);
+    }
+
+    // Node j depends on node i if it reads a port produced by i
+    for (int j=0; j<count; ++j) {
+        for (Port *input : _nodes[j]->inputs()) {
+            for (int i=0; i<count; ++i) {
+                if (i != j &&
+                    !isBackEdge(_nodes[i]) &&
+                    std::find(produced[i].begin(), produced[i].end(), input) != produced[i].end() &&
+                    std::find(dependents[i].begin(), dependents[i].end(), j) == dependents[i].end()) {
+                    dependents[i].push_back(j);
+                    dependencies[j] += 1;
+                }
+            }
+        }
+    }
+
+    // Topological sort, taking among the nodes whose dependencies are all
+    // forwarded the one added first
+    std::set<int> ready;
+    std::vector<AbstractNode *> sorted;
+
+    for (int i=0; i<count; ++i) {
+        if (dependencies[i] == 0) {
+            ready.insert(i);
+        }
+    }
+
+    while (!ready.empty()) {
+        int i = *ready.begin();
+
+        ready.erase(ready.begin());
+        sorted.push_back(_nodes[i]);
+
+        for (int j : dependents[i]) {
+            if (--dependencies[j] == 0) {
+                ready.insert(j);
+            }
+        }
+    }
+
+    if (int(sorted.size()) != count) {
+        throw std::logic_error("AbstractNetworkNode::sortNodes() found a loop that is not broken by a recurrent node");
+    }
+
+    // The output of the network is the one of its last node. Any other node
+    // that no node reads could also be the output
+    for (int i=0; i<count; ++i) {
+        if (dependents[i].empty() && !isBackEdge(_nodes[i]) && _nodes[i] != sorted.back()) {
+            throw std::logic_error("AbstractNetworkNode::sortNodes() found several nodes that no node reads, it cannot know which one produces the output");
+        }
+    }
+
+    _nodes.swap(sorted);
+
+    invalidateLevels();
+}
+
+void AbstractNetworkNode::setThreadPool(ThreadPool *pool)
+{
+    _pool = pool;
+
+    invalidateLevels();
+}
+
+bool AbstractNetworkNode::isBackEdge(AbstractNode *node)
+{
+    (void) node;
+
+    return false;
+}
+
+void AbstractNetworkNode::forwardNodes()
+{
+    if (_pool == nullptr) {
+        for (AbstractNode *node : _nodes) {
+            node->forward();
+        }
+
+        return;
+    }
+
+    if (_levels.empty()) {
+        computeLevels();
+    }
+
+    for (std::vector<AbstractNode *> &level : _levels) {
+        _pool->run(level.size(), [&level](unsigned int i) {
+            level[i]->forward();
+        });
+    }
+}
+
+void AbstractNetworkNode::invalidateLevels()
+{
+    _levels.clear();
+}
+
+void AbstractNetworkNode::describeDenseNodes(Description &description)
+{
+    static const char *names[] = {"learning_rate", "decay", "precision", "quantized"};
+
+    for (AbstractNode *node : _nodes) {
+        Description dense;
+
+        node->describe(dense);
+
+        if (dense.type != "Dense" && dense.type != "DenseSum") {
+            continue;
+        }
+
+        for (const auto &parameter : dense.parameters) {
+            if (std::find(std::begin(names), std::end(names), parameter.first) != std::end(names)) {
+                description.parameters.push_back(parameter);
+            }
+        }
+        break;
+    }
+}
+
+void AbstractNetworkNode::optimizeNodes()
+{
+    // The sub-nodes of the sub-nodes first, the ports they read are not changed
+    for (AbstractNode *node : _nodes) {
+        AbstractNetworkNode *network = dynamic_cast<AbstractNetworkNode *>(node);
+
+        if (network != nullptr) {
+            network->optimizeNodes();
+        }
+    }
+
+    // A node that does not list its inputs may read any port, whose producer
+    // then cannot be removed
+    for (AbstractNode *node : _nodes) {
+        if (node->inputs().empty()) {
+            return;
+        }
+    }
+
+    // Apply the simplifications until none applies anymore
+    bool changed = true;
+
+    while (changed) {
+        changed = false;
+
+        for (int i=0; i<int(_nodes.size()) && !changed; ++i) {
+            changed = removeIdentity(i) || fuseDenseSum(i);
+        }
+    }
+}
+
+unsigned int AbstractNetworkNode::countNodes()
+{
+    unsigned int count = _nodes.size();
+
+    for (AbstractNode *node : _nodes) {
+        AbstractNetworkNode *network = dynamic_cast<AbstractNetworkNode *>(node);
+
+        if (network != nullptr) {
+            count += network->countNodes();
+        }
+    }
+
+    return count;
+}
+
+bool AbstractNetworkNode::isGraphInput(Port *port)
+{
+    (void) port;
+
+    return true;
+}
+
+void AbstractNetworkNode::mergeSumReplaced(MergeSum *merge, MergeSum *by)
+{
+    (void) merge;
+    (void) by;
+}
+
+int AbstractNetworkNode::producer(Port *port)
+{
+    for (std::size_t i=0; i<_nodes.size(); ++i) {
+        if (_nodes[i]->output() == port) {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+std::vector<int> AbstractNetworkNode::readers(Port *port)
+{
+    std::vector<int> rs;
+
+    for (std::size_t i=0; i<_nodes.size(); ++i) {
+        std::vector<Port *> inputs = _nodes[i]->inputs();
+
+        if (std::find(inputs.begin(), inputs.end(), port) != inputs.end()) {
+            rs.push_back(i);
+        }
+    }
+
+    return rs;
+}
+
+bool AbstractNetworkNode::isUnchanged(Port *port, int i, int j)
+{
+    int p = producer(port);
+
+    if (p < 0) {
+        return isGraphInput(port);
+    }
+
+    // Produced before i, or produced from j on and holding its value of the
+    // previous time step from i to j
+    return p < i || p >= j;
+}
+
+bool AbstractNetworkNode::replaceReaders(const std::vector<int> &nodes, Port *port, Port *by)
+{
+    for (std::size_t i=0; i<nodes.size(); ++i) {
+        if (!_nodes[nodes[i]]->replaceInput(port, by)) {
+            // Put back the nodes already changed
+            for (std::size_t j=0; j<i; ++j) {
+                _nodes[nodes[j]]->replaceInput(by, port);
+            }
+
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool AbstractNetworkNode::removeIdentity(int i)
+{
+    LinearActivation *node = dynamic_cast<LinearActivation *>(_nodes[i]);
+
+    if (node == nullptr || i == int(_nodes.size()) - 1 || isBackEdge(node)) {
+        return false;
+    }
+
+    // The output must be read only after the node, and the input keep its
+    // value from the node to the last reader, so that the readers of the
+    // output see the same value when reading the input. This excludes the
+    // copies of values of the previous time step.
+    Port *input = node->inputs()[0];
+    Port *output = node->output();
+    std::vector<int> rs = readers(output);
+    int last = i;
+
+    for (int r : rs) {
+        if (r <= i) {
+            return false;
+        }
+
+        last = std::max(last, r);
+    }
+
+    if (!isUnchanged(input, i, last) || !replaceReaders(rs, output, input)) {
+        return false;
+    }
+
+    _nodes.erase(_nodes.begin() + i);
+    delete node;
+
+    invalidateLevels();
+
+    return true;
+}
+
+bool AbstractNetworkNode::fuseDenseSum(int i)
+{
+    AbstractNode *merge = _nodes[i];
+
+    if (typeid(*merge) != typeid(MergeSum) || isBackEdge(merge)) {
+        return false;
+    }
+
+    // The Dense nodes fused are the last ones among the inputs that are only
+    // read by the MergeSum, added one after the other. The DenseSum takes the
+    // place of the first one, so that the weights are serialized in the same
+    // order.
+    std::vector<Port *> inputs = merge->inputs();
+    std::vector<int> fusable;
+
+    for (Port *input : inputs) {
+        int p = producer(input);
+
+        if (p >= 0 && p < i &&
+            typeid(*_nodes[p]) == typeid(Dense) &&
+            !isBackEdge(_nodes[p]) &&
+            readers(input) == std::vector<int>{i} &&
+            std::count(inputs.begin(), inputs.end(), input) == 1) {
+            fusable.push_back(p);
+        }
+    }
+
+    if (fusable.empty()) {
+        return false;
+    }
+
+    std::sort(fusable.begin(), fusable.end());
+
+    int last = fusable.back();
+    int first = last;
+
+    while (std::find(fusable.begin(), fusable.end(), first - 1) != fusable.end()) {
+        first -= 1;
+    }
+
+    // The last node must stay the last one
+    if (i == int(_nodes.size()) - 1 && last != i - 1) {
+        return false;
+    }
+
+    // The Dense nodes read their inputs, and the other inputs are summed, when
+    // the first Dense node is forwarded
+    std::vector<Dense *> dense;
+    std::vector<Port *> others;
+
+    for (int j=first; j<=last; ++j) {
+        Port *input = _nodes[j]->inputs()[0];
+
+        if (!isUnchanged(input, first, last)) {
+            return false;
+        }
+
+        dense.push_back(static_cast<Dense *>(_nodes[j]));
+    }
+
+    for (Port *input : inputs) {
+        int p = producer(input);
+
+        if (p < first || p > last) {
+            if (!isUnchanged(input, first, i)) {
+                return false;
+            }
+
+            others.push_back(input);
+        }
+    }
+
+    if (!DenseSum::canFuse(dense)) {
+        return false;
+    }
+
+    // The readers of the MergeSum read the DenseSum, that is forwarded earlier
+    std::vector<int> rs = readers(merge->output());
+
+    for (int r : rs) {
+        if (r <= i) {
+            return false;
+        }
+    }
+
+    DenseSum *sum = new DenseSum(dense, others);
+
+    if (!replaceReaders(rs, merge->output(), sum->output())) {
+        delete sum;
+        return false;
+    }
+
+    mergeSumReplaced(static_cast<MergeSum *>(merge), sum);
+
+    delete merge;
+    _nodes.erase(_nodes.begin() + i);
+
+    for (int j=first; j<=last; ++j) {
+        delete _nodes[j];
+    }
+
+    _nodes.erase(_nodes.begin() + first + 1, _nodes.begin() + last + 1);
+    _nodes[first] = sum;
+
+    invalidateLevels();
+
+    return true;
+}
+
+void AbstractNetworkNode::computeLevels()
+{
+    int count = _nodes.size();
+    std::vector<std::vector<Port *>> produced(count);
+    std::vector<std::vector<Port *>> inputs(count);
+    std::vector<int> levels(count, 0);
+
+    for (int i=0; i<count; ++i) {
+        _nodes[i]->collectPorts(produced[i]);
+        inputs[i] = _nodes[i]->inputs();
+    }
+
+    // A node is forwarded after the nodes before it that produce one of its
+    // inputs, and after the ones that read one of its ports (they read the
+    // value of the previous time step, that the node overwrites). A node that
+    // does not list its inputs is forwarded alone, in order.
+    for (int j=0; j<count; ++j) {
+        for (int i=0; i<j; ++i) {
+            bool related = inputs[i].empty() || inputs[j].empty();
+
+            for (Port *input : inputs[j]) {
+                related |= std::find(produced[i].begin(), produced[i].end(), input) != produced[i].end();
+            }
+            for (Port *input : inputs[i]) {
+                related |= std::find(produced[j].begin(), produced[j].end(), input) != produced[j].end();
+            }
+
+            if (related) {
+                levels[j] = std::max(levels[j], levels[i] + 1);
+            }
+        }
+    }
+
+    _levels.clear();
+
+    for (int i=0; i<count; ++i) {
+        if (levels[i] >= int(_levels.size())) {
+            _levels.resize(levels[i] + 1);
+        }
+
+        _levels[levels[i]].push_back(_nodes[i]);
+    }
+}
+
+std::vector<AbstractNode::Port *> AbstractNetworkNode::inputs()
+{
+    std::vector<Port *> outputs;
+    std::vector<Port *> rs;
+
+    for (AbstractNode *node : _nodes) {
+        outputs.push_back(node->output());
+    }
+
+    // Keep the inputs of the sub-nodes that are not produced by other sub-nodes
+    for (AbstractNode *node : _nodes) {
+        for (Port *input : node->inputs()) {
+            if (std::find(outputs.begin(), outputs.end(), input) == outputs.end() &&
+                std::find(rs.begin(), rs.end(), input) == rs.end()) {
+                rs.push_back(input);
+            }
+        }
+    }
+
+    return rs;
+}
+
+bool AbstractNetworkNode::isRecurrent()
+{
+    for (AbstractNode *node : _nodes) {
+        if (node->isRecurrent()) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+void AbstractNetworkNode::collectPorts(std::vector<Port *> &ports)
+{
+    for (AbstractNode *node : _nodes) {
+        node->collectPorts(ports);
+    }
+}
+
+void AbstractNetworkNode::collectStates(std::vector<Matrix::ColsBlockXpr> &states)
+{
+    for (AbstractNode *node : _nodes) {
+        node->collectStates(states);
+    }
+}
+
+unsigned int AbstractNetworkNode::stateSize()
+{
+    unsigned int rs = 0;
+
+    for (AbstractNode *node : _nodes) {
+        rs += node->stateSize();
+    }
+
+    return rs;
+}
+
+unsigned int AbstractNetworkNode::period()
+{
+    unsigned int rs = 1;
+
+    for (AbstractNode *node : _nodes) {
+        unsigned int period = node->period();
+        unsigned int a = rs;
+        unsigned int b = period;
+
+        // Euclid's algorithm gives the greatest common divisor of rs and period
+        while (b != 0) {
+            unsigned int r = a % b;
+
+            a = b;
+            b = r;
+        }
+
+        rs = rs / a * period;
+    }
+
+    return rs;
 }
 
 void AbstractNetworkNode::serialize(NetworkSerializer &serializer)
@@ -52,9 +581,7 @@ void AbstractNetworkNode::deserialize(NetworkSerializer &serializer)
 
 void AbstractNetworkNode::forward()
 {
-    for (AbstractNode *node : _nodes) {
-        node->forward();
-    }
+    forwardNodes();
 }
 
 void AbstractNetworkNode::backward()
@@ -89,6 +616,52 @@ void AbstractNetworkNode::reset()
     }
 }
 
+void AbstractNetworkNode::setBatchSize(unsigned int batch_size)
+{
+    for (AbstractNode *node : _nodes) {
+        node->setBatchSize(batch_size);
+    }
+}
+
+void AbstractNetworkNode::freeze()
+{
+    for (AbstractNode *node : _nodes) {
+        node->freeze();
+    }
+}
+
+unsigned int AbstractNetworkNode::quantize()
+{
+    unsigned int rs = 0;
+
+    for (AbstractNode *node : _nodes) {
+        rs += node->quantize();
+    }
+
+    return rs;
+}
+
+unsigned int AbstractNetworkNode::setPrecision(Precision precision)
+{
+    unsigned int rs = 0;
+
+    for (AbstractNode *node : _nodes) {
+        rs += node->setPrecision(precision);
+    }
+
+    return rs;
+}
+
+void AbstractNetworkNode::setStreaming(bool streaming)
+{
+    for (AbstractNode *node : _nodes) {
+        node->setStreaming(streaming);
+    }
+
+    // The output port may not be produced by a sub-node (FusedGRU, CWRNN)
+    AbstractNode::setStreaming(streaming);
+}
+
 void AbstractNetworkNode::setCurrentTimestep(unsigned int timestep)
 {
     for (AbstractNode *node : _nodes) {
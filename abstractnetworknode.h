@@ -25,12 +25,16 @@
 
 #include "abstractnode.h"
 
+class ThreadPool;
+class MergeSum;
+
 /**
  * @brief Node made of a network of sub-nodes (recurrent nodes for instance)
  */
 class AbstractNetworkNode : public AbstractNode
 {
     public:
+        AbstractNetworkNode();
         virtual ~AbstractNetworkNode();
 
         /**
@@ -39,6 +43,53 @@ class AbstractNetworkNode : public AbstractNode
          */
         void addNode(AbstractNode *node);
 
+        /**
+         * @brief Order the nodes so that each node is forwarded after the
+         *        nodes producing its inputs
+         *
+         * The order is computed from the ports listed by the inputs() and
+         * collectPorts() methods of the nodes. The outputs of recurrent nodes
+         * (see AbstractRecurrentNetworkNode::addRecurrentNode()) are not
+         * dependencies: their readers can be forwarded before them, and then
+         * read their value at the previous time step. Among the valid orders,
+         * the one closest to the order in which the nodes have been added
+         * is used, so that a network already correctly ordered is unchanged.
+         * The node that no other node reads becomes the last one, and
+         * produces the output.
+         *
+         * @note The nodes are serialized in the new order
+         * @throw std::logic_error if the nodes form a loop that no recurrent
+         *        node breaks, or if several nodes are not read by any node.
+         *        The order of the nodes is then unchanged.
+         */
+        void sortNodes();
+
+        /**
+         * @brief Forward the independent nodes in parallel using @p pool, or
+         *        one after the other if @p pool is null
+         *
+         * The nodes are grouped in levels: the nodes of a level only read
+         * ports produced by nodes of the previous levels, and nodes of the
+         * same level are forwarded at the same time. The backward pass stays
+         * sequential, because nodes reading the same port add their errors to
+         * it. The pool is not owned by this node.
+         */
+        void setThreadPool(ThreadPool *pool);
+
+        /**
+         * @brief Ports read by the sub-nodes and produced outside this network
+         */
+        virtual std::vector<Port *> inputs();
+        virtual bool isRecurrent();
+        virtual void collectPorts(std::vector<Port *> &ports);
+        virtual void collectStates(std::vector<Matrix::ColsBlockXpr> &states);
+        virtual unsigned int stateSize();
+
+        /**
+         * @brief Least common multiple of the periods of the sub-nodes
+         */
+        virtual unsigned int period();
+
         virtual void serialize(NetworkSerializer &serializer);
         virtual void deserialize(NetworkSerializer &serializer);
 
@@ -47,11 +98,112 @@ class AbstractNetworkNode : public AbstractNode
         virtual void update();
         virtual void clearError();
         virtual void reset();
+        virtual void setBatchSize(unsigned int batch_size);
+        virtual void setStreaming(bool streaming);
+        virtual void freeze();
+        virtual unsigned int quantize();
+        virtual unsigned int setPrecision(Precision precision);
 
         virtual void setCurrentTimestep(unsigned int timestep);
 
+    protected:
+        /**
+         * @brief Whether the readers of the output of @p node read its value
+         *        at the previous time step, and therefore do not depend on it
+         */
+        virtual bool isBackEdge(AbstractNode *node);
+
+        /**
+         * @brief Forward all the nodes, level by level if a thread pool is used
+         */
+        void forwardNodes();
+
+        /**
+         * @brief Forget the levels, that are computed again when needed. This
+         *        must be called when _nodes is changed.
+         */
+        void invalidateLevels();
+
+        /**
+         * @brief Add to @p description the learning rate, decay, precision
+         *        and quantization of the first Dense (or DenseSum) sub-node,
+         *        that all the Dense sub-nodes share
+         */
+        void describeDenseNodes(Description &description);
+
+        /**
+         * @brief Simplify the sub-nodes of this node and of its sub-nodes
+         *        (see Network::optimize())
+         */
+        void optimizeNodes();
+
+        /**
+         * @brief Number of sub-nodes, the sub-nodes of the sub-nodes included
+         */
+        unsigned int countNodes();
+
+        /**
+         * @brief Whether @p port, that no sub-node produces, keeps the same
+         *        value while the sub-nodes are forwarded
+         *
+         * This is the case of the inputs of a sub-network, produced before it
+         * is forwarded.
+         */
+        virtual bool isGraphInput(Port *port);
+
+        /**
+         * @brief Called by optimizeNodes() when the sub-node @p merge is
+         *        replaced by @p by (a DenseSum), before @p merge is deleted
+         */
+        virtual void mergeSumReplaced(MergeSum *merge, MergeSum *by);
+
+    private:
+        /**
+         * @brief Group the nodes in levels of nodes that can be forwarded at
+         *        the same time
+         */
+        void computeLevels();
+
+        /**
+         * @brief Index of the node producing @p port, -1 if no node produces it
+         */
+        int producer(Port *port);
+
+        /**
+         * @brief Indexes of the nodes that read @p port
+         */
+        std::vector<int> readers(Port *port);
+
+        /**
+         * @brief Whether @p port holds its value of the current time step, or
+         *        is not produced yet, when node @p i is forwarded, and keeps it
+         *        until node @p j is forwarded
+         */
+        bool isUnchanged(Port *port, int i, int j);
+
+        /**
+         * @brief Make the nodes whose indexes are @p nodes read @p by instead
+         *        of @p port. Nothing is changed if one node cannot do that.
+         */
+        bool replaceReaders(const std::vector<int> &nodes, Port *port, Port *by);
+
+        /**
+         * @brief Remove node @p i if it is a LinearActivation that can be removed
+         */
+        bool removeIdentity(int i);
+
+        /**
+         * @brief Replace node @p i and Dense nodes among its inputs by a
+         *        DenseSum, if it is a MergeSum of such nodes
+         */
+        bool fuseDenseSum(int i);
+
     protected:
         std::vector<AbstractNode *> _nodes;
+
+    private:
+        ThreadPool *_pool;
+        std::vector<std::vector<AbstractNode *>> _levels;
 };
 
 #endif
@@ -24,14 +24,24 @@
 #define __ABSTRACTNODE_H__
 
 #include <vector>
+#include <string>
+#include <utility>
 #include <Eigen/Dense>
 
+#include "nnetcppconfig.h"
+
 class NetworkSerializer;
 
-// Typedefs so that using doubles instead of singles is easy
-typedef Eigen::VectorXf Vector;
-typedef Eigen::MatrixXf Matrix;
+// Scalar type used by all the nodes, double if NNETCPP_DOUBLE is defined in
+// nnetcppconfig.h (the DOUBLE CMake option)
+#ifdef NNETCPP_DOUBLE
+typedef double Float;
+#else
 typedef float Float;
+#endif
+
+typedef Eigen::Matrix<Float, Eigen::Dynamic, 1> Vector;
+typedef Eigen::Matrix<Float, Eigen::Dynamic, Eigen::Dynamic> Matrix;
 
 /**
  * @brief Node in a neural network
@@ -58,16 +68,50 @@ class AbstractNode
          * A port has a value (what has been predicted or produced) and an error.
          * Nodes update the errors of their input ports, and produce values on
          * their output ports.
+         *
+         * Values and errors are matrices having one row per neuron and one
+         * column per sample of the current minibatch. When a single sample is
+         * processed, they have only one column and can be used as vectors.
          */
         struct Port
         {
-            Vector value;   /*!< @brief Value of this port, produced by its owner */
-            Vector error;   /*!< @brief Error of this port, updated by its consumers */
+            Matrix value;   /*!< @brief Value of this port, produced by its owner */
+            Matrix error;   /*!< @brief Error of this port, updated by its consumers */
+        };
+
+        /**
+         * @brief Format in which the parameters of a node are stored
+         */
+        enum Precision
+        {
+            Full,       /*!< @brief Float, the default */
+            Half,       /*!< @brief IEEE 754 16-bit floating point numbers */
+            BFloat16    /*!< @brief 16 upper bits of a 32-bit float (same range, less precise than Half) */
+        };
+
+        /**
+         * @brief Type, parameters and inputs of a node, from which
+         *        Network::rebuild() builds the same node
+         */
+        struct Description
+        {
+            std::string type;                                           /*!< @brief Name of the class of the node, empty if it cannot be described */
+            std::vector<std::pair<std::string, double> > parameters;    /*!< @brief Arguments of the constructor and options, by name */
+            std::vector<std::pair<std::string, Port *> > inputs;        /*!< @brief Input ports, with the name of the method that connects them */
         };
 
         AbstractNode() {}
         virtual ~AbstractNode() {}
 
+        /**
+         * @brief Fill @p description with the type, parameters and inputs of
+         *        this node
+         *
+         * The default implementation leaves the type empty: the node cannot
+         * be described.
+         */
+        virtual void describe(Description &description) { (void) description; }
+
         /**
          * @brief Serialize the weights of this node (if any)
          */
@@ -83,6 +127,57 @@ class AbstractNode
          */
         virtual Port *output() = 0;
 
+        /**
+         * @brief Ports read by this node during its forward pass
+         *
+         * This is used to analyze the graph of nodes. Nodes that do not
+         * implement this method are considered as depending on unknown ports.
+         */
+        virtual std::vector<Port *> inputs() { return std::vector<Port *>(); }
+
+        /**
+         * @brief Read @p by instead of @p port, that is one of inputs()
+         *
+         * This is used to simplify the graph of nodes (see Network::optimize).
+         * Nodes that do not implement this method return false and are left
+         * unchanged.
+         */
+        virtual bool replaceInput(Port *port, Port *by) { (void) port; (void) by; return false; }
+
+        /**
+         * @brief Append to @p ports the ports produced by this node and its
+         *        sub-nodes, whose values describe the state of the node after
+         *        a forward pass.
+         */
+        virtual void collectPorts(std::vector<Port *> &ports) { ports.push_back(output()); }
+
+        /**
+         * @brief Append to @p states the blocks of the recurrent storage that
+         *        contain the values at the previous time step, in streaming mode.
+         *
+         * Each block has one column per stream. They remain valid until the
+         * batch size or the streaming mode change.
+         */
+        virtual void collectStates(std::vector<Matrix::ColsBlockXpr> &states) { (void) states; }
+
+        /**
+         * @brief Number of rows of the blocks listed by collectStates(), that
+         *        is the number of values in the recurrent state of one stream.
+         */
+        virtual unsigned int stateSize() { return 0; }
+
+        /**
+         * @brief Whether the output of this node depends on previous time steps
+         */
+        virtual bool isRecurrent() { return false; }
+
+        /**
+         * @brief Number of time steps after which the behavior of this node
+         *        repeats itself, for instance 1 if it does not depend on the
+         *        time step.
+         */
+        virtual unsigned int period() { return 1; }
+
         /**
          * @brief Forward pass from the inputs to the outputs of this node
          */
@@ -111,6 +206,74 @@ class AbstractNode
          */
         virtual void reset() {}
 
+        /**
+         * @brief Set the number of samples (columns of the ports) processed
+         *        at once by this node.
+         *
+         * The default implementation resizes the output port of the node and
+         * clears its value and error. The error of a frozen node stays empty.
+         */
+        virtual void setBatchSize(unsigned int batch_size)
+        {
+            Port *port = output();
+
+            port->value.setZero(port->value.rows(), batch_size);
+            port->error.setZero(port->error.rows(), batch_size);
+        }
+
+        /**
+         * @brief Release the memory used only by backward() and update()
+         *
+         * A frozen node can only be used for inference, the errors of its
+         * ports being empty. The default implementation releases the error
+         * of the output port.
+         */
+        virtual void freeze()
+        {
+            output()->error.resize(0, 0);
+        }
+
+        /**
+         * @brief Store the parameters of this node with a reduced precision,
+         *        for inference only
+         *
+         * The node is frozen first (see freeze()). The default implementation
+         * does nothing.
+         *
+         * @return Number of nodes that have been quantized
+         */
+        virtual unsigned int quantize() { return 0; }
+
+        /**
+         * @brief Store the parameters of this node in @p precision
+         *
+         * The computations are still performed in Float. The default
+         * implementation does nothing.
+         *
+         * @return Number of nodes whose precision has been changed
+         */
+        virtual unsigned int setPrecision(Precision precision) { (void) precision; return 0; }
+
+        /**
+         * @brief Enable or disable the streaming mode of this node
+         *
+         * In streaming mode, the node is only forwarded, one time step after
+         * the other, and does not keep anything that would be needed by a
+         * backward pass. The default implementation releases the error of the
+         * output port, and gives it back the shape of the value when the
+         * streaming mode is disabled (the error of a frozen node stays empty).
+         */
+        virtual void setStreaming(bool streaming)
+        {
+            Port *port = output();
+
+            if (streaming) {
+                port->error.resize(port->error.rows(), 0);
+            } else {
+                port->error.setZero(port->error.rows(), port->value.cols());
+            }
+        }
+
         /**
          * @brief If the input is a sequence, inform the node of a new position
          *        in the sequence.
@@ -23,18 +23,20 @@
 #include "abstractrecurrentnetworknode.h"
 
 #include <assert.h>
+#include <algorithm>
 
 AbstractRecurrentNetworkNode::BpttVariant AbstractRecurrentNetworkNode::bptt_variant = AbstractRecurrentNetworkNode::Standard;
+unsigned int AbstractRecurrentNetworkNode::checkpoint_interval = 0;
 
 AbstractRecurrentNetworkNode::AbstractRecurrentNetworkNode()
-: _timestep(0)
+: _timestep(0),
+  _streaming(false),
+  _frozen(false)
 {
 }
 
 AbstractRecurrentNetworkNode::~AbstractRecurrentNetworkNode()
 {
-    // Ensure that the storage is emptied
-    reset();
 }
 
 void AbstractRecurrentNetworkNode::addRecurrentNode(AbstractNode *node)
@@ -42,10 +44,57 @@ void AbstractRecurrentNetworkNode::addRecurrentNode(AbstractNode *node)
     N n;
 
     n.node = node;
+    n.used_values = 0;
+    n.used_errors = 0;
 
     _recurrent_nodes.push_back(n);
 }
 
+bool AbstractRecurrentNetworkNode::isRecurrent()
+{
+    return true;
+}
+
+void AbstractRecurrentNetworkNode::collectStates(std::vector<Matrix::ColsBlockXpr> &states)
+{
+    assert(_streaming);
+
+    AbstractNetworkNode::collectStates(states);
+
+    // In streaming mode, the single slot contains the values at t-1 when
+    // setCurrentTimestep() reads it, and the values at t after forward()
+    for (N &n : _recurrent_nodes) {
+        states.push_back(valueSlot(n, 0));
+    }
+}
+
+unsigned int AbstractRecurrentNetworkNode::stateSize()
+{
+    unsigned int rs = AbstractNetworkNode::stateSize();
+
+    for (N &n : _recurrent_nodes) {
+        rs += n.node->output()->value.rows();
+    }
+
+    return rs;
+}
+
+bool AbstractRecurrentNetworkNode::isRecurrentNode(AbstractNode *node)
+{
+    for (N &n : _recurrent_nodes) {
+        if (n.node == node) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+bool AbstractRecurrentNetworkNode::isBackEdge(AbstractNode *node)
+{
+    return isRecurrentNode(node);
+}
+
 void AbstractRecurrentNetworkNode::forward()
 {
     AbstractNetworkNode::forward();
@@ -56,9 +105,13 @@ void AbstractRecurrentNetworkNode::forwardRecurrent()
 {
     // Copy the value of the recurrent nodes to the storage
     for (N &n : _recurrent_nodes) {
-        assert(n.storage.size() > _timestep);
+        valueSlot(n, _timestep) = n.node->output()->value;
 
-        n.storage[_timestep]->value = n.node->output()->value;
+        if (!_streaming && checkpoint_interval != 0 && _timestep % checkpoint_interval == checkpoint_interval - 1) {
+            // End of a segment, keep its value so that the next segment can
+            // be forwarded again
+            checkpointSlot(n, _timestep) = n.node->output()->value;
+        }
     }
 }
 
@@ -70,10 +123,15 @@ void AbstractRecurrentNetworkNode::backward()
 
 void AbstractRecurrentNetworkNode::backwardRecurrent()
 {
+    // Nothing is kept for a backward pass in streaming mode
+    assert(!_streaming && !_frozen);
+
     // Copy the error of the recurrent nodes in the storage at previous time step
     if (_timestep > 0) {
         for (N &n : _recurrent_nodes) {
-            assert(n.storage.size() > _timestep);
+            // Get error[t] first, so that error[t-1] cannot be moved by a
+            // growth of the storage
+            Slot error = errorSlot(n, _timestep);
 
             switch (bptt_variant) {
             case Standard:
@@ -81,7 +139,7 @@ void AbstractRecurrentNetworkNode::backwardRecurrent()
                 // before backprop started, and that therefore has to be removed
                 // so that the node error contains only the error from the current
                 // time step
-                n.storage[_timestep - 1]->error = (n.node->output()->error - n.storage[_timestep]->error).cwiseMin(10.0f).cwiseMax(-10.0f);
+                errorSlot(n, _timestep - 1) = (n.node->output()->error - error).cwiseMin(Float(10)).cwiseMax(Float(-10));
                 break;
 
             case Experimental:
@@ -89,7 +147,7 @@ void AbstractRecurrentNetworkNode::backwardRecurrent()
                 // the error of this node is not cleared between time steps.
                 // Divide by the sequence length in order to avoid an exponential
                 // increase of the error over time.
-                n.storage[_timestep - 1]->error = n.node->output()->error * _error_normalization;
+                errorSlot(n, _timestep - 1) = n.node->output()->error * _error_normalization;
                 break;
             }
         }
@@ -101,47 +159,102 @@ void AbstractRecurrentNetworkNode::reset()
     AbstractNetworkNode::reset();
 
     // Clear the storage
-    for (N &n : _recurrent_nodes) {
-        for (Port *port : n.storage) {
-            delete port;
-        }
-
-        n.storage.clear();
-    }
+    clearStorage();
 
     // Reset the timestep counter, so that a next sequence can be shorter than
     // the one just finished.
     _max_timestep = 0;
 }
 
-void AbstractRecurrentNetworkNode::setCurrentTimestep(unsigned int timestep)
+void AbstractRecurrentNetworkNode::setBatchSize(unsigned int batch_size)
 {
-    // Let AbstractNetworkNode reset the error signals of all the nodes in the cell.
-    AbstractNetworkNode::setCurrentTimestep(timestep);
+    AbstractNetworkNode::setBatchSize(batch_size);
 
+    // The stored time steps have the shape of the previous batch and cannot
+    // be used anymore
+    clearStorage();
+}
+
+void AbstractRecurrentNetworkNode::setStreaming(bool streaming)
+{
+    AbstractNetworkNode::setStreaming(streaming);
+
+    _streaming = streaming;
+
+    // Release the memory used by the time steps of previous sequences, the
+    // layout of the storage changes.
     for (N &n : _recurrent_nodes) {
-        assert(timestep <= n.storage.size());
+        n.values = Matrix();
+        n.errors = Matrix();
+        n.used_values = 0;
+        n.used_errors = 0;
+    }
+}
 
-        // Add a new port if needed
-        if (timestep == n.storage.size()) {
-            int size = n.node->output()->value.rows();
+void AbstractRecurrentNetworkNode::freeze()
+{
+    AbstractNetworkNode::freeze();
 
-            n.storage.push_back(new Port);
+    _frozen = true;
 
-            n.storage.back()->value = Vector::Zero(size);
-            n.storage.back()->error = Vector::Zero(size);
+    for (N &n : _recurrent_nodes) {
+        n.errors = Matrix();
+        n.used_errors = 0;
+    }
+}
+
+bool AbstractRecurrentNetworkNode::isFrozen()
+{
+    return _frozen;
+}
+
+bool AbstractRecurrentNetworkNode::isStreaming()
+{
+    return _streaming;
+}
+
+void AbstractRecurrentNetworkNode::clearStorage()
+{
+    for (N &n : _recurrent_nodes) {
+        n.values.leftCols(n.used_values).setZero();
+        n.errors.leftCols(n.used_errors).setZero();
+
+        n.used_values = 0;
+        n.used_errors = 0;
+    }
+}
+
+void AbstractRecurrentNetworkNode::setCurrentTimestep(unsigned int timestep)
+{
+    if (!_streaming) {
+        // Let AbstractNetworkNode reset the error signals of all the nodes in the cell.
+        AbstractNetworkNode::setCurrentTimestep(timestep);
+    } else {
+        // There is no error to reset, and forward() overwrites the values.
+        // Only the nodes whose behavior depends on the time step need it.
+        for (AbstractNode *node : _nodes) {
+            if (node->isRecurrent() || node->period() != 1) {
+                node->setCurrentTimestep(timestep);
+            }
         }
+    }
 
-        if (timestep > 0) {
-            // Set the value of the recurrent connection to the value at time t-1
-            n.node->output()->value = n.storage[timestep - 1]->value;
-        } else {
+    for (N &n : _recurrent_nodes) {
+        if (timestep == 0) {
             // Reset the recurrent value
             n.node->output()->value.setZero();
+        } else if (!_streaming && checkpoint_interval != 0 && timestep % checkpoint_interval == 0) {
+            // First time step of a segment, start from the end of the previous one
+            n.node->output()->value = checkpointSlot(n, timestep - 1);
+        } else {
+            // Set the value of the recurrent connection to the value at time t-1
+            n.node->output()->value = valueSlot(n, timestep - 1);
         }
 
         // Set the error of the recurrent node to the error computed at time t
-        n.node->output()->error = n.storage[timestep]->error;
+        if (!_streaming && !_frozen) {
+            n.node->output()->error = errorSlot(n, timestep);
+        }
     }
 
     // Use the timestep
@@ -150,7 +263,60 @@ void AbstractRecurrentNetworkNode::setCurrentTimestep(unsigned int timestep)
     // Keep track of the length of the sequence, this is used for normalizing
     // backpropagated errors
     _max_timestep = std::max(_max_timestep, timestep);
-    _error_normalization = 1.0f / float(_max_timestep);
+    _error_normalization = Float(1) / Float(_max_timestep);
+}
+
+AbstractRecurrentNetworkNode::Slot AbstractRecurrentNetworkNode::slot(N &n, Matrix &storage, int &used, unsigned int index)
+{
+    int size = n.node->output()->value.rows();
+    int batch_size = n.node->output()->value.cols();
+    int end = (index + 1) * batch_size;
+
+    if (storage.rows() != size) {
+        // First use of the storage
+        storage.resize(size, 0);
+    }
+
+    if (end > storage.cols()) {
+        // Double the capacity, so that long sequences only cause a logarithmic
+        // number of allocations
+        int capacity = storage.cols();
+        int new_capacity = std::max(end, 2 * capacity);
+
+        storage.conservativeResize(Eigen::NoChange, new_capacity);
+        storage.rightCols(new_capacity - capacity).setZero();
+    }
+
+    used = std::max(used, end);
+
+    return storage.middleCols(index * batch_size, batch_size);
+}
+
+AbstractRecurrentNetworkNode::Slot AbstractRecurrentNetworkNode::valueSlot(N &n, unsigned int timestep)
+{
+    if (_streaming) {
+        // The value at t-1 is read before the one at t is written
+        return slot(n, n.values, n.used_values, 0);
+    } else if (checkpoint_interval == 0) {
+        return slot(n, n.values, n.used_values, timestep);
+    } else {
+        return slot(n, n.values, n.used_values, timestep % checkpoint_interval);
+    }
+}
+
+AbstractRecurrentNetworkNode::Slot AbstractRecurrentNetworkNode::checkpointSlot(N &n, unsigned int timestep)
+{
+    return slot(n, n.values, n.used_values, checkpoint_interval + timestep / checkpoint_interval);
+}
+
+AbstractRecurrentNetworkNode::Slot AbstractRecurrentNetworkNode::errorSlot(N &n, unsigned int timestep)
+{
+    if (checkpoint_interval == 0) {
+        return slot(n, n.errors, n.used_errors, timestep);
+    } else {
+        // Errors only flow from t to t-1, two slots are enough
+        return slot(n, n.errors, n.used_errors, timestep % 2);
+    }
 }
 
 unsigned int AbstractRecurrentNetworkNode::currentTimestep()
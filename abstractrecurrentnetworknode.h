@@ -47,6 +47,22 @@ class AbstractRecurrentNetworkNode : public AbstractNetworkNode
 
         static BpttVariant bptt_variant;
 
+        /**
+         * @brief Number of time steps between two checkpoints of the recurrent
+         *        values, 0 to store the values of all the time steps.
+         *
+         * When this is not zero, only the values of the current segment of
+         * checkpoint_interval time steps, the values at the end of every segment
+         * and the errors of two consecutive time steps are stored. Going back
+         * to a previous segment requires to forward it again from the checkpoint
+         * that precedes it, which Network::trainSequence() does. An interval of
+         * sqrt(T) gives a memory usage in O(sqrt(T)) instead of O(T), at the
+         * cost of one more forward pass.
+         *
+         * @note This value must only be changed between sequences.
+         */
+        static unsigned int checkpoint_interval;
+
     public:
         AbstractRecurrentNetworkNode();
         virtual ~AbstractRecurrentNetworkNode();
@@ -57,14 +73,55 @@ class AbstractRecurrentNetworkNode : public AbstractNetworkNode
          */
         void addRecurrentNode(AbstractNode *node);
 
+        virtual bool isRecurrent();
+        virtual void collectStates(std::vector<Matrix::ColsBlockXpr> &states);
+        virtual unsigned int stateSize();
+
         virtual void forward();
         virtual void backward();
         virtual void reset();
+        virtual void setBatchSize(unsigned int batch_size);
+
+        /**
+         * @brief Enable or disable the streaming mode
+         *
+         * In streaming mode, only the values of the recurrent nodes at the
+         * previous time step are stored, whatever the length of the sequence,
+         * and no error is stored at all. backward() cannot be used.
+         */
+        virtual void setStreaming(bool streaming);
+
+        /**
+         * @brief Release the errors of the sub-nodes and of the recurrent
+         *        storage. backward() cannot be used anymore.
+         */
+        virtual void freeze();
 
         virtual void setCurrentTimestep(unsigned int timestep);
         unsigned int currentTimestep();
 
     protected:
+        /**
+         * @brief Whether the streaming mode is enabled
+         */
+        bool isStreaming();
+
+        /**
+         * @brief Whether freeze() has been called
+         */
+        bool isFrozen();
+
+        /**
+         * @brief Whether @p node has been registered using addRecurrentNode()
+         */
+        bool isRecurrentNode(AbstractNode *node);
+
+        /**
+         * @brief The readers of a recurrent node read its value at the
+         *        previous time step
+         */
+        virtual bool isBackEdge(AbstractNode *node);
+
         /**
          * @brief Copy the values of the recurrent nodes from time t to time t+1
          */
@@ -79,12 +136,59 @@ class AbstractRecurrentNetworkNode : public AbstractNetworkNode
         struct N
         {
             AbstractNode *node;
-            std::vector<Port *> storage;
+            Matrix values;      /*!< @brief Value slots, one block of batch size columns per slot */
+            Matrix errors;      /*!< @brief Error slots, same layout as values */
+            int used_values;    /*!< @brief Number of columns of values used since the last reset */
+            int used_errors;    /*!< @brief Number of columns of errors used since the last reset */
         };
 
+        typedef Matrix::ColsBlockXpr Slot;
+
+        /**
+         * @brief Zero the values and errors stored for all the time steps
+         *
+         * The memory is kept, so that the next sequence does not allocate
+         * anything if it is not longer than the previous ones.
+         */
+        void clearStorage();
+
+        /**
+         * @brief Slot @p index of @p storage (values or errors of @p n)
+         *
+         * The storage grows geometrically when @p index is past its end. The
+         * new slots are zeroed.
+         */
+        Slot slot(N &n, Matrix &storage, int &used, unsigned int index);
+
+        /**
+         * @brief Slot containing the value of @p n at time @p timestep
+         *
+         * Without checkpointing, there is one slot per time step. In streaming
+         * mode, there is only one slot, overwritten at every time step. With
+         * checkpointing, the checkpoint_interval first slots contain the
+         * values of the current segment, and the next ones the values at the
+         * end of the segments (see checkpointSlot()).
+         */
+        Slot valueSlot(N &n, unsigned int timestep);
+
+        /**
+         * @brief Slot containing the value of @p n at the end of the segment
+         *        containing @p timestep.
+         */
+        Slot checkpointSlot(N &n, unsigned int timestep);
+
+        /**
+         * @brief Slot containing the error of @p n at time @p timestep
+         */
+        Slot errorSlot(N &n, unsigned int timestep);
+
+    private:
+
         unsigned int _timestep;
         unsigned int _max_timestep;
-        float _error_normalization;
+        bool _streaming;
+        bool _frozen;
+        Float _error_normalization;
 
         std::vector<N> _recurrent_nodes;
 };
@@ -25,6 +25,36 @@
 
 #include "abstractnode.h"
 
+#include <type_traits>
+
+/**
+ * @brief Evaluation of the tanh and sigmoid functions, shared by the
+ *        activation nodes and the nodes computing activations themselves
+ */
+class ActivationFunctions
+{
+    public:
+        enum Approximation {
+            Precise,            /*!< @brief 2 / (1 + exp(-2x)) - 1 and 1 / (1 + exp(-x)), the argument of exp being clamped to [-30, 30] */
+            Fast                /*!< @brief Rational approximation of tanh, sigmoid(x) being 0.5 * tanh(x / 2) + 0.5. Maximum absolute error of 4e-7 for tanh and 2e-7 for sigmoid, about twice as fast as Precise. The approximation is only accurate to a float, Precise is used instead when Float is double. */
+        };
+
+        /**
+         * @brief Approximation used by the functions, read when an expression
+         *        using them is built. Precise by default.
+         */
+        static Approximation approximation;
+
+        /**
+         * @brief Whether the functions use the Fast approximation, that is
+         *        never the case when Float is double
+         */
+        static bool fast()
+        {
+            return approximation == Fast && std::is_same<Float, float>::value;
+        }
+};
+
 /**
  * @brief Template class for activation layers
  */
@@ -51,11 +81,31 @@ class Activation : public AbstractNode
             _input = input;
         }
 
+        virtual void describe(Description &description)
+        {
+            description.type = std::string(F::name()) + "Activation";
+            description.inputs.push_back(std::make_pair("setInput", _input));
+        }
+
         virtual Port *output()
         {
             return &_output;
         }
 
+        virtual std::vector<Port *> inputs()
+        {
+            return std::vector<Port *>{_input};
+        }
+
+        virtual bool replaceInput(Port *port, Port *by)
+        {
+            if (_input == port) {
+                _input = by;
+            }
+
+            return true;
+        }
+
         virtual void forward()
         {
             _output.value.noalias() = _input->value.unaryExpr<F>();
@@ -86,48 +136,128 @@ class Activation : public AbstractNode
 namespace nnetcppinternal
 {
 
-inline Float _exp(Float x)
+// The functors below are written once for a Float and for an Eigen packet, so
+// that unaryExpr() evaluates them with SSE, AVX or AVX-512 instructions
+// (depending on the instruction set the code is compiled for). A Float and a
+// packet may differ by one unit in the last place, exp() being computed by the
+// standard library for a Float.
+
+/**
+ * @brief exp(x), x being clamped to [-30, 30]
+ */
+template<typename T>
+inline T _exp(const T &x)
 {
+    using namespace Eigen::internal;
+
     // The constant 30 is also used by CLSTM
-    if (x < -30.0f) return std::exp(-30.0f);
-    if (x > 30.0f) return std::exp(30.0f);
-    return std::exp(x);
+    return pexp(pmax(pmin(x, pset1<T>(30.0f)), pset1<T>(-30.0f)));
 }
 
 struct Tanh
 {
+    static const char *name() { return "Tanh"; }
+
+    Tanh() : fast(ActivationFunctions::fast()) {}
+
+    template<typename T>
+    T packetOp(const T &x) const
+    {
+        using namespace Eigen::internal;
+
+        if (fast) {
+            return generic_fast_tanh_float(x);
+        }
+
+        // 2 / (1 + exp(-2x)) - 1
+        return psub(
+            pdiv(pset1<T>(2.0f), padd(pset1<T>(1.0f), _exp(pmul(pset1<T>(-2.0f), x)))),
+            pset1<T>(1.0f)
+        );
+    }
+
     Float operator()(Float x) const
     {
-        return 2.0f / (1.0f + _exp(-2.0f * x)) - 1.0f;
+        return packetOp(x);
     }
+
+    bool fast;
 };
 
 struct dTanh
 {
+    template<typename T>
+    T packetOp(const T &y) const
+    {
+        using namespace Eigen::internal;
+
+        // 1 - y*y
+        return psub(pset1<T>(1.0f), pmul(y, y));
+    }
+
     Float operator()(Float y) const
     {
-        return 1.0f - y*y;
+        return packetOp(y);
     }
 };
 
 struct Sigmoid
 {
+    static const char *name() { return "Sigmoid"; }
+
+    Sigmoid() : fast(ActivationFunctions::fast()) {}
+
+    template<typename T>
+    T packetOp(const T &x) const
+    {
+        using namespace Eigen::internal;
+
+        if (fast) {
+            // sigmoid(x) = 0.5 * tanh(x / 2) + 0.5
+            const T half = pset1<T>(0.5f);
+
+            return pmadd(half, generic_fast_tanh_float(pmul(half, x)), half);
+        }
+
+        // 1 / (1 + exp(-x))
+        return pdiv(pset1<T>(1.0f), padd(pset1<T>(1.0f), _exp(pnegate(x))));
+    }
+
     Float operator()(Float x) const
     {
-        return 1.0f / (1.0f + _exp(-x));
+        return packetOp(x);
     }
+
+    bool fast;
 };
 
 struct dSigmoid
 {
+    template<typename T>
+    T packetOp(const T &y) const
+    {
+        using namespace Eigen::internal;
+
+        // y * (1 - y)
+        return pmul(y, psub(pset1<T>(1.0f), y));
+    }
+
     Float operator()(Float y) const
     {
-        return y * (1.0f - y);
+        return packetOp(y);
     }
 };
 
 struct OneMinus
 {
+    static const char *name() { return "OneMinus"; }
+
+    template<typename T>
+    T packetOp(const T &x) const
+    {
+        return Eigen::internal::psub(Eigen::internal::pset1<T>(1.0f), x);
+    }
+
     Float operator()(Float x) const
     {
         return 1.0f - x;
@@ -136,6 +266,13 @@ struct OneMinus
 
 struct dOneMinus
 {
+    template<typename T>
+    T packetOp(const T &y) const
+    {
+        (void) y;
+        return Eigen::internal::pset1<T>(-1.0f);
+    }
+
     Float operator()(Float y) const
     {
         (void) y;
@@ -145,6 +282,14 @@ struct dOneMinus
 
 struct Linear
 {
+    static const char *name() { return "Linear"; }
+
+    template<typename T>
+    T packetOp(const T &x) const
+    {
+        return x;
+    }
+
     Float operator()(Float x) const
     {
         return x;
@@ -153,6 +298,13 @@ struct Linear
 
 struct dLinear
 {
+    template<typename T>
+    T packetOp(const T &y) const
+    {
+        (void) y;
+        return Eigen::internal::pset1<T>(1.0f);
+    }
+
     Float operator()(Float y) const
     {
         (void) y;
@@ -162,6 +314,24 @@ struct dLinear
 
 }
 
+namespace Eigen
+{
+namespace internal
+{
+
+// Let Eigen use packetOp() (the costs are rough numbers of instructions)
+template<> struct functor_traits<nnetcppinternal::Tanh> { enum { Cost = 20, PacketAccess = true }; };
+template<> struct functor_traits<nnetcppinternal::dTanh> { enum { Cost = 2, PacketAccess = true }; };
+template<> struct functor_traits<nnetcppinternal::Sigmoid> { enum { Cost = 20, PacketAccess = true }; };
+template<> struct functor_traits<nnetcppinternal::dSigmoid> { enum { Cost = 2, PacketAccess = true }; };
+template<> struct functor_traits<nnetcppinternal::OneMinus> { enum { Cost = 1, PacketAccess = true }; };
+template<> struct functor_traits<nnetcppinternal::dOneMinus> { enum { Cost = 1, PacketAccess = true }; };
+template<> struct functor_traits<nnetcppinternal::Linear> { enum { Cost = 1, PacketAccess = true }; };
+template<> struct functor_traits<nnetcppinternal::dLinear> { enum { Cost = 1, PacketAccess = true }; };
+
+}
+}
+
 // Instantiate the Activation templates
 /**
  * @brief Tanh (output from -1 to 1) activation
@@ -0,0 +1,253 @@
+/*
+ * Copyright (c) 2015 Vrije Universiteit Brussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "checkpointer.h"
+#include "network.h"
+
+#include <assert.h>
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+/**
+ * @brief Flush to the disk the file or directory @p filename
+ */
+static void sync(const std::string &filename)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+
+    if (fd == -1) {
+        throw std::runtime_error("Checkpointer: cannot open " + filename);
+    }
+
+    int rs = fsync(fd);
+
+    close(fd);
+
+    if (rs != 0) {
+        throw std::runtime_error("Checkpointer: cannot flush " + filename + " to the disk");
+    }
+}
+
+/**
+ * @brief Highest index of the checkpoints "<filename>.<index>" on the disk,
+ *        0 if there are none
+ */
+static unsigned long lastIndex(const std::string &filename)
+{
+    std::size_t slash = filename.find_last_of('/');
+    std::string directory = (slash == std::string::npos ? std::string(".") : filename.substr(0, slash + 1));
+    std::string prefix = filename.substr(slash == std::string::npos ? 0 : slash + 1) + ".";
+    DIR *dir = opendir(directory.c_str());
+    unsigned long rs = 0;
+
+    if (dir == nullptr) {
+        return 0;
+    }
+
+    while (struct dirent *entry = readdir(dir)) {
+        std::string name = entry->d_name;
+
+        // Only the complete checkpoints, without ".tmp"
+        if (name.size() > prefix.size() &&
+            name.compare(0, prefix.size(), prefix) == 0 &&
+            name.find_first_not_of("0123456789", prefix.size()) == std::string::npos) {
+            rs = std::max(rs, std::stoul(name.substr(prefix.size())));
+        }
+    }
+
+    closedir(dir);
+
+    return rs;
+}
+
+Checkpointer::Checkpointer(const std::string &filename,
+                           unsigned int keep,
+                           NetworkSerializer::Mode mode)
+: _filename(filename),
+  _keep(keep),
+  _mode(mode),
+  _next(0),
+  _latest(lastIndex(filename)),
+  _stop(false)
+{
+    assert(keep > 0);
+
+    // Continue after the checkpoints of a previous training, that are not
+    // overwritten
+    _index = _latest + 1;
+
+    _thread = std::thread(&Checkpointer::work, this);
+}
+
+Checkpointer::~Checkpointer()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        _stop = true;
+    }
+
+    // The thread writes the checkpoints still queued before it stops
+    _queued.notify_one();
+    _thread.join();
+}
+
+std::string Checkpointer::save(Network *network)
+{
+    NetworkSerializer &snapshot = _snapshots[_next];
+
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+
+        // The snapshot to fill may still be queued, the other one being the
+        // last checkpoint queued
+        _written.wait(lock, [this]() {
+            return std::none_of(_queue.begin(), _queue.end(), [this](const std::pair<unsigned int, unsigned long> &job) {
+                return job.first == _next;
+            });
+        });
+
+        rethrow();
+    }
+
+    // The thread does not use this snapshot, that is filled without the lock
+    snapshot.clear();
+    snapshot.setMode(_mode);
+    network->serialize(snapshot);
+
+    unsigned long index = _index++;
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        _queue.push_back(std::make_pair(_next, index));
+    }
+
+    _queued.notify_one();
+    _next = 1 - _next;
+
+    return name(index);
+}
+
+void Checkpointer::wait()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    _written.wait(lock, [this]() { return _queue.empty(); });
+
+    rethrow();
+}
+
+std::string Checkpointer::latest()
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    return _latest == 0 ? std::string() : name(_latest);
+}
+
+std::string Checkpointer::name(unsigned long index) const
+{
+    return _filename + "." + std::to_string(index);
+}
+
+void Checkpointer::work()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (true) {
+        _queued.wait(lock, [this]() { return _stop || !_queue.empty(); });
+
+        if (_queue.empty()) {
+            return;
+        }
+
+        // The job stays in the queue while it is written, so that save()
+        // does not fill its snapshot
+        std::pair<unsigned int, unsigned long> job = _queue.front();
+
+        lock.unlock();
+
+        try {
+            write(_snapshots[job.first], job.second);
+
+            lock.lock();
+            _latest = job.second;
+        } catch (const std::exception &) {
+            lock.lock();
+            _error = std::current_exception();
+        }
+
+        _queue.pop_front();
+        _written.notify_all();
+    }
+}
+
+void Checkpointer::write(NetworkSerializer &snapshot, unsigned long index)
+{
+    std::string filename = name(index);
+    std::string temporary = filename + ".tmp";
+
+    {
+        std::ofstream s(temporary, std::ios::binary | std::ios::trunc);
+
+        snapshot.save(s);
+        s.close();
+
+        if (!s) {
+            std::remove(temporary.c_str());
+            throw std::runtime_error("Checkpointer: cannot write " + temporary);
+        }
+    }
+
+    // Flush the file before renaming it, so that a crash leaves either no
+    // file or a complete one under the final name
+    sync(temporary);
+
+    if (std::rename(temporary.c_str(), filename.c_str()) != 0) {
+        std::remove(temporary.c_str());
+        throw std::runtime_error("Checkpointer: cannot rename " + temporary + " to " + filename);
+    }
+
+    std::size_t slash = filename.find_last_of('/');
+
+    sync(slash == std::string::npos ? std::string(".") : filename.substr(0, slash + 1));
+
+    if (index > _keep) {
+        std::remove(name(index - _keep).c_str());
+    }
+}
+
+void Checkpointer::rethrow()
+{
+    if (_error) {
+        std::exception_ptr error = _error;
+
+        _error = nullptr;
+        std::rethrow_exception(error);
+    }
+}
@@ -0,0 +1,150 @@
+/*
+ * Copyright (c) 2015 Vrije Universiteit Brussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __CHECKPOINTER_H__
+#define __CHECKPOINTER_H__
+
+#include "networkserializer.h"
+
+#include <string>
+#include <deque>
+#include <utility>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+
+class Network;
+
+/**
+ * @brief Save checkpoints of a network during its training, in a background
+ *        thread
+ *
+ * save() copies the weights of the network into a serializer, which is all
+ * the training loop waits for, and a thread writes this copy to a file.
+ * Two serializers are used in turn, so that a snapshot can be taken while
+ * the previous one is being written. Their memory is kept from one
+ * checkpoint to the next.
+ *
+ * Checkpoint n is written to "<filename>.<n>.tmp", which is flushed to the
+ * disk and renamed to "<filename>.<n>". A file of that name is therefore
+ * always complete. Only the last checkpoints are kept.
+ *
+ * The checkpoints are numbered after the ones already on the disk, so that
+ * a training that is resumed with the same filename does not overwrite the
+ * checkpoints it was resumed from. The oldest of them are removed as new
+ * checkpoints are written.
+ */
+class Checkpointer
+{
+    public:
+        /**
+         * @param filename Prefix of the names of the checkpoints
+         * @param keep Number of checkpoints kept, the older ones being removed
+         * @param mode What the checkpoints contain (see NetworkSerializer::Mode)
+         */
+        Checkpointer(const std::string &filename,
+                     unsigned int keep = 3,
+                     NetworkSerializer::Mode mode = NetworkSerializer::Checkpoint);
+
+        /**
+         * @brief Wait for the checkpoints being written
+         */
+        ~Checkpointer();
+
+        Checkpointer(const Checkpointer &) = delete;
+        Checkpointer &operator=(const Checkpointer &) = delete;
+
+        /**
+         * @brief Take a snapshot of @p network and write it in the background
+         *
+         * This must be called between two updates of the network, for
+         * instance between two calls to Network::train(). It returns once the
+         * weights are copied, unless two checkpoints are still being written,
+         * in which case it first waits for the oldest one.
+         *
+         * @return Name of the file that will contain the checkpoint
+         * @throw std::runtime_error if a previous checkpoint could not be
+         *        written
+         */
+        std::string save(Network *network);
+
+        /**
+         * @brief Wait until all the checkpoints have been written
+         *
+         * @throw std::runtime_error if a checkpoint could not be written
+         */
+        void wait();
+
+        /**
+         * @brief Name of the last checkpoint completely written, or an empty
+         *        string
+         *
+         * Before the first checkpoint is written, this is the last one found
+         * on the disk when this object was created.
+         */
+        std::string latest();
+
+    private:
+        /**
+         * @brief Name of checkpoint @p index
+         */
+        std::string name(unsigned long index) const;
+
+        /**
+         * @brief Write @p snapshot to checkpoint @p index, then remove the
+         *        checkpoint that is no longer kept
+         */
+        void write(NetworkSerializer &snapshot, unsigned long index);
+
+        /**
+         * @brief Main loop of the writing thread
+         */
+        void work();
+
+        /**
+         * @brief Throw the error of the writing thread, if any, and forget it.
+         *        _mutex must be locked.
+         */
+        void rethrow();
+
+    private:
+        std::string _filename;
+        unsigned int _keep;
+        NetworkSerializer::Mode _mode;
+
+        NetworkSerializer _snapshots[2];
+        unsigned int _next;                     /*!< @brief Snapshot filled by the next save() */
+        unsigned long _index;                   /*!< @brief Index of the next checkpoint, starting after the ones on the disk */
+
+        std::thread _thread;
+        std::mutex _mutex;                      /*!< @brief Protects the members below */
+        std::condition_variable _queued;
+        std::condition_variable _written;
+
+        std::deque<std::pair<unsigned int, unsigned long>> _queue;  /*!< @brief Snapshots to write and their index, the first one being written */
+        unsigned long _latest;                  /*!< @brief Index of the last checkpoint written or found on the disk, 0 if none */
+        std::exception_ptr _error;
+        bool _stop;
+};
+
+#endif
@@ -1,165 +1,435 @@
 #include "cwrnn.h"
 #include "dense.h"
-#include "mergesum.h"
+#include "networkserializer.h"
 
-#include <iostream>
+#include <algorithm>
+#include <stdexcept>
 #include <assert.h>
 
+using namespace nnetcppinternal;
+
 CWRNN::CWRNN(unsigned int num_units, unsigned int size, Float learning_rate, Float decay)
-: _learning_rate(learning_rate),
-  _decay(decay)
+: _num_units(num_units),
+  _learning_rate(learning_rate),
+  _decay(decay),
+  _max_timestep(0)
 {
-    // Output node that sums the outputs of all the units
-    _output = new MergeSum;
-
-    // Create the units
-    _units.resize(num_units);
     _unit_size = size / num_units;
 
     assert(_unit_size * num_units == size);
 
+    // The output is the sum of the units
+    _units.value = Vector::Zero(size);
+    _output.value = Vector::Zero(_unit_size);
+    _output.error = Vector::Zero(_unit_size);
+
+    // The units at time t are copied to a recurrent node, so that the storage
+    // of AbstractRecurrentNetworkNode can be used
+    _recurrent_units = new LinearActivation;
+    _recurrent_units->setInput(&_units);
+
+    addNode(_recurrent_units);
+    addRecurrentNode(_recurrent_units);
+
+    // Recurrent connections between the previous units and each unit (this
+    // one included), initialized like Dense nodes
+    _weights = BlockRows::Zero(size, size);
+    _biases = Matrix::Zero(size, num_units);
+
     for (unsigned int i=0; i<num_units; ++i) {
-        Unit &unit = _units[i];
+        for (unsigned int j=0; j<=i; ++j) {
+            _weights.block(i * _unit_size, j * _unit_size, _unit_size, _unit_size) =
+                Matrix::Random(_unit_size, _unit_size) * Float(0.01);
+            _biases.block(i * _unit_size, j, _unit_size, 1) = Vector::Random(_unit_size) * Float(0.01);
+        }
+    }
+
+    _d_weights = BlockRows::Zero(size, size);
+    _avg_d_weights = BlockRows::Zero(size, size);
+    _avg_d_biases = Matrix::Zero(size, num_units);
+    _d_bias = Vector::Zero(size);
+
+    sumBiases();
+    setBatchSize(1);
+    reset();
+}
+
+void CWRNN::addInput(Port *input)
+{
+    // One projection of the input to all the units
+    Input in;
+    unsigned int size = _units.value.rows();
+
+    in.port = input;
+    in.weights = Matrix::Random(size, input->value.rows()) * Float(0.01);
+    in.d_weights = Matrix::Zero(size, input->value.rows());
+    in.avg_d_weights = Matrix::Zero(size, input->value.rows());
+    in.bias = Vector::Random(size) * Float(0.01);
+    in.avg_d_bias = Vector::Zero(size);
 
-        unit.sum = new MergeSum;
-        unit.activation = new TanhActivation;
-        unit.skip = new LinearActivation;
-        unit.output = new MergeSum;
+    _inputs.push_back(in);
 
-        // Recurrent connections between the previous units and this one (this one included)
+    sumBiases();
+}
+
+void CWRNN::serialize(NetworkSerializer &serializer)
+{
+    unsigned int u = _unit_size;
+    bool frozen = isFrozen();
+
+    // Same layout as when every block was a Dense node (weights, their
+    // statistics, bias, its statistics), zeros replacing the statistics of
+    // a frozen node: the recurrent blocks unit by unit, then the blocks of
+    // the inputs.
+    for (unsigned int i=0; i<_num_units; ++i) {
         for (unsigned int j=0; j<=i; ++j) {
-            Dense *dense = new Dense(_unit_size, _learning_rate, _decay);
-            Unit &prev_unit = _units[j];
-
-            // HACK: this dense has the same number of inputs and outputs. First
-            //       set itself as input so that it discovers its size, then
-            //       set the proper input
-            dense->setInput(dense->output());
-
-            unit.inputs.push_back(dense);
-            unit.sum->addInput(dense->output());
-            addNode(dense);
-
-            if (j == 0) {
-                // Now that sum knows its size (thanks to the Dense nodes), other connections
-                // can be made
-                unit.activation->setInput(unit.sum->output());
-                unit.output->addInput(unit.activation->output());
-                unit.output->addInput(unit.skip->output());
-                unit.skip->setInput(unit.output->output());
+            serializer.writeTensor(_weights.block(i * u, j * u, u, u));
+
+            if (frozen) {
+                serializer.writeStatistics(Matrix::Zero(u, u));
+            } else {
+                serializer.writeStatistics(_avg_d_weights.block(i * u, j * u, u, u));
             }
 
-            // HACK (contd.): set the real output of dense
-            dense->setInput(prev_unit.output->output());
+            serializer.writeTensor(_biases.block(i * u, j, u, 1));
+
+            if (frozen) {
+                serializer.writeStatistics(Vector::Zero(u));
+            } else {
+                serializer.writeStatistics(_avg_d_biases.block(i * u, j, u, 1));
+            }
         }
+    }
 
-        // The output of this unit is a recurrent node that has to be registered
-        // as such
-        addRecurrentNode(unit.output);
-        addNode(unit.sum);
-        addNode(unit.activation);
-        addNode(unit.skip);
-        addNode(unit.output);
+    for (Input &input : _inputs) {
+        for (unsigned int i=0; i<_num_units; ++i) {
+            serializer.writeTensor(input.weights.middleRows(i * u, u));
 
-        // Add the output of this unit to the general output
-        _output->addInput(unit.output->output());
-    }
+            if (frozen) {
+                serializer.writeStatistics(Matrix::Zero(u, input.weights.cols()));
+            } else {
+                serializer.writeStatistics(input.avg_d_weights.middleRows(i * u, u));
+            }
 
-    reset();
+            serializer.writeTensor(input.bias.segment(i * u, u));
+
+            if (frozen) {
+                serializer.writeStatistics(Vector::Zero(u));
+            } else {
+                serializer.writeStatistics(input.avg_d_bias.segment(i * u, u));
+            }
+        }
+    }
 }
 
-void CWRNN::addInput(Port *input)
+void CWRNN::deserialize(NetworkSerializer &serializer)
 {
-    // Add the input to all the units, inserting a Dense between the input and
-    // the units.
-    for (Unit &unit : _units) {
-        Dense *dense = new Dense(_unit_size, _learning_rate, _decay);
+    unsigned int u = _unit_size;
+    bool frozen = isFrozen();
+    Matrix skipped;
 
-        dense->setInput(input);
+    // A frozen node skips the statistics
+    for (unsigned int i=0; i<_num_units; ++i) {
+        for (unsigned int j=0; j<=i; ++j) {
+            serializer.readTensor(_weights.block(i * u, j * u, u, u));
 
-        unit.sum->addInput(dense->output());
-        unit.inputs.push_back(dense);
-        _inputs.push_back(dense);
+            if (frozen) {
+                serializer.readStatistics(skipped = Matrix(u, u));
+            } else {
+                serializer.readStatistics(_avg_d_weights.block(i * u, j * u, u, u));
+            }
+
+            serializer.readTensor(_biases.block(i * u, j, u, 1));
 
-        addNode(dense);
+            if (frozen) {
+                serializer.readStatistics(skipped = Matrix(u, 1));
+            } else {
+                serializer.readStatistics(_avg_d_biases.block(i * u, j, u, 1));
+            }
+        }
     }
+
+    for (Input &input : _inputs) {
+        for (unsigned int i=0; i<_num_units; ++i) {
+            serializer.readTensor(input.weights.middleRows(i * u, u));
+
+            if (frozen) {
+                serializer.readStatistics(skipped = Matrix(u, input.weights.cols()));
+            } else {
+                serializer.readStatistics(input.avg_d_weights.middleRows(i * u, u));
+            }
+
+            serializer.readTensor(input.bias.segment(i * u, u));
+
+            if (frozen) {
+                serializer.readStatistics(skipped = Matrix(u, 1));
+            } else {
+                serializer.readStatistics(input.avg_d_bias.segment(i * u, u));
+            }
+        }
+    }
+
+    sumBiases();
 }
 
 AbstractNode::Port *CWRNN::output()
 {
-    return _output->output();
+    return &_output;
 }
 
-template<typename EnabledFunc, typename DisabledFunc>
-void CWRNN::forUnits(unsigned int t, EnabledFunc enabled, DisabledFunc disabled)
+void CWRNN::describe(Description &description)
+{
+    description.type = "CWRNN";
+    description.parameters = {
+        {"num_units", double(_num_units)},
+        {"size", double(_units.value.rows())},
+        {"learning_rate", _learning_rate},
+        {"decay", _decay}
+    };
+
+    for (Input &input : _inputs) {
+        description.inputs.push_back(std::make_pair("addInput", input.port));
+    }
+}
+
+std::vector<AbstractNode::Port *> CWRNN::inputs()
+{
+    std::vector<Port *> rs;
+
+    for (Input &input : _inputs) {
+        rs.push_back(input.port);
+    }
+
+    return rs;
+}
+
+void CWRNN::setBatchSize(unsigned int batch_size)
+{
+    AbstractRecurrentNetworkNode::setBatchSize(batch_size);
+
+    _units.value.setZero(_units.value.rows(), batch_size);
+    _output.value.setZero(_unit_size, batch_size);
+    _output.error.setZero(_output.error.rows(), batch_size);
+    _activations.setZero(_units.value.rows(), batch_size);
+}
+
+void CWRNN::collectPorts(std::vector<Port *> &ports)
+{
+    AbstractRecurrentNetworkNode::collectPorts(ports);
+
+    ports.push_back(&_output);
+}
+
+void CWRNN::freeze()
+{
+    AbstractRecurrentNetworkNode::freeze();
+
+    _output.error.resize(0, 0);
+
+    _d_weights.resize(0, 0);
+    _avg_d_weights.resize(0, 0);
+    _avg_d_biases.resize(0, 0);
+    _d_bias.resize(0);
+
+    for (Input &input : _inputs) {
+        input.d_weights.resize(0, 0);
+        input.avg_d_weights.resize(0, 0);
+        input.avg_d_bias.resize(0);
+    }
+}
+
+unsigned int CWRNN::period()
+{
+    // Period of the slowest unit (see firstEnabledUnit)
+    return 1 << (_num_units - 1);
+}
+
+unsigned int CWRNN::firstEnabledUnit(unsigned int t)
 {
     // The first unit is enabled one timestep every 2^(num_units-1), the second
     // unit every 2^(num_units-2) timesteps, etc. The last unit is always enabled
-    for (unsigned int i=0; i<_units.size(); ++i) {
-        unsigned int period = 1 << (_units.size() - i - 1);
+    for (unsigned int i=0; i<_num_units; ++i) {
+        unsigned int period = 1 << (_num_units - i - 1);
 
         if (t % period == 0) {
-            enabled(_units[i]);
-        } else {
-            disabled(_units[i]);
+            return i;
         }
     }
+
+    return _num_units - 1;
+}
+
+void CWRNN::sumBiases()
+{
+    _bias = _biases.rowwise().sum();
+
+    for (Input &input : _inputs) {
+        _bias += input.bias;
+    }
 }
 
 void CWRNN::forward()
 {
-    // Propagate the input (or skip links) of the units
-    forUnits(
-        currentTimestep(),
-        [](Unit &enabled) {
-            for (Dense *dense : enabled.inputs) {
-                dense->forward();
-            }
+    const Matrix &prev = _recurrent_units->output()->value;
+    unsigned int first = firstEnabledUnit(currentTimestep()) * _unit_size;
+    unsigned int rows = _units.value.rows() - first;
+    auto activations = _activations.bottomRows(rows);
 
-            enabled.sum->forward();
-            enabled.activation->forward();      // output = activation(sum(inputs)), skip is set to zero by Activation::clearError, called by setCurrentTimestep.
-        },
-        [](Unit &disabled) {
-            disabled.skip->forward();           // output = output(t-1), activation is set to zero by Activation::clearError.
-        }
-    );
+    // Enabled units, from the units at t-1 (unit i only reads the units 0 to
+    // i) and the inputs
+    for (unsigned int row=first; row<_units.value.rows(); row += _unit_size) {
+        activations.middleRows(row - first, _unit_size).noalias() =
+            _weights.block(row, 0, _unit_size, row + _unit_size) * prev.topRows(row + _unit_size);
+    }
+
+    activations.colwise() += _bias.tail(rows);
 
-    // Forward the output of all the units (now that the last outputs are not
-    // needed anymore)
-    for (Unit &unit : _units) {
-        unit.output->forward();
+    for (Input &input : _inputs) {
+        activations.noalias() += input.weights.bottomRows(rows) * input.port->value;
     }
 
-    // Forward pass of the output node
-    _output->forward();
+    activations = activations.unaryExpr(Tanh());
+
+    // The disabled units keep their value
+    _units.value.topRows(first) = prev.topRows(first);
+    _units.value.bottomRows(rows) = activations;
+
+    // The output is the sum of the units
+    _output.value = _units.value.topRows(_unit_size);
+
+    for (unsigned int i=1; i<_num_units; ++i) {
+        _output.value += _units.value.middleRows(i * _unit_size, _unit_size);
+    }
 
     // Store the output of the recurrent nodes for later use
-    AbstractRecurrentNetworkNode::forwardRecurrent();
+    _recurrent_units->forward();
+    forwardRecurrent();
 }
 
 void CWRNN::backward()
 {
-    // Backward pass of the output node
-    _output->backward();
+    if (isFrozen()) {
+        throw std::logic_error("CWRNN::backward() called on a frozen node");
+    }
 
-    // Propagate the error of the units to their inputs or skip links
-    forUnits(
-        currentTimestep(),
-        [](Unit &enabled) {
-            enabled.output->backward();         // Also set the error at the skip link, but this link will not be backpropagated
-            enabled.activation->backward();
-            enabled.sum->backward();
+    Port *recurrent = _recurrent_units->output();
+    const Matrix &units = recurrent->value;
+    unsigned int first_unit = firstEnabledUnit(currentTimestep());
+    unsigned int first = first_unit * _unit_size;
+    unsigned int rows = units.rows() - first;
+    auto errors = _activations.bottomRows(rows);
 
-            for (Dense *dense : enabled.inputs) {
-                dense->backward();
-            }
-        },
-        [](Unit &disabled) {
-            disabled.output->backward();        // Also set the error at "activation", but this error will not be backpropagated
-            disabled.skip->backward();
-        }
-    );
+    // Every unit receives the error of the output, on top of its error from t+1
+    for (unsigned int i=0; i<_num_units; ++i) {
+        recurrent->error.middleRows(i * _unit_size, _unit_size) += _output.error;
+    }
+
+    errors = recurrent->error.bottomRows(rows).cwiseProduct(units.bottomRows(rows).unaryExpr(dTanh()));
+
+    // The skip link of the disabled units sends their error to t-1. It used
+    // to be a LinearActivation reading and writing the same port, so the error
+    // is doubled, and this is kept so that trained networks behave the same.
+    recurrent->error.topRows(first) *= Float(2);
+
+    // Error of the units at t-1 and of the inputs
+    for (unsigned int row=first; row<units.rows(); row += _unit_size) {
+        recurrent->error.topRows(row + _unit_size).noalias() +=
+            _weights.block(row, 0, _unit_size, row + _unit_size).transpose() * errors.middleRows(row - first, _unit_size);
+    }
+
+    for (Input &input : _inputs) {
+        input.port->error.noalias() += input.weights.bottomRows(rows).transpose() * errors;
+        input.d_weights.bottomRows(rows).noalias() -= errors * input.port->value.transpose();
+    }
+
+    // Gradient of the blocks on and below the diagonal. Like for the Dense
+    // nodes of the other recurrent nodes, the units have their value at t.
+    for (unsigned int i=first_unit; i<_num_units; ++i) {
+        unsigned int row = i * _unit_size;
+
+        _d_weights.block(row, 0, _unit_size, row + _unit_size).noalias() -=
+            errors.middleRows(row - first, _unit_size) * units.topRows(row + _unit_size).transpose();
+    }
+
+    _d_bias.tail(rows).noalias() -= errors.rowwise().sum();
 
     // Store the backpropagated error for later use
-    AbstractRecurrentNetworkNode::backwardRecurrent();
+    backwardRecurrent();
+}
+
+void CWRNN::update()
+{
+    if (isFrozen()) {
+        throw std::logic_error("CWRNN::update() called on a frozen node");
+    }
+
+    // Same normalization and update as Dense, only for the blocks on and below
+    // the diagonal. The other ones stay zero.
+    Float normalization_factor = Float(1) / Float(_max_timestep + 1);
+    unsigned int size = _units.value.rows();
+
+    _d_weights *= normalization_factor;
+    _d_bias *= normalization_factor;
+
+    for (unsigned int i=0; i<_num_units; ++i) {
+        unsigned int row = i * _unit_size;
+
+        Dense::rmsprop(
+            _weights.block(row, 0, _unit_size, row + _unit_size),
+            _d_weights.block(row, 0, _unit_size, row + _unit_size),
+            _avg_d_weights.block(row, 0, _unit_size, row + _unit_size),
+            _learning_rate,
+            _decay
+        );
+        Dense::rmsprop(
+            _biases.col(i).tail(size - row),
+            _d_bias.tail(size - row),
+            _avg_d_biases.col(i).tail(size - row),
+            _learning_rate,
+            _decay
+        );
+    }
+
+    for (Input &input : _inputs) {
+        input.d_weights *= normalization_factor;
+
+        Dense::rmsprop(input.weights, input.d_weights, input.avg_d_weights, _learning_rate, _decay);
+        Dense::rmsprop(input.bias, _d_bias, input.avg_d_bias, _learning_rate, _decay);
+    }
+
+    sumBiases();
+}
+
+void CWRNN::clearError()
+{
+    AbstractRecurrentNetworkNode::clearError();
+
+    _output.error.setZero();
+    _output.value.setZero();
+
+    _d_weights *= Dense::momentum;
+    _d_bias *= Dense::momentum;
+
+    for (Input &input : _inputs) {
+        input.d_weights *= Dense::momentum;
+    }
+}
+
+void CWRNN::reset()
+{
+    AbstractRecurrentNetworkNode::reset();
+
+    _max_timestep = 0;
+}
+
+void CWRNN::setCurrentTimestep(unsigned int timestep)
+{
+    // Set the value and error of _recurrent_units
+    AbstractRecurrentNetworkNode::setCurrentTimestep(timestep);
+
+    _output.error.setZero();
+    _output.value.setZero();
+
+    // Sequence length, used to normalize the gradients
+    _max_timestep = std::max(_max_timestep, timestep);
 }
@@ -28,14 +28,19 @@
 
 #include <vector>
 
-class Dense;
-class MergeSum;
-
 /**
  * @brief Clockwork RNN
  *
  * Implementation based on the description of "A Clockwork RNN", Koutnìk,
  * Greff, Gomez and Schmidhuber, 2014, arXiv:1v1153.2041.
+ *
+ * The recurrent weights of all the units are stored in one block-triangular
+ * matrix, unit i reading the units 0 to i, and the weights of each input in
+ * one matrix having a block of rows per unit. Because the units active at a
+ * time step are always the last ones, a time step only touches the rows of
+ * the active units: one product per active unit, restricted to the blocks on
+ * and below the diagonal, and one product per input. The weights are
+ * serialized as if each block was a Dense node.
  */
 class CWRNN : public AbstractRecurrentNetworkNode
 {
@@ -56,42 +61,81 @@ class CWRNN : public AbstractRecurrentNetworkNode
          * @brief Add an X input to this network
          *
          * @note The input does not need to be the output port of a Dense since
-         *       CWRNN automatically adds Dense nodes between its input and the
-         *       Clockwork units. For instance, you can simply pass Network::inputPort()
-         *       as a parameter to this method.
+         *       CWRNN automatically projects its input to the Clockwork units.
+         *       For instance, you can simply pass Network::inputPort() as a
+         *       parameter to this method.
          */
         void addInput(Port *input);
 
+        virtual void serialize(NetworkSerializer &serializer);
+        virtual void deserialize(NetworkSerializer &serializer);
+        virtual void describe(Description &description);
+
         virtual Port *output();
+        virtual std::vector<Port *> inputs();
         virtual void forward();
         virtual void backward();
+        virtual void update();
+        virtual void clearError();
+        virtual void reset();
+        virtual void setBatchSize(unsigned int batch_size);
+        virtual void collectPorts(std::vector<Port *> &ports);
+        virtual void freeze();
+        virtual unsigned int period();
+
+        virtual void setCurrentTimestep(unsigned int timestep);
 
     private:
         /**
-         * @brief Iterate over the units and call a functor depending on whether
-         *        they are enabled or disabled
+         * @brief First unit enabled at time step @p t. The units after it are
+         *        also enabled.
          */
-        template<typename EnabledFunc, typename DisabledFunc>
-        void forUnits(unsigned int t, EnabledFunc enabled, DisabledFunc disabled);
+        unsigned int firstEnabledUnit(unsigned int t);
 
-    private:
-        struct Unit {
-            std::vector<Dense *> inputs;
-            MergeSum *sum;
-            TanhActivation *activation;
+        /**
+         * @brief Sum of the biases of all the blocks, added to the units at
+         *        each time step
+         */
+        void sumBiases();
 
-            LinearActivation *skip;
+    private:
+        /**
+         * @brief Row-major storage, so that the blocks read by a unit are
+         *        contiguous in memory
+         */
+        typedef Eigen::Matrix<Float, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> BlockRows;
 
-            MergeSum *output;
+        struct Input {
+            Port *port;
+            Matrix weights;         /*!< @brief One block of rows per unit */
+            Matrix d_weights;
+            Matrix avg_d_weights;
+            Vector bias;
+            Vector avg_d_bias;
         };
 
-        std::vector<Unit> _units;
-        std::vector<Dense *> _inputs;
-        MergeSum *_output;
-
+        unsigned int _num_units;
         unsigned int _unit_size;
-        float _learning_rate;
-        float _decay;
+        Float _learning_rate;
+        Float _decay;
+
+        Port _units;                            /*!< @brief Values of all the units at time t */
+        LinearActivation *_recurrent_units;     /*!< @brief Units at time t-1 during forward(), receives error from t+1 */
+        Port _output;                           /*!< @brief Sum of the units */
+
+        BlockRows _weights;                     /*!< @brief Block (i, j) connects unit j to unit i, zero if j > i */
+        BlockRows _d_weights;
+        BlockRows _avg_d_weights;
+        Matrix _biases;                         /*!< @brief Column j contains the bias of the blocks (i, j) */
+        Matrix _avg_d_biases;
+        Vector _d_bias;                         /*!< @brief Gradient shared by all the biases of a unit */
+        Vector _bias;
+
+        std::vector<Input> _inputs;
+
+        Matrix _activations;                    /*!< @brief Activations of the enabled units, then their errors */
+
+        unsigned int _max_timestep;
 };
 
 #endif
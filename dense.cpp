@@ -23,33 +23,115 @@
 #include "dense.h"
 #include "networkserializer.h"
 
-float Dense::momentum = 0.1f;
+#include <stdexcept>
+#include <cmath>
+#include <algorithm>
+
+Float Dense::momentum = 0.1f;
 
 /**
- * @brief Serialize an Eigen matrix-like
+ * @brief Serialize zeros in place of statistics of the same size as @p like
+ *        (used for statistics released by Dense::freeze())
  */
 template<typename Derived>
-void _serialize(NetworkSerializer &serializer, const Eigen::PlainObjectBase<Derived> &value)
+void _serializeZeros(NetworkSerializer &serializer, const Eigen::MatrixBase<Derived> &like)
 {
-    unsigned int count = value.rows() * value.cols();
-    const float *data = value.data();
+    serializer.writeStatistics(Matrix::Zero(like.rows(), like.cols()));
+}
 
-    for (unsigned int i=0; i<count; ++i) {
-        serializer.writeWeight(data[i]);
+/**
+ * @brief Skip statistics of the same shape as @p like, if the serializer
+ *        contains statistics
+ */
+template<typename Derived>
+void _skip(NetworkSerializer &serializer, const Eigen::MatrixBase<Derived> &like)
+{
+    if (serializer.mode() == NetworkSerializer::Checkpoint) {
+        serializer.readInPlace(like.rows(), like.cols());
     }
 }
 
 /**
- * @brief Deserialize an Eigen matrix-like
+ * @brief Bits of @p value rounded to a 16-bit floating point number of type
+ *        @p Half (Eigen::half or Eigen::bfloat16)
  */
-template<typename Derived>
-void _deserialize(NetworkSerializer &serializer, Eigen::PlainObjectBase<Derived> &value)
+template<typename Half>
+static inline uint16_t _toBits(Float value)
+{
+    return Eigen::numext::bit_cast<uint16_t>(Half(float(value)));
+}
+
+template<>
+inline uint16_t _toBits<Eigen::half>(Float value)
 {
-    unsigned int count = value.rows() * value.cols();
-    float *data = value.data();
+    // Flush the subnormal numbers to zero, and saturate instead of producing
+    // infinities, so that _fromBits() only has to handle normal numbers
+    float v = float(value);
 
-    for (unsigned int i=0; i<count; ++i) {
-        data[i] = serializer.readWeight();
+    if (std::abs(v) < 6.10351562e-5f) {
+        v = 0.0f;
+    }
+
+    v = std::min(std::max(v, -65504.0f), 65504.0f);
+
+    return Eigen::numext::bit_cast<uint16_t>(Eigen::half(v));
+}
+
+/**
+ * @brief Value of a 16-bit floating point number of type @p Half
+ *
+ * The conversions only use a few integer and float operations, so that the
+ * compiler can vectorize them, contrary to the ones of Eigen.
+ */
+template<typename Half>
+static inline Float _fromBits(uint16_t bits);
+
+template<>
+inline Float _fromBits<Eigen::bfloat16>(uint16_t bits)
+{
+    // The 16 upper bits of a float
+    return Float(Eigen::numext::bit_cast<float>(uint32_t(bits) << 16));
+}
+
+template<>
+inline Float _fromBits<Eigen::half>(uint16_t bits)
+{
+    // Exponent and mantissa shifted in place, the exponent bias being changed
+    // from 15 to 127 by a multiplication by 2^112. This is exact for all the
+    // finite numbers, but slow for subnormal ones, that _toBits() avoids.
+    float magnitude = Eigen::numext::bit_cast<float>(uint32_t(bits & 0x7fff) << 13) * 5.19229686e+33f;
+    uint32_t sign = uint32_t(bits & 0x8000) << 16;
+
+    return Float(Eigen::numext::bit_cast<float>(Eigen::numext::bit_cast<uint32_t>(magnitude) | sign));
+}
+
+/**
+ * @brief Round the coefficients of @p from to 16 bits
+ */
+template<typename Half, typename Derived, typename Bits>
+void _round(const Eigen::MatrixBase<Derived> &from, Bits &to)
+{
+    to.resize(from.rows(), from.cols());
+
+    for (int r=0; r<from.rows(); ++r) {
+        for (int c=0; c<from.cols(); ++c) {
+            to(r, c) = _toBits<Half>(from(r, c));
+        }
+    }
+}
+
+/**
+ * @brief Float values of 16-bit coefficients
+ */
+template<typename Half, typename Bits>
+void _unround(const Bits &from, Matrix &to)
+{
+    to.resize(from.rows(), from.cols());
+
+    for (int r=0; r<from.rows(); ++r) {
+        for (int c=0; c<from.cols(); ++c) {
+            to(r, c) = _fromBits<Half>(from(r, c));
+        }
     }
 }
 
@@ -57,29 +139,121 @@ Dense::Dense(unsigned int outputs, Float learning_rate, Float decay, bool bias_i
 : _input(nullptr),
   _learning_rate(learning_rate),
   _decay(decay),
-  _bias_initialized_at_one(bias_initialized_at_one)
+  _bias_initialized_at_one(bias_initialized_at_one),
+  _frozen(false),
+  _quantized(false),
+  _mapped_weights(nullptr),
+  _precision(Full)
 {
     // Prepare the output port
-    _output.error.resize(outputs);
-    _output.value.resize(outputs);
+    _output.error.resize(outputs, 1);
+    _output.value.resize(outputs, 1);
 }
 
 void Dense::serialize(NetworkSerializer &serializer)
 {
+    if (_quantized) {
+        // The scales, the 8-bit weights packed in as few values as possible,
+        // and the bias
+        serializer.writeTensor(_scales);
+        serializer.writeBytes(_quantized_weights.data(), _quantized_weights.size());
+        serializer.writeTensor(_bias);
+        return;
+    }
+
+    if (_precision != Full) {
+        // The 16-bit weights, their statistics in BFloat16 (the range of Half
+        // is too small for them), and the bias
+        HalfRows statistics = HalfRows::Zero(_half_weights.rows(), _half_weights.cols());
+
+        if (!_frozen) {
+            _round<Eigen::bfloat16>(_avg_d_weights, statistics);
+        }
+
+        serializer.writeBytes(_half_weights.data(), _half_weights.size() * sizeof(uint16_t));
+
+        if (serializer.mode() == NetworkSerializer::Checkpoint) {
+            serializer.writeBytes(statistics.data(), statistics.size() * sizeof(uint16_t));
+        }
+
+        serializer.writeTensor(_bias);
+
+        if (_frozen) {
+            _serializeZeros(serializer, _bias);
+        } else {
+            serializer.writeStatistics(_avg_d_bias);
+        }
+        return;
+    }
+
+    if (_frozen) {
+        // The statistics have been released, write zeros so that the format
+        // stays the same as for a node that is not frozen
+        serializer.writeTensor(weights());
+        _serializeZeros(serializer, weights());
+        serializer.writeTensor(_bias);
+        _serializeZeros(serializer, _bias);
+        return;
+    }
+
     // Serialize all the weights and statistics
-    _serialize(serializer, _weights);
-    _serialize(serializer, _avg_d_weights);
-    _serialize(serializer, _bias);
-    _serialize(serializer, _avg_d_bias);
+    serializer.writeTensor(_weights);
+    serializer.writeStatistics(_avg_d_weights);
+    serializer.writeTensor(_bias);
+    serializer.writeStatistics(_avg_d_bias);
 }
 
 void Dense::deserialize(NetworkSerializer &serializer)
 {
+    unmap();
+
+    if (_quantized) {
+        serializer.readTensor(_scales);
+        serializer.readBytes(_quantized_weights.data(), _quantized_weights.size());
+        serializer.readTensor(_bias);
+        return;
+    }
+
+    if (_precision != Full) {
+        HalfRows statistics = HalfRows::Zero(_half_weights.rows(), _half_weights.cols());
+
+        serializer.readBytes(_half_weights.data(), _half_weights.size() * sizeof(uint16_t));
+
+        if (serializer.mode() == NetworkSerializer::Checkpoint) {
+            serializer.readBytes(statistics.data(), statistics.size() * sizeof(uint16_t));
+        }
+
+        serializer.readTensor(_bias);
+
+        if (_frozen) {
+            _skip(serializer, _bias);
+            return;
+        }
+
+        // The master copy of the weights restarts from their 16-bit value
+        _weights = unroundWeights();
+        _unround<Eigen::bfloat16>(statistics, _avg_d_weights);
+        serializer.readStatistics(_avg_d_bias);
+        return;
+    }
+
+    if (_frozen) {
+        // Only the weights are used by a frozen node
+        if (!mapWeights(serializer)) {
+            serializer.readTensor(_weights);
+        }
+
+        _skip(serializer, weights());
+        serializer.readTensor(_bias);
+        _skip(serializer, _bias);
+        return;
+    }
+
     // Deserialize all the weights and statistics
-    _deserialize(serializer, _weights);
-    _deserialize(serializer, _avg_d_weights);
-    _deserialize(serializer, _bias);
-    _deserialize(serializer, _avg_d_bias);
+    serializer.readTensor(_weights);
+    serializer.readStatistics(_avg_d_weights);
+    serializer.readTensor(_bias);
+    serializer.readStatistics(_avg_d_bias);
 }
 
 void Dense::setInput(Port *input)
@@ -90,7 +264,7 @@ void Dense::setInput(Port *input)
     unsigned int inputs = _input->value.rows();
     unsigned int outputs = _output.value.rows();
 
-    _weights = Matrix::Random(outputs, inputs) * 0.01f;
+    _weights = Matrix::Random(outputs, inputs) * Float(0.01);
     _d_weights = Matrix::Zero(outputs, inputs);
     _avg_d_weights = Matrix::Zero(outputs, inputs);
     _d_bias = Vector::Zero(outputs);
@@ -99,7 +273,11 @@ void Dense::setInput(Port *input)
     if (_bias_initialized_at_one) {
         _bias = Vector::Ones(outputs);
     } else {
-        _bias = Vector::Random(outputs) * 0.01f;
+        _bias = Vector::Random(outputs) * Float(0.01);
+    }
+
+    if (_precision != Full) {
+        roundWeights();
     }
 
     // Clear the error, so that the error is initialized for the first backpropagation
@@ -107,47 +285,259 @@ void Dense::setInput(Port *input)
     clearError();
 }
 
+void Dense::describe(Description &description)
+{
+    description.type = "Dense";
+    description.parameters = {
+        {"outputs", double(_output.value.rows())},
+        {"learning_rate", _learning_rate},
+        {"decay", _decay},
+        {"bias_initialized_at_one", double(_bias_initialized_at_one)},
+        {"precision", double(_precision)},
+        {"quantized", double(_quantized)}
+    };
+    description.inputs.push_back(std::make_pair("setInput", _input));
+}
+
 AbstractNode::Port *Dense::output()
 {
     return &_output;
 }
 
+std::vector<AbstractNode::Port *> Dense::inputs()
+{
+    return std::vector<Port *>{_input};
+}
+
+bool Dense::replaceInput(Port *port, Port *by)
+{
+    if (_input == port) {
+        _input = by;
+    }
+
+    return true;
+}
+
 void Dense::forward()
 {
-    _output.value.noalias() = _weights * _input->value;
-    _output.value += _bias;
+    multiply();
+    _output.value.colwise() += _bias;
+}
+
+void Dense::multiply()
+{
+    if (_quantized) {
+        multiplyQuantized();
+        return;
+    }
+
+    if (_precision == Half) {
+        multiplyHalf<Eigen::half>();
+        return;
+    } else if (_precision == BFloat16) {
+        multiplyHalf<Eigen::bfloat16>();
+        return;
+    }
+
+    // One matrix-matrix product for all the samples of the batch
+    _output.value.noalias() = weights() * _input->value;
+}
+
+Eigen::Map<const Matrix> Dense::weights() const
+{
+    if (_mapped_weights != nullptr) {
+        return Eigen::Map<const Matrix>(_mapped_weights, _output.value.rows(), _input->value.rows());
+    }
+
+    return Eigen::Map<const Matrix>(_weights.data(), _weights.rows(), _weights.cols());
+}
+
+bool Dense::mapWeights(NetworkSerializer &serializer)
+{
+    if (!serializer.mapping()) {
+        return false;
+    }
+
+    _mapping = serializer.mapping();
+    _mapped_weights = serializer.readInPlace(_output.value.rows(), _input->value.rows());
+    _weights.resize(0, 0);
+
+    return true;
+}
+
+void Dense::unmap()
+{
+    if (_mapped_weights == nullptr) {
+        return;
+    }
+
+    _weights = weights();
+    _mapped_weights = nullptr;
+    _mapping.reset();
+}
+
+/**
+ * @brief Dot product of 8-bit weights and an input between -127 and 127,
+ *        accumulated in 32 bits
+ *
+ * The input is stored on 16 bits, which lets the compiler use the SSE2
+ * instructions that multiply and add pairs of 16-bit integers.
+ */
+static inline int32_t dot(const int8_t *a, const int16_t *b, int size)
+{
+    int32_t rs = 0;
+
+    for (int i=0; i<size; ++i) {
+        rs += int16_t(a[i]) * b[i];
+    }
+
+    return rs;
+}
+
+void Dense::multiplyQuantized()
+{
+    const Matrix &input = _input->value;
+    int rows = _quantized_weights.rows();
+    int cols = _quantized_weights.cols();
+
+    // Quantize each sample, so that its largest absolute value becomes 127
+    _quantized_input.resize(cols, input.cols());
+    _input_scales.resize(input.cols());
+    _output.value.resize(rows, input.cols());
+
+    for (int c=0; c<input.cols(); ++c) {
+        Float range = input.col(c).cwiseAbs().maxCoeff();
+        Float scale = (range > 0 ? range / Float(127) : Float(1));
+
+        _input_scales[c] = scale;
+        _quantized_input.col(c) = (input.col(c) / scale).array().round().cast<int16_t>();
+    }
+
+    // Integer products, converted back to Float using the scales
+    for (int c=0; c<input.cols(); ++c) {
+        const int16_t *x = _quantized_input.col(c).data();
+
+        for (int r=0; r<rows; ++r) {
+            _output.value(r, c) = Float(dot(_quantized_weights.row(r).data(), x, cols)) * _scales[r];
+        }
+
+        _output.value.col(c) *= _input_scales[c];
+    }
+}
+
+/**
+ * @brief Dot product of 16-bit weights and Float inputs, accumulated in Float
+ *
+ * The products are accumulated in several independent sums, so that the
+ * compiler can convert and multiply several weights at once.
+ */
+template<typename Half>
+static inline Float dot(const uint16_t *a, const Float *b, int size)
+{
+    Float sums[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    Float rs = 0;
+    int i = 0;
+
+    for (; i+8<=size; i+=8) {
+        for (int j=0; j<8; ++j) {
+            sums[j] += _fromBits<Half>(a[i+j]) * b[i+j];
+        }
+    }
+
+    for (; i<size; ++i) {
+        rs += _fromBits<Half>(a[i]) * b[i];
+    }
+
+    for (int j=0; j<8; ++j) {
+        rs += sums[j];
+    }
+
+    return rs;
+}
+
+template<typename Half>
+void Dense::multiplyHalf()
+{
+    const Matrix &input = _input->value;
+    int rows = _half_weights.rows();
+    int cols = _half_weights.cols();
+
+    _output.value.resize(rows, input.cols());
+
+    for (int c=0; c<input.cols(); ++c) {
+        const Float *x = input.col(c).data();
+
+        for (int r=0; r<rows; ++r) {
+            _output.value(r, c) = dot<Half>(_half_weights.row(r).data(), x, cols);
+        }
+    }
+}
+
+void Dense::roundWeights()
+{
+    if (_precision == Half) {
+        _round<Eigen::half>(_weights, _half_weights);
+    } else if (_precision == BFloat16) {
+        _round<Eigen::bfloat16>(_weights, _half_weights);
+    } else {
+        _half_weights.resize(0, 0);
+    }
+}
+
+Matrix Dense::unroundWeights() const
+{
+    Matrix rs;
+
+    if (_precision == Half) {
+        _unround<Eigen::half>(_half_weights, rs);
+    } else if (_precision == BFloat16) {
+        _unround<Eigen::bfloat16>(_half_weights, rs);
+    }
+
+    return rs;
 }
 
 void Dense::backward()
+{
+    if (_frozen) {
+        throw std::logic_error("Dense::backward() called on a frozen node");
+    }
+
+    backpropagate(_output.error);
+}
+
+void Dense::backpropagate(const Matrix &error)
 {
     // Multiply the output errors by the weights to obtain the input errors
-    _input->error.noalias() += _weights.transpose() * _output.error;
+    _input->error.noalias() += _weights.transpose() * error;
 
-    // Update the gradient of the input parameters and biases
-    _d_weights.noalias() -= _output.error * _input->value.transpose();
-    _d_bias.noalias() -= _output.error;
+    // Update the gradient of the input parameters and biases, summed over the
+    // samples of the batch
+    _d_weights.noalias() -= error * _input->value.transpose();
+    _d_bias.noalias() -= error.rowwise().sum();
 }
 
 void Dense::update()
 {
+    if (_frozen) {
+        throw std::logic_error("Dense::update() called on a frozen node");
+    }
+
     // Divide the gradients by the number of time steps, so that gradient updates
     // don't blow up for long sequences
-    float normalization_factor = 1.0f / float(_max_timestep + 1);
+    Float normalization_factor = Float(1) / Float(_max_timestep + 1);
 
     _d_weights *= normalization_factor;
     _d_bias *= normalization_factor;
 
-    // Keep a moving average of the gradients
-    _avg_d_weights = _decay * _avg_d_weights + (1.0f - _decay) * _d_weights.array().square().matrix();
-    _avg_d_bias = _decay * _avg_d_bias + (1.0f - _decay) * _d_bias.array().square().matrix();
-
     // Perform the update using RMSprop
-    _weights.noalias() -= (_learning_rate * _d_weights).cwiseQuotient(
-        (_avg_d_weights.array().sqrt() + 1e-3).matrix()
-    );
-    _bias.noalias() -= (_learning_rate * _d_bias).cwiseQuotient(
-        (_avg_d_bias.array().sqrt() + 1e-3).matrix()
-    );
+    rmsprop(_weights, _d_weights, _avg_d_weights, _learning_rate, _decay);
+    rmsprop(_bias, _d_bias, _avg_d_bias, _learning_rate, _decay);
+
+    // The forward pass reads the rounded weights
+    if (_precision != Full) {
+        roundWeights();
+    }
 }
 
 void Dense::clearError()
@@ -179,3 +569,66 @@ void Dense::reset()
 {
     _max_timestep = 0;
 }
+
+unsigned int Dense::quantize()
+{
+    if (_quantized) {
+        return 0;
+    }
+
+    freeze();
+
+    // Quantize the Float weights
+    unmap();
+    setPrecision(Full);
+
+    // One scale per row, so that its largest absolute value becomes 127
+    _scales = _weights.cwiseAbs().rowwise().maxCoeff() / Float(127);
+    _scales = (_scales.array() > 0).select(_scales, Float(1));
+    _quantized_weights = (_scales.cwiseInverse().asDiagonal() * _weights).array().round().cast<int8_t>();
+
+    _weights.resize(0, 0);
+    _quantized = true;
+
+    return 1;
+}
+
+void Dense::freeze()
+{
+    AbstractNode::freeze();
+
+    _frozen = true;
+
+    _d_weights.resize(0, 0);
+    _avg_d_weights.resize(0, 0);
+    _d_bias.resize(0);
+    _avg_d_bias.resize(0);
+
+    // Only the 16-bit weights are used by the forward pass
+    if (_precision != Full) {
+        _weights.resize(0, 0);
+    }
+}
+
+unsigned int Dense::setPrecision(Precision precision)
+{
+    if (_quantized || precision == _precision) {
+        return 0;
+    }
+
+    unmap();
+
+    // A frozen node may have released its Float weights
+    if (_precision != Full && _frozen) {
+        _weights = unroundWeights();
+    }
+
+    _precision = precision;
+    roundWeights();
+
+    if (_frozen && _precision != Full) {
+        _weights.resize(0, 0);
+    }
+
+    return 1;
+}
@@ -25,6 +25,10 @@
 
 #include "abstractnode.h"
 
+#include <cstdint>
+#include <limits>
+#include <memory>
+
 /**
  * @brief Dense fully-connected layer, with no activation function (linear activation)
  */
@@ -36,7 +40,28 @@ class Dense : public AbstractNode
          *        non-zero value allows the gradient to have "inertia" in its
          *        main direction.
          */
-        static float momentum;
+        static Float momentum;
+
+        /**
+         * @brief RMSprop step of @p weights along the gradient @p d_weights,
+         *        @p avg_d_weights being the moving average of its square
+         *
+         * This is the update performed by update(), also used by the nodes
+         * that store the weights of several Dense in one matrix.
+         */
+        template<typename Weights, typename Gradient, typename Average>
+        static void rmsprop(Weights &&weights, const Gradient &d_weights, Average &&avg_d_weights, Float learning_rate, Float decay)
+        {
+            // Keep a moving average of the gradients
+            avg_d_weights = decay * avg_d_weights + (Float(1) - decay) * d_weights.array().square().matrix();
+
+            // The average of a weight that never receives a gradient (the
+            // unused recurrent weights of the LSTM output gate) stays at zero,
+            // whose vectorized square root raises FE_INVALID in Eigen.
+            weights -= (learning_rate * d_weights).cwiseQuotient(
+                (avg_d_weights.array().max(std::numeric_limits<Float>::min()).sqrt() + Float(1e-3)).matrix()
+            );
+        }
 
     public:
         /**
@@ -51,17 +76,120 @@ class Dense : public AbstractNode
 
         virtual void serialize(NetworkSerializer &serializer);
         virtual void deserialize(NetworkSerializer &serializer);
+        virtual void describe(Description &description);
 
         virtual Port *output();
+        virtual std::vector<Port *> inputs();
+        virtual bool replaceInput(Port *port, Port *by);
         virtual void forward();
         virtual void backward();
         virtual void update();
         virtual void clearError();
         virtual void reset();
 
+        /**
+         * @brief Release the gradients and their statistics. backward() and
+         *        update() then throw std::logic_error.
+         *
+         * A frozen node deserialized from a file mapped by
+         * NetworkSerializer::map() uses its weights in place, without
+         * copying them.
+         */
+        virtual void freeze();
+
+        /**
+         * @brief Freeze this node and store its weights as 8-bit integers
+         *
+         * Each row of the weights is scaled so that its largest absolute
+         * value becomes 127. During the forward pass, each sample of the
+         * input is quantized in the same way, the products are computed
+         * with integers, and the bias (and activation) is applied to their
+         * result converted back to Float. The weights use 4 times less
+         * memory, and are serialized as integers.
+         *
+         * @note A quantized node deserializes only weights serialized by a
+         *       quantized node, in place of its own.
+         */
+        virtual unsigned int quantize();
+
+        /**
+         * @brief Store the weights in 16 bits (Half or BFloat16) or back in
+         *        Float (Full)
+         *
+         * The forward pass reads the 16-bit weights, converts them on the fly
+         * and accumulates the products in Float, so that half as much memory
+         * is read. While the node is trained, a Float master copy of the
+         * weights is kept: backward() and update() use it, and it is rounded
+         * again to 16 bits after every update. Freezing the node releases
+         * the master copy.
+         *
+         * The weights are serialized in 16 bits, and so are their statistics,
+         * always in BFloat16 because they may be too small for Half.
+         *
+         * @note A node deserializes only weights serialized in its own
+         *       precision. A quantized node ignores this method.
+         */
+        virtual unsigned int setPrecision(Precision precision);
+
         virtual void setCurrentTimestep(unsigned int timestep);
 
+    protected:
+        /**
+         * @brief Backpropagate @p error, the error of the weighted sum of the
+         *        inputs, to the input and the gradients
+         */
+        void backpropagate(const Matrix &error);
+
+        /**
+         * @brief Weighted sum of the inputs, without the bias, put in the
+         *        value of the output port
+         */
+        void multiply();
+
+        /**
+         * @brief Weights of the node, in _weights or mapped from a file
+         */
+        Eigen::Map<const Matrix> weights() const;
+
     private:
+        /**
+         * @brief multiply() using the quantized weights
+         */
+        void multiplyQuantized();
+
+        /**
+         * @brief multiply() using the 16-bit weights
+         */
+        template<typename Half>
+        void multiplyHalf();
+
+        /**
+         * @brief Use the weights of a frozen node in place in the file mapped
+         *        by @p serializer, if possible (a file converted from another
+         *        Float type is not mapped)
+         *
+         * @return True if the weights have been mapped and read
+         */
+        bool mapWeights(NetworkSerializer &serializer);
+
+        /**
+         * @brief Copy mapped weights to _weights, so that they can be changed
+         */
+        void unmap();
+
+        /**
+         * @brief Round the master copy of the weights to 16 bits
+         */
+        void roundWeights();
+
+        /**
+         * @brief Float values of the 16-bit weights
+         */
+        Matrix unroundWeights() const;
+
+    protected:
+        friend class DenseSum;
+
         Port *_input;
         Float _learning_rate;
         Float _decay;
@@ -77,6 +205,24 @@ class Dense : public AbstractNode
         Vector _avg_d_bias;
 
         unsigned int _max_timestep;
+        bool _frozen;
+
+    private:
+        typedef Eigen::Matrix<int8_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> QuantizedRows;
+        typedef Eigen::Matrix<int16_t, Eigen::Dynamic, Eigen::Dynamic> QuantizedColumns;
+        typedef Eigen::Matrix<uint16_t, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> HalfRows;
+
+        bool _quantized;
+        QuantizedRows _quantized_weights;       /*!< @brief Rows of the weights divided by their scale */
+        Vector _scales;                         /*!< @brief Scale of each row of the weights */
+        QuantizedColumns _quantized_input;      /*!< @brief Samples of the input divided by their scale, between -127 and 127 */
+        Vector _input_scales;
+
+        const Float *_mapped_weights;           /*!< @brief Weights read in place in a mapped file, or nullptr */
+        std::shared_ptr<const void> _mapping;   /*!< @brief Keeps the mapped file mapped */
+
+        Precision _precision;
+        HalfRows _half_weights;                 /*!< @brief Bits of the 16-bit weights, used when _precision is not Full */
 };
 
 #endif
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2015 Vrije Universiteit Brussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+
+#ifndef __DENSEACTIVATION_H__
+#define __DENSEACTIVATION_H__
+
+#include "dense.h"
+#include "activation.h"
+
+#include <stdexcept>
+
+/**
+ * @brief Dense layer followed by an activation function, in one node
+ *
+ * This node computes what a Dense followed by an Activation computes, but the
+ * bias and the activation function are applied in one pass over the output
+ * of the product, and the error is multiplied by the derivative of the
+ * activation just before being backpropagated through the weights. This
+ * saves a node and a pass over the output in the forward and backward passes.
+ *
+ * The weights are serialized like the ones of a Dense, so that a Dense and
+ * its activation can be replaced with this node in a trained network. The
+ * network loads the files of the network that had the Dense and the
+ * activation, and conversely (see Network::deserialize()).
+ */
+template<typename F, typename DF>
+class DenseActivation : public Dense
+{
+    public:
+        /**
+         * @see Dense::Dense
+         */
+        DenseActivation(unsigned int outputs, Float learning_rate, Float decay = 0.9f, bool bias_initialized_at_one = false)
+        : Dense(outputs, learning_rate, decay, bias_initialized_at_one)
+        {
+        }
+
+        virtual void describe(Description &description)
+        {
+            Dense::describe(description);
+
+            description.type = std::string(F::name()) + "Dense";
+        }
+
+        virtual void forward()
+        {
+            multiply();
+            _output.value = (_output.value.colwise() + _bias).unaryExpr(F());
+        }
+
+        virtual void backward()
+        {
+            if (_frozen) {
+                throw std::logic_error("DenseActivation::backward() called on a frozen node");
+            }
+
+            _error = _output.error.cwiseProduct(_output.value.unaryExpr(DF()));
+
+            backpropagate(_error);
+        }
+
+        virtual void freeze()
+        {
+            Dense::freeze();
+
+            _error.resize(0, 0);
+        }
+
+    private:
+        Matrix _error;          /*!< @brief Error of the weighted sum, before the activation */
+};
+
+/**
+ * @brief Dense layer with a tanh activation
+ */
+typedef DenseActivation<nnetcppinternal::Tanh, nnetcppinternal::dTanh> TanhDense;
+
+/**
+ * @brief Dense layer with a sigmoid activation
+ */
+typedef DenseActivation<nnetcppinternal::Sigmoid, nnetcppinternal::dSigmoid> SigmoidDense;
+
+#endif
@@ -0,0 +1,283 @@
+/*
+ * Copyright (c) 2015 Vrije Universiteit Brussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "densesum.h"
+#include "networkserializer.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+DenseSum::DenseSum(const std::vector<Dense *> &nodes, const std::vector<Port *> &inputs)
+: _learning_rate(nodes[0]->_learning_rate),
+  _decay(nodes[0]->_decay),
+  _max_timestep(0),
+  _frozen(nodes[0]->_frozen)
+{
+    int outputs = nodes[0]->_output.value.rows();
+    int columns = 0;
+
+    for (Dense *node : nodes) {
+        assert(node->_output.value.rows() == outputs);
+        assert(node->_frozen == _frozen);
+
+        _dense_inputs.push_back(node->_input);
+        _offsets.push_back(columns);
+
+        columns += node->_weights.cols();
+    }
+
+    // Copy the parameters of the nodes side by side
+    _weights.resize(outputs, columns);
+    _biases.resize(outputs, nodes.size());
+
+    if (!_frozen) {
+        _d_weights.resize(outputs, columns);
+        _avg_d_weights.resize(outputs, columns);
+        _avg_d_biases.resize(outputs, nodes.size());
+
+        // The nodes received the same error, their bias gradients are the same
+        _d_bias = nodes[0]->_d_bias;
+    }
+
+    for (std::size_t i=0; i<nodes.size(); ++i) {
+        Dense *node = nodes[i];
+        int cols = node->_weights.cols();
+
+        _weights.middleCols(_offsets[i], cols) = node->_weights;
+        _biases.col(i) = node->_bias;
+
+        if (!_frozen) {
+            _d_weights.middleCols(_offsets[i], cols) = node->_d_weights;
+            _avg_d_weights.middleCols(_offsets[i], cols) = node->_avg_d_weights;
+            _avg_d_biases.col(i) = node->_avg_d_bias;
+        }
+
+        _max_timestep = std::max(_max_timestep, node->_max_timestep);
+    }
+
+    _bias = _biases.rowwise().sum();
+
+    // Same batch size as the nodes
+    _output.value.setZero(outputs, nodes[0]->_output.value.cols());
+    _output.error.setZero(nodes[0]->_output.error.rows(), nodes[0]->_output.error.cols());
+
+    _inputs = inputs;
+}
+
+bool DenseSum::canFuse(const std::vector<Dense *> &nodes)
+{
+    for (Dense *node : nodes) {
+        if (node->_output.value.rows() != nodes[0]->_output.value.rows() ||
+            node->_learning_rate != nodes[0]->_learning_rate ||
+            node->_decay != nodes[0]->_decay ||
+            node->_frozen != nodes[0]->_frozen ||
+            node->_quantized ||
+            node->_mapped_weights != nullptr ||
+            node->_precision != Full) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+void DenseSum::serialize(NetworkSerializer &serializer)
+{
+    // Same layout as the Dense nodes, zeros replacing the statistics of a
+    // frozen node
+    for (std::size_t i=0; i<_dense_inputs.size(); ++i) {
+        auto weights = _weights.middleCols(_offsets[i], _dense_inputs[i]->value.rows());
+
+        serializer.writeTensor(weights);
+
+        if (_frozen) {
+            serializer.writeStatistics(Matrix::Zero(weights.rows(), weights.cols()));
+        } else {
+            serializer.writeStatistics(_avg_d_weights.middleCols(_offsets[i], weights.cols()));
+        }
+
+        serializer.writeTensor(_biases.col(i));
+
+        if (_frozen) {
+            serializer.writeStatistics(Vector::Zero(_biases.rows()));
+        } else {
+            serializer.writeStatistics(_avg_d_biases.col(i));
+        }
+    }
+}
+
+void DenseSum::deserialize(NetworkSerializer &serializer)
+{
+    Matrix skipped_weights;
+    Matrix skipped_bias(_biases.rows(), 1);
+
+    for (std::size_t i=0; i<_dense_inputs.size(); ++i) {
+        auto weights = _weights.middleCols(_offsets[i], _dense_inputs[i]->value.rows());
+
+        // A frozen node skips the statistics
+        skipped_weights.resize(weights.rows(), weights.cols());
+
+        serializer.readTensor(weights);
+        serializer.readStatistics(_frozen ? skipped_weights.middleCols(0, weights.cols()) : _avg_d_weights.middleCols(_offsets[i], weights.cols()));
+        serializer.readTensor(_biases.col(i));
+        serializer.readStatistics(_frozen ? skipped_bias.col(0) : _avg_d_biases.col(i));
+    }
+
+    _bias = _biases.rowwise().sum();
+}
+
+void DenseSum::describe(Description &description)
+{
+    description.type = "DenseSum";
+    description.parameters = {
+        {"outputs", double(_output.value.rows())},
+        {"learning_rate", _learning_rate},
+        {"decay", _decay},
+        {"precision", double(Full)},
+        {"quantized", 0.0}
+    };
+
+    // The input of each Dense node, then the inputs summed as they are
+    for (Port *input : _dense_inputs) {
+        description.inputs.push_back(std::make_pair("setInput", input));
+    }
+
+    AbstractMergeNode::describe(description);
+}
+
+std::vector<AbstractNode::Port *> DenseSum::inputs()
+{
+    std::vector<Port *> rs = _dense_inputs;
+
+    rs.insert(rs.end(), _inputs.begin(), _inputs.end());
+
+    return rs;
+}
+
+bool DenseSum::replaceInput(Port *port, Port *by)
+{
+    std::replace(_dense_inputs.begin(), _dense_inputs.end(), port, by);
+
+    return AbstractMergeNode::replaceInput(port, by);
+}
+
+void DenseSum::forward()
+{
+    // Stack the inputs, then one matrix-matrix product for all of them
+    _stacked.resize(_weights.cols(), _dense_inputs[0]->value.cols());
+
+    for (std::size_t i=0; i<_dense_inputs.size(); ++i) {
+        _stacked.middleRows(_offsets[i], _dense_inputs[i]->value.rows()) = _dense_inputs[i]->value;
+    }
+
+    _output.value.noalias() = _weights * _stacked;
+    _output.value.colwise() += _bias;
+
+    for (Port *input : _inputs) {
+        _output.value.noalias() += input->value;
+    }
+}
+
+void DenseSum::backward()
+{
+    if (_frozen) {
+        throw std::logic_error("DenseSum::backward() called on a frozen node");
+    }
+
+    const Matrix &error = _output.error;
+
+    // Errors of all the inputs in one product
+    _stacked.noalias() = _weights.transpose() * error;
+
+    for (std::size_t i=0; i<_dense_inputs.size(); ++i) {
+        Port *input = _dense_inputs[i];
+        int rows = input->value.rows();
+
+        input->error += _stacked.middleRows(_offsets[i], rows);
+
+        // The inputs are read from their ports, whose values may have been
+        // restored after forward() was called
+        _d_weights.middleCols(_offsets[i], rows).noalias() -= error * input->value.transpose();
+    }
+
+    _d_bias.noalias() -= error.rowwise().sum();
+
+    for (Port *input : _inputs) {
+        input->error.noalias() += error;
+    }
+}
+
+void DenseSum::update()
+{
+    if (_frozen) {
+        throw std::logic_error("DenseSum::update() called on a frozen node");
+    }
+
+    // Normalization and RMSprop of Dense::update()
+    Float normalization_factor = Float(1) / Float(_max_timestep + 1);
+
+    _d_weights *= normalization_factor;
+    _d_bias *= normalization_factor;
+
+    Dense::rmsprop(_weights, _d_weights, _avg_d_weights, _learning_rate, _decay);
+
+    for (int i=0; i<_biases.cols(); ++i) {
+        Dense::rmsprop(_biases.col(i), _d_bias, _avg_d_biases.col(i), _learning_rate, _decay);
+    }
+
+    _bias = _biases.rowwise().sum();
+}
+
+void DenseSum::clearError()
+{
+    _output.error.setZero();
+    _output.value.setZero();
+
+    _d_weights *= Dense::momentum;
+    _d_bias *= Dense::momentum;
+}
+
+void DenseSum::setCurrentTimestep(unsigned int timestep)
+{
+    // Like Dense, clear the error signal but not the gradients
+    _output.error.setZero();
+    _output.value.setZero();
+
+    _max_timestep = std::max(_max_timestep, timestep);
+}
+
+void DenseSum::reset()
+{
+    _max_timestep = 0;
+}
+
+void DenseSum::freeze()
+{
+    AbstractNode::freeze();
+
+    _frozen = true;
+
+    _d_weights.resize(0, 0);
+    _avg_d_weights.resize(0, 0);
+    _avg_d_biases.resize(0, 0);
+    _d_bias.resize(0);
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2015 Vrije Universiteit Brussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __DENSESUM_H__
+#define __DENSESUM_H__
+
+#include "dense.h"
+#include "mergesum.h"
+
+/**
+ * @brief Sum of several Dense nodes, computed by one wider Dense over the
+ *        concatenation of their inputs
+ *
+ * This node replaces a MergeSum whose inputs are Dense nodes (see
+ * Network::optimize()). The weights of the Dense nodes are stored side by
+ * side in one matrix, so that the forward pass is one product, and the
+ * biases are summed. The gradients, updates and serialization are the ones
+ * of the original Dense nodes, and the optimized network loads the files of
+ * the original one, and conversely (see Network::deserialize()).
+ *
+ * The inputs of the MergeSum that are not produced by these Dense nodes are
+ * added to the sum as they are: they are the inputs of this MergeSum, and
+ * addInput() adds more of them. inputs() lists the inputs of the Dense nodes
+ * first.
+ */
+class DenseSum : public MergeSum
+{
+    public:
+        /**
+         * @brief Take the weights, statistics and inputs of @p nodes, that
+         *        all have the same number of outputs, and sum them with
+         *        @p inputs. The nodes are not used anymore by this object and
+         *        can be deleted.
+         */
+        DenseSum(const std::vector<Dense *> &nodes, const std::vector<Port *> &inputs = std::vector<Port *>());
+
+        /**
+         * @brief Whether @p nodes have the same number of outputs, learning
+         *        rate and decay, and are all frozen or not, so that they can
+         *        be replaced by a DenseSum
+         */
+        static bool canFuse(const std::vector<Dense *> &nodes);
+
+        virtual void serialize(NetworkSerializer &serializer);
+        virtual void deserialize(NetworkSerializer &serializer);
+        virtual void describe(Description &description);
+
+        virtual std::vector<Port *> inputs();
+        virtual bool replaceInput(Port *port, Port *by);
+        virtual void forward();
+        virtual void backward();
+        virtual void update();
+        virtual void clearError();
+        virtual void reset();
+        virtual void freeze();
+
+        virtual void setCurrentTimestep(unsigned int timestep);
+
+    private:
+        std::vector<Port *> _dense_inputs;  /*!< @brief Input of each Dense node */
+        std::vector<int> _offsets;          /*!< @brief First column of the weights of each Dense node */
+        Float _learning_rate;
+        Float _decay;
+
+        Matrix _weights;                    /*!< @brief Weights of the Dense nodes, side by side */
+        Matrix _d_weights;
+        Matrix _avg_d_weights;
+        Matrix _biases;                     /*!< @brief Column i contains the bias of the Dense node i */
+        Matrix _avg_d_biases;
+        Vector _d_bias;                     /*!< @brief Gradient shared by all the biases */
+        Vector _bias;                       /*!< @brief Sum of the biases */
+
+        Matrix _stacked;                    /*!< @brief Inputs one above the other, then their errors */
+
+        unsigned int _max_timestep;
+        bool _frozen;
+};
+
+#endif
@@ -0,0 +1,299 @@
+/*
+ * Copyright (c) 2015 Vrije Universiteit Brussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "fusedgru.h"
+#include <algorithm>
+#include <stdexcept>
+
+using namespace nnetcppinternal;
+
+FusedGRU::FusedGRU(unsigned int size, Float learning_rate, Float decay)
+: _size(size),
+  _learning_rate(learning_rate),
+  _decay(decay),
+  _loops_zr(2, size, learning_rate, decay),
+  _loop_h(1, size, learning_rate, decay),
+  _max_timestep(0)
+{
+    _output.value = Vector::Zero(size);
+    _output.error = Vector::Zero(size);
+
+    // The recurrent output is a copy of the output, registered as recurrent
+    // node so that the storage of AbstractRecurrentNetworkNode can be used
+    _recurrent_output = new LinearActivation;
+    _recurrent_output->setInput(&_output);
+
+    addNode(_recurrent_output);
+    addRecurrentNode(_recurrent_output);
+
+    // Like in GRU, the loop to Z has its bias initialized to one, so that the
+    // cell starts by being transparent
+    _loops_zr.setBiasToOne(0);
+
+    setBatchSize(1);
+    reset();
+}
+
+void FusedGRU::addInput(Port *input)
+{
+    _x_inputs.push_back(input);
+}
+
+void FusedGRU::addZ(Port *z)
+{
+    _z_inputs.push_back(z);
+}
+
+void FusedGRU::addR(Port *r)
+{
+    _r_inputs.push_back(r);
+}
+
+void FusedGRU::serialize(NetworkSerializer &serializer)
+{
+    // Same layout as GRU: the loops to Z, R and the input
+    _loops_zr.serialize(serializer);
+    _loop_h.serialize(serializer);
+}
+
+void FusedGRU::deserialize(NetworkSerializer &serializer)
+{
+    _loops_zr.deserialize(serializer);
+    _loop_h.deserialize(serializer);
+}
+
+void FusedGRU::describe(Description &description)
+{
+    description.type = "FusedGRU";
+    description.parameters = {
+        {"size", double(_size)},
+        {"learning_rate", _learning_rate},
+        {"decay", _decay}
+    };
+
+    for (Port *x : _x_inputs) {
+        description.inputs.push_back(std::make_pair("addInput", x));
+    }
+    for (Port *z : _z_inputs) {
+        description.inputs.push_back(std::make_pair("addZ", z));
+    }
+    for (Port *r : _r_inputs) {
+        description.inputs.push_back(std::make_pair("addR", r));
+    }
+}
+
+AbstractNode::Port *FusedGRU::output()
+{
+    return &_output;
+}
+
+std::vector<AbstractNode::Port *> FusedGRU::inputs()
+{
+    std::vector<Port *> rs;
+
+    rs.insert(rs.end(), _x_inputs.begin(), _x_inputs.end());
+    rs.insert(rs.end(), _z_inputs.begin(), _z_inputs.end());
+    rs.insert(rs.end(), _r_inputs.begin(), _r_inputs.end());
+
+    return rs;
+}
+
+void FusedGRU::collectPorts(std::vector<Port *> &ports)
+{
+    AbstractRecurrentNetworkNode::collectPorts(ports);
+
+    ports.push_back(&_output);
+    ports.push_back(&_h_prev);
+    ports.push_back(&_z);
+    ports.push_back(&_r);
+    ports.push_back(&_reset_times_h);
+    ports.push_back(&_c);
+}
+
+void FusedGRU::forward()
+{
+    const Matrix &h_prev = _recurrent_output->output()->value;
+    auto z_in = _zr.topRows(_size);
+    auto r_in = _zr.bottomRows(_size);
+
+    _h_prev.value = h_prev;
+
+    // Z and R from h(t-1) in one product, then their other inputs
+    _zr.noalias() = _loops_zr.weights * h_prev;
+    _zr.colwise() += _loops_zr.bias;
+
+    for (Port *z : _z_inputs) {
+        z_in += z->value;
+    }
+    for (Port *r : _r_inputs) {
+        r_in += r->value;
+    }
+
+    _z.value = z_in.unaryExpr(Sigmoid());
+    _r.value = r_in.unaryExpr(Sigmoid());
+    _reset_times_h.value = _r.value.cwiseProduct(h_prev);
+
+    // Candidate activation, from R * h(t-1) and X
+    _c.value.noalias() = _loop_h.weights * _reset_times_h.value;
+    _c.value.colwise() += _loop_h.bias;
+
+    for (Port *x : _x_inputs) {
+        _c.value += x->value;
+    }
+
+    _c.value = _c.value.unaryExpr(Tanh());
+
+    // h(t) = Z * h(t-1) + (1 - Z) * C
+    _output.value = _z.value.cwiseProduct(h_prev) +
+                    _c.value.cwiseProduct((Float(1) - _z.value.array()).matrix());
+
+    // Copy h(t) to the recurrent output, and store it
+    _recurrent_output->forward();
+    forwardRecurrent();
+}
+
+void FusedGRU::backward()
+{
+    if (isFrozen()) {
+        throw std::logic_error("FusedGRU::backward() called on a frozen node");
+    }
+
+    // This is the derivative of what the graph of GRU computes, including
+    // where it differs from the textbook GRU: the value of h seen by its
+    // MergeProduct and loops during the backward pass is h(t), not h(t-1),
+    // and only Z * h(t-1) propagates error to t-1.
+    const Matrix &h = _output.value;
+    const Matrix &h_prev = _h_prev.value;
+    Port *recurrent = _recurrent_output->output();
+    auto e_z = _zr.topRows(_size);
+    auto e_r = _zr.bottomRows(_size);
+
+    // Error of h(t), from the outside world and from t+1
+    _e = _output.error + recurrent->error;
+
+    // Through Z * h(t-1) + (1 - Z) * C
+    e_z = (_e.cwiseProduct(h_prev) - _e.cwiseProduct(_c.value)).cwiseProduct(_z.value.unaryExpr(dSigmoid()));
+    _e_c = _e.cwiseProduct((Float(1) - _z.value.array()).matrix()).cwiseProduct(_c.value.unaryExpr(dTanh()));
+    recurrent->error += _e.cwiseProduct(
+        _z.value.cwiseProduct(h_prev).cwiseQuotient((h.array() + 1e-20).matrix())
+    );
+
+    // Through the loop from R * h(t-1) to the candidate activation
+    _e_rh.noalias() = _loop_h.weights.transpose() * _e_c;
+    _loop_h.d_weights.noalias() -= _e_c * _reset_times_h.value.transpose();
+    _loop_h.d_bias.noalias() -= _e_c.rowwise().sum();
+
+    e_r = _e_rh.cwiseProduct(h_prev).cwiseProduct(_r.value.unaryExpr(dSigmoid()));
+
+    // Through the loops from h to Z and R, in one product
+    _loops_zr.d_weights.noalias() -= _zr * h.transpose();
+    _loops_zr.d_bias.noalias() -= _zr.rowwise().sum();
+
+    // Errors of the inputs
+    for (Port *x : _x_inputs) {
+        x->error += _e_c;
+    }
+    for (Port *z : _z_inputs) {
+        z->error += e_z;
+    }
+    for (Port *r : _r_inputs) {
+        r->error += e_r;
+    }
+
+    backwardRecurrent();
+}
+
+void FusedGRU::update()
+{
+    if (isFrozen()) {
+        throw std::logic_error("FusedGRU::update() called on a frozen node");
+    }
+
+    _loops_zr.update(_max_timestep);
+    _loop_h.update(_max_timestep);
+}
+
+void FusedGRU::clearError()
+{
+    AbstractRecurrentNetworkNode::clearError();
+
+    _output.error.setZero();
+    _output.value.setZero();
+
+    _loops_zr.clearGradients();
+    _loop_h.clearGradients();
+}
+
+void FusedGRU::reset()
+{
+    AbstractRecurrentNetworkNode::reset();
+
+    _max_timestep = 0;
+}
+
+void FusedGRU::setBatchSize(unsigned int batch_size)
+{
+    AbstractRecurrentNetworkNode::setBatchSize(batch_size);
+
+    _output.value.setZero(_size, batch_size);
+    _output.error.setZero(_output.error.rows(), batch_size);
+
+    for (Port *port : {&_h_prev, &_z, &_r, &_reset_times_h, &_c}) {
+        port->value.setZero(_size, batch_size);
+    }
+
+    _zr.setZero(2 * _size, batch_size);
+
+    if (!isFrozen()) {
+        _e.setZero(_size, batch_size);
+        _e_c.setZero(_size, batch_size);
+        _e_rh.setZero(_size, batch_size);
+    }
+}
+
+void FusedGRU::freeze()
+{
+    AbstractRecurrentNetworkNode::freeze();
+
+    _output.error.resize(0, 0);
+
+    _loops_zr.freeze();
+    _loop_h.freeze();
+
+    _e.resize(0, 0);
+    _e_c.resize(0, 0);
+    _e_rh.resize(0, 0);
+}
+
+void FusedGRU::setCurrentTimestep(unsigned int timestep)
+{
+    // Set the value and error of _recurrent_output
+    AbstractRecurrentNetworkNode::setCurrentTimestep(timestep);
+
+    // Like GRU, the output has the value of h(t-1) until forward() is called,
+    // and an error that only comes from the outside world
+    _output.value = _recurrent_output->output()->value;
+    _output.error.setZero();
+
+    // Sequence length, used to normalize the gradients
+    _max_timestep = std::max(_max_timestep, timestep);
+}
@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2015 Vrije Universiteit Brussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __FUSEDGRU_H__
+#define __FUSEDGRU_H__
+
+#include "abstractrecurrentnetworknode.h"
+#include "activation.h"
+#include "stackedweights.h"
+
+/**
+ * @brief Gated Recurrent Units layer computed by a single fused kernel
+ *
+ * This node computes exactly what GRU computes, forward and backward, but
+ * without its graph of 17 nodes: the update and reset gates are produced by
+ * one product with a stacked weight matrix, and the element-wise operations of
+ * a time step are evaluated in a few passes over the batch.
+ *
+ * The weights are serialized in the same format as the ones of GRU, so that
+ * one can be replaced with the other in a trained network: a network using
+ * one loads the files of a network using the other (see
+ * Network::deserialize()).
+ */
+class FusedGRU : public AbstractRecurrentNetworkNode
+{
+    public:
+        /**
+         * @brief Layer of GRU units. All the input and output ports of this
+         *        layer have the same shape.
+         *
+         * @see GRU::GRU
+         */
+        FusedGRU(unsigned int size, Float learning_rate, Float decay = 0.9f);
+
+        /**
+         * @brief Add an X input to this network
+         */
+        void addInput(Port *input);
+
+        /**
+         * @brief Add a Z (update gate) input to this network
+         */
+        void addZ(Port *z);
+
+        /**
+         * @brief Add a R (reset gate) input to this network
+         */
+        void addR(Port *r);
+
+        virtual void serialize(NetworkSerializer &serializer);
+        virtual void deserialize(NetworkSerializer &serializer);
+        virtual void describe(Description &description);
+
+        virtual Port *output();
+        virtual std::vector<Port *> inputs();
+        virtual void collectPorts(std::vector<Port *> &ports);
+        virtual void forward();
+        virtual void backward();
+        virtual void update();
+        virtual void clearError();
+        virtual void reset();
+        virtual void setBatchSize(unsigned int batch_size);
+        virtual void freeze();
+
+        virtual void setCurrentTimestep(unsigned int timestep);
+
+    private:
+        unsigned int _size;
+        Float _learning_rate;
+        Float _decay;
+
+        std::vector<Port *> _x_inputs;
+        std::vector<Port *> _z_inputs;
+        std::vector<Port *> _r_inputs;
+
+        Port _output;                           /*!< @brief h(t), receives error from the outside world */
+        LinearActivation *_recurrent_output;    /*!< @brief h(t-1) during forward(), receives error from t+1 */
+
+        // Values of time t, needed by backward()
+        Port _h_prev;
+        Port _z;
+        Port _r;
+        Port _reset_times_h;
+        Port _c;
+
+        // Scratch buffers of the size of the batch
+        Matrix _zr;                             /*!< @brief Z and R stacked, before their activation, then their errors */
+        Matrix _e;                              /*!< @brief Error of h(t) */
+        Matrix _e_c;                            /*!< @brief Error of the candidate activation, before tanh */
+        Matrix _e_rh;                           /*!< @brief Error of R * h(t-1) */
+
+        // Recurrent weights, the loops to Z and R being stacked
+        StackedWeights _loops_zr;
+        StackedWeights _loop_h;
+
+        unsigned int _max_timestep;
+};
+
+#endif
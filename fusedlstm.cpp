@@ -0,0 +1,301 @@
+/*
+ * Copyright (c) 2015 Vrije Universiteit Brussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "fusedlstm.h"
+
+#include <algorithm>
+#include <stdexcept>
+
+using namespace nnetcppinternal;
+
+FusedLSTM::FusedLSTM(unsigned int size, Float learning_rate, Float decay)
+: _size(size),
+  _learning_rate(learning_rate),
+  _decay(decay),
+  _loops(NumGates, size, learning_rate, decay),
+  _max_timestep(0)
+{
+    _output.value = Vector::Zero(size);
+    _output.error = Vector::Zero(size);
+    _cells.value = Vector::Zero(size);
+
+    // The recurrent cells are a copy of the cells, registered as recurrent
+    // node so that the storage of AbstractRecurrentNetworkNode can be used
+    _cells_recurrent = new LinearActivation;
+    _cells_recurrent->setInput(&_cells);
+
+    addNode(_cells_recurrent);
+    addRecurrentNode(_cells_recurrent);
+
+    // Like in LSTM, the forget gate has its bias initialized to one
+    _loops.setBiasToOne(ForgetGate);
+
+    setBatchSize(1);
+    reset();
+}
+
+void FusedLSTM::addInput(Port *input)
+{
+    _inputs[Input].push_back(input);
+}
+
+void FusedLSTM::addInGate(Port *in)
+{
+    _inputs[InputGate].push_back(in);
+}
+
+void FusedLSTM::addOutGate(Port *out)
+{
+    _inputs[OutputGate].push_back(out);
+}
+
+void FusedLSTM::addForgetGate(Port *forget)
+{
+    _inputs[ForgetGate].push_back(forget);
+}
+
+void FusedLSTM::serialize(NetworkSerializer &serializer)
+{
+    _loops.serialize(serializer);
+}
+
+void FusedLSTM::deserialize(NetworkSerializer &serializer)
+{
+    _loops.deserialize(serializer);
+}
+
+void FusedLSTM::describe(Description &description)
+{
+    static const char *methods[NumGates] = {"addForgetGate", "addInput", "addInGate", "addOutGate"};
+
+    description.type = "FusedLSTM";
+    description.parameters = {
+        {"size", double(_size)},
+        {"learning_rate", _learning_rate},
+        {"decay", _decay}
+    };
+
+    for (int gate=0; gate<NumGates; ++gate) {
+        for (Port *input : _inputs[gate]) {
+            description.inputs.push_back(std::make_pair(methods[gate], input));
+        }
+    }
+}
+
+AbstractNode::Port *FusedLSTM::output()
+{
+    return &_output;
+}
+
+std::vector<AbstractNode::Port *> FusedLSTM::inputs()
+{
+    std::vector<Port *> rs;
+
+    for (const std::vector<Port *> &inputs : _inputs) {
+        rs.insert(rs.end(), inputs.begin(), inputs.end());
+    }
+
+    return rs;
+}
+
+void FusedLSTM::collectPorts(std::vector<Port *> &ports)
+{
+    AbstractRecurrentNetworkNode::collectPorts(ports);
+
+    ports.push_back(&_output);
+    ports.push_back(&_cells);
+    ports.push_back(&_cells_prev);
+    ports.push_back(&_gates);
+    ports.push_back(&_cells_activation);
+}
+
+Matrix::RowsBlockXpr FusedLSTM::rows(Matrix &stacked, Gate gate)
+{
+    return stacked.middleRows(gate * _size, _size);
+}
+
+void FusedLSTM::forward()
+{
+    const Matrix &cells_prev = _cells_recurrent->output()->value;
+    Matrix &gates = _gates.value;
+
+    _cells_prev.value = cells_prev;
+
+    // The gates and the input from c(t-1) in one product, then their other
+    // inputs. Like in LSTM, the output gate reads the recurrent connection
+    // of the forget gate, the block of the output gate being unused.
+    auto loops = gates.topRows(OutputGate * _size);
+
+    loops.noalias() = _loops.weights.topRows(OutputGate * _size) * cells_prev;
+    loops.colwise() += _loops.bias.head(OutputGate * _size);
+    rows(gates, OutputGate) = rows(gates, ForgetGate);
+
+    for (int gate=0; gate<NumGates; ++gate) {
+        auto block = rows(gates, Gate(gate));
+
+        for (Port *input : _inputs[gate]) {
+            block += input->value;
+        }
+    }
+
+    // Activations, in place
+    rows(gates, ForgetGate) = rows(gates, ForgetGate).unaryExpr(Sigmoid());
+    rows(gates, Input) = rows(gates, Input).unaryExpr(Tanh());
+    rows(gates, InputGate) = rows(gates, InputGate).unaryExpr(Sigmoid());
+    rows(gates, OutputGate) = rows(gates, OutputGate).unaryExpr(Sigmoid());
+
+    // c(t) = I * X + F * c(t-1), h(t) = O * tanh(c(t))
+    _cells.value = rows(gates, InputGate).cwiseProduct(rows(gates, Input)) +
+                   rows(gates, ForgetGate).cwiseProduct(cells_prev);
+    _cells_activation.value = _cells.value.unaryExpr(Tanh());
+    _output.value = rows(gates, OutputGate).cwiseProduct(_cells_activation.value);
+
+    // Copy c(t) to the recurrent cells, and store it
+    _cells_recurrent->forward();
+    forwardRecurrent();
+}
+
+void FusedLSTM::backward()
+{
+    if (isFrozen()) {
+        throw std::logic_error("FusedLSTM::backward() called on a frozen node");
+    }
+
+    // This is the derivative of what the graph of LSTM computes: its
+    // MergeProduct and loops see c(t) as value of the recurrent cells during
+    // the backward pass, not c(t-1).
+    Matrix &gates = _gates.value;
+    const Matrix &cells = _cells.value;
+    const Matrix &cells_prev = _cells_prev.value;
+    const Matrix &activation = _cells_activation.value;
+    Port *recurrent = _cells_recurrent->output();
+
+    // Error of c(t), from h(t) and from t+1
+    _e_cells = _output.error.cwiseProduct(rows(gates, OutputGate))
+                            .cwiseProduct(activation.unaryExpr(dTanh()))
+             + recurrent->error;
+
+    // Errors of the gates and input, before their activation
+    rows(_e_gates, ForgetGate) = _e_cells.cwiseProduct(cells_prev)
+                                         .cwiseProduct(rows(gates, ForgetGate).unaryExpr(dSigmoid()));
+    rows(_e_gates, Input) = _e_cells.cwiseProduct(rows(gates, InputGate))
+                                    .cwiseProduct(rows(gates, Input).unaryExpr(dTanh()));
+    rows(_e_gates, InputGate) = _e_cells.cwiseProduct(rows(gates, Input))
+                                        .cwiseProduct(rows(gates, InputGate).unaryExpr(dSigmoid()));
+    rows(_e_gates, OutputGate) = _output.error.cwiseProduct(activation)
+                                              .cwiseProduct(rows(gates, OutputGate).unaryExpr(dSigmoid()));
+
+    // Errors of the inputs
+    for (int gate=0; gate<NumGates; ++gate) {
+        auto block = rows(_e_gates, Gate(gate));
+
+        for (Port *input : _inputs[gate]) {
+            input->error += block;
+        }
+    }
+
+    // The recurrent connection of the forget gate receives the errors of the
+    // forget and output gates, the one of the output gate none
+    auto e_loops = _e_gates.topRows(OutputGate * _size);
+
+    rows(_e_gates, ForgetGate) += rows(_e_gates, OutputGate);
+
+    // Error to t-1, through F * c(t-1) and the three loops used
+    recurrent->error += _e_cells.cwiseProduct(
+        rows(gates, ForgetGate).cwiseProduct(cells_prev).cwiseQuotient((cells.array() + 1e-20).matrix())
+    );
+    recurrent->error.noalias() += _loops.weights.topRows(OutputGate * _size).transpose() * e_loops;
+
+    // Gradients of the loops, in one product
+    _loops.d_weights.topRows(OutputGate * _size).noalias() -= e_loops * cells.transpose();
+    _loops.d_bias.head(OutputGate * _size).noalias() -= e_loops.rowwise().sum();
+
+    backwardRecurrent();
+}
+
+void FusedLSTM::update()
+{
+    if (isFrozen()) {
+        throw std::logic_error("FusedLSTM::update() called on a frozen node");
+    }
+
+    _loops.update(_max_timestep);
+}
+
+void FusedLSTM::clearError()
+{
+    AbstractRecurrentNetworkNode::clearError();
+
+    _output.error.setZero();
+    _output.value.setZero();
+
+    _loops.clearGradients();
+}
+
+void FusedLSTM::reset()
+{
+    AbstractRecurrentNetworkNode::reset();
+
+    _max_timestep = 0;
+}
+
+void FusedLSTM::setBatchSize(unsigned int batch_size)
+{
+    AbstractRecurrentNetworkNode::setBatchSize(batch_size);
+
+    _output.value.setZero(_size, batch_size);
+    _output.error.setZero(_output.error.rows(), batch_size);
+
+    for (Port *port : {&_cells, &_cells_prev, &_cells_activation}) {
+        port->value.setZero(_size, batch_size);
+    }
+
+    _gates.value.setZero(NumGates * _size, batch_size);
+
+    if (!isFrozen()) {
+        _e_gates.setZero(NumGates * _size, batch_size);
+        _e_cells.setZero(_size, batch_size);
+    }
+}
+
+void FusedLSTM::freeze()
+{
+    AbstractRecurrentNetworkNode::freeze();
+
+    _output.error.resize(0, 0);
+    _loops.freeze();
+
+    _e_gates.resize(0, 0);
+    _e_cells.resize(0, 0);
+}
+
+void FusedLSTM::setCurrentTimestep(unsigned int timestep)
+{
+    // Set the value and error of _cells_recurrent
+    AbstractRecurrentNetworkNode::setCurrentTimestep(timestep);
+
+    _output.error.setZero();
+    _output.value.setZero();
+
+    // Sequence length, used to normalize the gradients
+    _max_timestep = std::max(_max_timestep, timestep);
+}
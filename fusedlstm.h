@@ -0,0 +1,136 @@
+/*
+ * Copyright (c) 2015 Vrije Universiteit Brussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __FUSEDLSTM_H__
+#define __FUSEDLSTM_H__
+
+#include "abstractrecurrentnetworknode.h"
+#include "activation.h"
+#include "stackedweights.h"
+
+/**
+ * @brief Long Short-Term Memory layer computed by a single fused kernel
+ *
+ * This node computes exactly what LSTM computes, forward and backward, without
+ * its graph of 20 nodes: the recurrent projections are one product with a
+ * stacked weight matrix, and the gates and products of a time step are
+ * evaluated in a few passes over the batch.
+ *
+ * Like in LSTM, the output gate reads the recurrent connection of the forget
+ * gate. The recurrent weights of the output gate are kept, serialized and
+ * never changed, so that the weights are serialized in the same format as
+ * the ones of LSTM, and a network using one loads the files of a network
+ * using the other (see Network::deserialize()).
+ */
+class FusedLSTM : public AbstractRecurrentNetworkNode
+{
+    public:
+        /**
+         * @brief Layer of LSTM cells. All the input and output ports of this
+         *        layer have the same shape.
+         *
+         * @see LSTM::LSTM
+         */
+        FusedLSTM(unsigned int size, Float learning_rate, Float decay = 0.9f);
+
+        /**
+         * @brief Add an X input to this network
+         */
+        void addInput(Port *input);
+
+        /**
+         * @brief Add an input gate input to this network
+         */
+        void addInGate(Port *in);
+
+        /**
+         * @brief Add an output gate input to this network
+         */
+        void addOutGate(Port *out);
+
+        /**
+         * @brief Add a forget gate input to this network
+         */
+        void addForgetGate(Port *forget);
+
+        virtual void serialize(NetworkSerializer &serializer);
+        virtual void deserialize(NetworkSerializer &serializer);
+        virtual void describe(Description &description);
+
+        virtual Port *output();
+        virtual std::vector<Port *> inputs();
+        virtual void collectPorts(std::vector<Port *> &ports);
+        virtual void forward();
+        virtual void backward();
+        virtual void update();
+        virtual void clearError();
+        virtual void reset();
+        virtual void setBatchSize(unsigned int batch_size);
+        virtual void freeze();
+
+        virtual void setCurrentTimestep(unsigned int timestep);
+
+    private:
+        /**
+         * @brief Rows of the stacked matrices, in the order in which LSTM
+         *        serializes its recurrent Dense nodes
+         */
+        enum Gate {
+            ForgetGate = 0,
+            Input = 1,
+            InputGate = 2,
+            OutputGate = 3,
+            NumGates = 4
+        };
+
+        /**
+         * @brief Rows of @p gate in @p stacked
+         */
+        Matrix::RowsBlockXpr rows(Matrix &stacked, Gate gate);
+
+    private:
+        unsigned int _size;
+        Float _learning_rate;
+        Float _decay;
+
+        std::vector<Port *> _inputs[NumGates];
+
+        Port _output;                           /*!< @brief h(t) = O * tanh(c(t)) */
+        Port _cells;                            /*!< @brief c(t) */
+        LinearActivation *_cells_recurrent;     /*!< @brief c(t-1) during forward(), receives error from t+1 */
+
+        // Values of time t, needed by backward()
+        Port _cells_prev;
+        Port _gates;                            /*!< @brief Activations of the stacked gates and input */
+        Port _cells_activation;
+
+        // Scratch buffers of the size of the batch
+        Matrix _e_gates;                        /*!< @brief Errors of the stacked gates, before their activation */
+        Matrix _e_cells;
+
+        // Recurrent weights, the four projections being stacked
+        StackedWeights _loops;
+
+        unsigned int _max_timestep;
+};
+
+#endif
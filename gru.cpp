@@ -114,6 +114,31 @@ GRU::GRU(unsigned int size, Float learning_rate, Float decay)
     reset();
 }
 
+/**
+ * @brief Describe the inputs of @p merge added by @p method, the first one
+ *        being the recurrent connection added by the constructor (the input
+ *        of its Dense node once fused in a DenseSum, see DenseSum::inputs())
+ */
+static void describeInputs(AbstractNode::Description &description, const char *method, MergeSum *merge)
+{
+    std::vector<AbstractNode::Port *> inputs = merge->inputs();
+
+    for (std::size_t i=1; i<inputs.size(); ++i) {
+        description.inputs.push_back(std::make_pair(method, inputs[i]));
+    }
+}
+
+void GRU::describe(Description &description)
+{
+    description.type = "GRU";
+    description.parameters.push_back(std::make_pair("size", double(output()->value.rows())));
+
+    describeDenseNodes(description);
+    describeInputs(description, "addInput", _inputs);
+    describeInputs(description, "addZ", _updates);
+    describeInputs(description, "addR", _resets);
+}
+
 AbstractNode::Port *GRU::output()
 {
     return _real_output->output();
@@ -144,3 +169,15 @@ void GRU::setCurrentTimestep(unsigned int timestep)
     // receive it from the outside world and not from any recurrent connection
     _real_output->output()->value = _recurrent_output->output()->value;
 }
+
+void GRU::mergeSumReplaced(MergeSum *merge, MergeSum *by)
+{
+    // A gate fused with its recurrent Dense node by Network::optimize()
+    if (_inputs == merge) {
+        _inputs = by;
+    } else if (_updates == merge) {
+        _updates = by;
+    } else if (_resets == merge) {
+        _resets = by;
+    }
+}
@@ -65,9 +65,13 @@ class GRU : public AbstractRecurrentNetworkNode
          */
         void addR(Port *r);
 
+        virtual void describe(Description &description);
         virtual Port* output();
         virtual void setCurrentTimestep(unsigned int timestep);
 
+    protected:
+        virtual void mergeSumReplaced(MergeSum *merge, MergeSum *by);
+
     private:
         MergeSum *_inputs;
         MergeSum *_updates;
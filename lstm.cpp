@@ -120,6 +120,32 @@ LSTM::LSTM(unsigned int size, Float learning_rate, Float decay)
     reset();
 }
 
+/**
+ * @brief Describe the inputs of @p merge added by @p method, the first one
+ *        being the recurrent connection added by the constructor (the input
+ *        of its Dense node once fused in a DenseSum, see DenseSum::inputs())
+ */
+static void describeInputs(AbstractNode::Description &description, const char *method, MergeSum *merge)
+{
+    std::vector<AbstractNode::Port *> inputs = merge->inputs();
+
+    for (std::size_t i=1; i<inputs.size(); ++i) {
+        description.inputs.push_back(std::make_pair(method, inputs[i]));
+    }
+}
+
+void LSTM::describe(Description &description)
+{
+    description.type = "LSTM";
+    description.parameters.push_back(std::make_pair("size", double(output()->value.rows())));
+
+    describeDenseNodes(description);
+    describeInputs(description, "addInput", _inputs);
+    describeInputs(description, "addInGate", _ingates);
+    describeInputs(description, "addOutGate", _outgates);
+    describeInputs(description, "addForgetGate", _forgetgates);
+}
+
 AbstractNode::Port *LSTM::output()
 {
     return _output->output();
@@ -144,3 +170,17 @@ void LSTM::addForgetGate(Port *forget)
 {
     _forgetgates->addInput(forget);
 }
+
+void LSTM::mergeSumReplaced(MergeSum *merge, MergeSum *by)
+{
+    // A gate fused with its recurrent Dense node by Network::optimize()
+    if (_inputs == merge) {
+        _inputs = by;
+    } else if (_ingates == merge) {
+        _ingates = by;
+    } else if (_outgates == merge) {
+        _outgates = by;
+    } else if (_forgetgates == merge) {
+        _forgetgates = by;
+    }
+}
@@ -70,8 +70,12 @@ class LSTM : public AbstractRecurrentNetworkNode
          */
         void addForgetGate(Port *forget);
 
+        virtual void describe(Description &description);
         virtual Port* output();
 
+    protected:
+        virtual void mergeSumReplaced(MergeSum *merge, MergeSum *by);
+
     private:
         MergeSum *_inputs;
         MergeSum *_ingates;
@@ -26,6 +26,13 @@ MergeProduct::MergeProduct()
 {
 }
 
+void MergeProduct::describe(Description &description)
+{
+    AbstractMergeNode::describe(description);
+
+    description.type = "MergeProduct";
+}
+
 void MergeProduct::forward()
 {
     _output.value.setOnes();
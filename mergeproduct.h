@@ -33,6 +33,8 @@ class MergeProduct : public AbstractMergeNode
     public:
         MergeProduct();
 
+        virtual void describe(Description &description);
+
         virtual void forward();
         virtual void backward();
 };
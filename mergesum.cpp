@@ -26,6 +26,13 @@ MergeSum::MergeSum()
 {
 }
 
+void MergeSum::describe(Description &description)
+{
+    AbstractMergeNode::describe(description);
+
+    description.type = "MergeSum";
+}
+
 void MergeSum::forward()
 {
     _output.value.setZero();
@@ -33,6 +33,8 @@ class MergeSum : public AbstractMergeNode
     public:
         MergeSum();
 
+        virtual void describe(Description &description);
+
         virtual void forward();
         virtual void backward();
 };
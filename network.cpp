@@ -21,11 +21,34 @@
  */
 
 #include "network.h"
+#include "networkserializer.h"
+#include "session.h"
+#include "activation.h"
+#include "denseactivation.h"
+#include "mergesum.h"
+#include "mergeproduct.h"
+#include "densesum.h"
+#include "gru.h"
+#include "fusedgru.h"
+#include "lstm.h"
+#include "fusedlstm.h"
+#include "cwrnn.h"
 
 #include <assert.h>
 #include <algorithm>
+#include <cstdlib>
+#include <functional>
+#include <iomanip>
+#include <limits>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+
+std::size_t Network::activation_memory = 512 << 20;
 
 Network::Network(unsigned int inputs)
+: _stream_timestep(0)
 {
     _input_port.error = Vector::Zero(inputs);
     _input_port.value = Vector::Zero(inputs);
@@ -41,8 +64,152 @@ AbstractNode::Port *Network::output()
     return _nodes.back()->output();
 }
 
+void Network::predictBatch(const Matrix &inputs, Matrix &outputs)
+{
+    predict(inputs, nullptr);
+
+    // Copy the output in the buffer of the caller (this does not allocate
+    // anything if the buffer already has the right size)
+    outputs = output()->value;
+}
+
+void Network::step(const std::vector<Session *> &sessions,
+                   const Matrix &inputs,
+                   Matrix &outputs)
+{
+    unsigned int period = this->period();
+
+    assert(inputs.rows() == _input_port.value.rows());
+    assert(inputs.cols() == int(sessions.size()));
+
+    outputs.resize(output()->value.rows(), sessions.size());
+
+    if (sessions.empty()) {
+        return;
+    }
+
+    // Sessions at the same phase of the period of the network are forwarded
+    // together
+    _session_indexes.resize(sessions.size());
+
+    for (std::size_t i=0; i<sessions.size(); ++i) {
+        _session_indexes[i] = i;
+    }
+
+    std::stable_sort(_session_indexes.begin(), _session_indexes.end(), [&](int a, int b) {
+        return sessions[a]->_timestep % period < sessions[b]->_timestep % period;
+    });
+
+    // A session stepped twice would have its state loaded twice, and only one
+    // of its new states stored
+    _sorted_sessions.assign(sessions.begin(), sessions.end());
+    std::sort(_sorted_sessions.begin(), _sorted_sessions.end());
+
+    if (std::adjacent_find(_sorted_sessions.begin(), _sorted_sessions.end()) != _sorted_sessions.end()) {
+        throw std::invalid_argument("Network::step() called with a session appearing twice");
+    }
+
+    // The network is sized for the largest group of sessions, the smaller
+    // groups using the first columns of its ports. Its size therefore only
+    // changes when the largest group does, and not at every group.
+    int largest = 0;
+
+    for (std::size_t start=0; start < sessions.size(); ) {
+        unsigned int phase = sessions[_session_indexes[start]]->_timestep % period;
+        std::size_t end = start;
+
+        while (end < sessions.size() && sessions[_session_indexes[end]]->_timestep % period == phase) {
+            ++end;
+        }
+
+        largest = std::max(largest, int(end - start));
+        start = end;
+    }
+
+    if (largest != _input_port.value.cols()) {
+        // This leaves the streaming mode
+        setBatchSize(largest);
+    }
+
+    if (!isStreaming()) {
+        setStreaming(true);
+    }
+
+    int state_size = stateSize();
+
+    _states.clear();
+    collectStates(_states);
+
+    for (std::size_t start=0; start < sessions.size(); ) {
+        unsigned int phase = sessions[_session_indexes[start]]->_timestep % period;
+        std::size_t end = start;
+
+        while (end < sessions.size() && sessions[_session_indexes[end]]->_timestep % period == phase) {
+            ++end;
+        }
+
+        int count = end - start;
+
+        // The columns not used by this group are forwarded with a zero input,
+        // and their outputs ignored
+        _input_port.value.rightCols(largest - count).setZero();
+
+        // Load the recurrent state and the input of every session
+        for (int i=0; i<count; ++i) {
+            Session *session = sessions[_session_indexes[start + i]];
+            Eigen::Map<Vector> session_state(session->stateData(state_size), state_size);
+            int row = 0;
+
+            for (Matrix::ColsBlockXpr &state : _states) {
+                if (session->_timestep == 0) {
+                    // Beginning of the stream
+                    state.col(i).setZero();
+                } else {
+                    state.col(i) = session_state.segment(row, state.rows());
+                }
+
+                row += state.rows();
+            }
+
+            _input_port.value.col(i) = inputs.col(_session_indexes[start + i]);
+        }
+
+        // Forward the sessions at a time step greater than zero (that would
+        // clear the recurrent state) and having the right phase
+        setCurrentTimestep(period + phase);
+
+        forwardNodes();
+
+        // Store the new recurrent state of the sessions, and their outputs
+        for (int i=0; i<count; ++i) {
+            Session *session = sessions[_session_indexes[start + i]];
+            Eigen::Map<Vector> session_state(session->stateData(state_size), state_size);
+            int row = 0;
+
+            for (Matrix::ColsBlockXpr &state : _states) {
+                session_state.segment(row, state.rows()) = state.col(i);
+                row += state.rows();
+            }
+
+            session->_timestep += 1;
+            outputs.col(_session_indexes[start + i]) = output()->value.col(i);
+        }
+
+        start = end;
+    }
+
+    // The recurrent state now belongs to the sessions, the next call to
+    // step(input) starts a new stream
+    _stream_timestep = 0;
+}
+
 void Network::reset()
 {
+    // The storage of a stream cannot be used for a normal sequence
+    if (isStreaming()) {
+        setStreaming(false);
+    }
+
     // Call reset on all the nodes
     AbstractRecurrentNetworkNode::reset();
 
@@ -50,6 +217,661 @@ void Network::reset()
     setCurrentTimestep(0);
 }
 
+std::pair<unsigned int, unsigned int> Network::optimize()
+{
+    unsigned int before = countNodes();
+
+    optimizeNodes();
+
+    return std::make_pair(before, countNodes());
+}
+
+bool Network::isGraphInput(Port *port)
+{
+    // The ports that no node produces may be produced by the sub-nodes of a
+    // node, at any time during the forward pass
+    return port == &_input_port;
+}
+
+void Network::freeze()
+{
+    AbstractRecurrentNetworkNode::freeze();
+
+    _input_port.error.resize(0, 0);
+
+    // Buffers used by trainSequence()
+    _sequence_input_port = Port();
+    _hoisted_ports.clear();
+    _stored_values.resize(0, 0);
+}
+
+unsigned int Network::quantize()
+{
+    freeze();
+
+    return AbstractRecurrentNetworkNode::quantize();
+}
+
+Network::QuantizationReport Network::quantize(const Matrix &calibration_inputs)
+{
+    QuantizationReport report;
+    Matrix reference;
+    Matrix outputs;
+
+    reset();
+    predictBatch(calibration_inputs, reference);
+
+    report.nodes = quantize();
+
+    reset();
+    predictBatch(calibration_inputs, outputs);
+    reset();
+
+    outputs -= reference;
+
+    report.max_error = outputs.cwiseAbs().maxCoeff();
+    report.mean_squared_error = outputs.squaredNorm() / Float(outputs.size());
+
+    return report;
+}
+
+void Network::serialize(NetworkSerializer &serializer)
+{
+    serializer.setDescription(topology());
+
+    AbstractRecurrentNetworkNode::serialize(serializer);
+}
+
+std::string Network::topology()
+{
+    std::ostringstream s;
+    std::vector<Port *> outputs;
+
+    for (AbstractNode *node : _nodes) {
+        outputs.push_back(node->output());
+    }
+
+    // Enough digits for the parameters to be read back exactly
+    s << std::setprecision(std::numeric_limits<double>::max_digits10);
+    s << "Network inputs=" << _input_port.value.rows()
+      << " momentum=" << double(Dense::momentum)
+      << " frozen=" << isFrozen() << '\n';
+
+    for (AbstractNode *node : _nodes) {
+        Description description;
+
+        node->describe(description);
+
+        if (description.type.empty()) {
+            return std::string();
+        }
+
+        s << description.type;
+
+        for (const auto &parameter : description.parameters) {
+            s << ' ' << parameter.first << '=' << parameter.second;
+        }
+
+        if (isRecurrentNode(node)) {
+            s << " recurrent=1";
+        }
+
+        // Inputs are the input of the network or the output of a node
+        for (const auto &input : description.inputs) {
+            auto it = std::find(outputs.begin(), outputs.end(), input.second);
+
+            s << ' ' << input.first << "=@";
+
+            if (input.second == &_input_port) {
+                s << "input";
+            } else if (it != outputs.end()) {
+                s << (it - outputs.begin());
+            } else {
+                return std::string();
+            }
+        }
+
+        s << '\n';
+    }
+
+    return s.str();
+}
+
+/**
+ * @brief Line of a description produced by Network::topology()
+ */
+struct DescribedNode
+{
+    std::string type;
+    std::map<std::string, double> parameters;
+    std::vector<std::pair<std::string, int> > inputs;   /*!< @brief Method and index of the node producing the input, -1 for the input of the network */
+};
+
+/**
+ * @brief Function that connects a port to a node built by buildNode(),
+ *        given the name of the method to use
+ */
+typedef std::function<void(const std::string &, AbstractNode::Port *)> Connector;
+
+static std::runtime_error invalidDescription(const std::string &reason)
+{
+    return std::runtime_error("Invalid network description: " + reason);
+}
+
+static DescribedNode parseNode(const std::string &line)
+{
+    std::istringstream s(line);
+    std::string token;
+    DescribedNode rs;
+
+    s >> rs.type;
+
+    while (s >> token) {
+        std::size_t equal = token.find('=');
+        std::string name = token.substr(0, equal);
+        std::string value = (equal == std::string::npos ? std::string() : token.substr(equal + 1));
+        const char *begin = value.c_str();
+        char *end = nullptr;
+
+        if (value == "@input") {
+            rs.inputs.push_back(std::make_pair(name, -1));
+        } else if (value.size() > 1 && value[0] == '@') {
+            rs.inputs.push_back(std::make_pair(name, int(std::strtol(begin + 1, &end, 10))));
+        } else {
+            rs.parameters[name] = std::strtod(begin, &end);
+        }
+
+        if (value.empty() || (end != nullptr && *end != '\0')) {
+            throw invalidDescription("cannot read " + token);
+        }
+    }
+
+    return rs;
+}
+
+static double parameter(const DescribedNode &node, const char *name)
+{
+    auto it = node.parameters.find(name);
+
+    if (it == node.parameters.end()) {
+        throw invalidDescription(node.type + " has no parameter " + name);
+    }
+
+    return it->second;
+}
+
+/**
+ * @brief Set @p connect so that it calls the method of @p node in @p methods
+ *        whose name it receives
+ */
+template<typename T>
+static AbstractNode *connectable(T *node, Connector &connect, const std::map<std::string, void (T::*)(AbstractNode::Port *)> &methods)
+{
+    connect = [node, methods](const std::string &method, AbstractNode::Port *port) {
+        auto it = methods.find(method);
+
+        if (it == methods.end()) {
+            throw invalidDescription("unknown method " + method);
+        }
+
+        (node->*(it->second))(port);
+    };
+
+    return node;
+}
+
+/**
+ * @brief Build the node described by @p node, whose inputs are connected
+ *        by @p connect. DenseSum nodes, built from their inputs, are not
+ *        built by this function.
+ */
+static AbstractNode *buildNode(const DescribedNode &node, Connector &connect)
+{
+    const std::string &type = node.type;
+
+    if (type == "Dense" || type == "TanhDense" || type == "SigmoidDense") {
+        unsigned int outputs = parameter(node, "outputs");
+        Float learning_rate = parameter(node, "learning_rate");
+        Float decay = parameter(node, "decay");
+        bool bias_initialized_at_one = parameter(node, "bias_initialized_at_one");
+        Dense *dense;
+
+        if (type == "TanhDense") {
+            dense = new TanhDense(outputs, learning_rate, decay, bias_initialized_at_one);
+        } else if (type == "SigmoidDense") {
+            dense = new SigmoidDense(outputs, learning_rate, decay, bias_initialized_at_one);
+        } else {
+            dense = new Dense(outputs, learning_rate, decay, bias_initialized_at_one);
+        }
+
+        return connectable<Dense>(dense, connect, {{"setInput", &Dense::setInput}});
+    } else if (type == "TanhActivation") {
+        return connectable(new TanhActivation, connect, {{"setInput", &TanhActivation::setInput}});
+    } else if (type == "SigmoidActivation") {
+        return connectable(new SigmoidActivation, connect, {{"setInput", &SigmoidActivation::setInput}});
+    } else if (type == "OneMinusActivation") {
+        return connectable(new OneMinusActivation, connect, {{"setInput", &OneMinusActivation::setInput}});
+    } else if (type == "LinearActivation") {
+        return connectable(new LinearActivation, connect, {{"setInput", &LinearActivation::setInput}});
+    } else if (type == "MergeSum") {
+        return connectable<AbstractMergeNode>(new MergeSum, connect, {{"addInput", &AbstractMergeNode::addInput}});
+    } else if (type == "MergeProduct") {
+        return connectable<AbstractMergeNode>(new MergeProduct, connect, {{"addInput", &AbstractMergeNode::addInput}});
+    } else if (type == "GRU") {
+        return connectable(
+            new GRU(parameter(node, "size"), parameter(node, "learning_rate"), parameter(node, "decay")),
+            connect,
+            {{"addInput", &GRU::addInput}, {"addZ", &GRU::addZ}, {"addR", &GRU::addR}}
+        );
+    } else if (type == "FusedGRU") {
+        return connectable(
+            new FusedGRU(parameter(node, "size"), parameter(node, "learning_rate"), parameter(node, "decay")),
+            connect,
+            {{"addInput", &FusedGRU::addInput}, {"addZ", &FusedGRU::addZ}, {"addR", &FusedGRU::addR}}
+        );
+    } else if (type == "LSTM") {
+        return connectable(
+            new LSTM(parameter(node, "size"), parameter(node, "learning_rate"), parameter(node, "decay")),
+            connect,
+            {{"addInput", &LSTM::addInput}, {"addInGate", &LSTM::addInGate}, {"addOutGate", &LSTM::addOutGate}, {"addForgetGate", &LSTM::addForgetGate}}
+        );
+    } else if (type == "FusedLSTM") {
+        return connectable(
+            new FusedLSTM(parameter(node, "size"), parameter(node, "learning_rate"), parameter(node, "decay")),
+            connect,
+            {{"addInput", &FusedLSTM::addInput}, {"addInGate", &FusedLSTM::addInGate}, {"addOutGate", &FusedLSTM::addOutGate}, {"addForgetGate", &FusedLSTM::addForgetGate}}
+        );
+    } else if (type == "CWRNN") {
+        return connectable(
+            new CWRNN(parameter(node, "num_units"), parameter(node, "size"), parameter(node, "learning_rate"), parameter(node, "decay")),
+            connect,
+            {{"addInput", &CWRNN::addInput}}
+        );
+    }
+
+    throw invalidDescription("unknown node type " + type);
+}
+
+/**
+ * @brief Parameters of @p node that change its weights, and whether it is
+ *        recurrent if @p recurrent is true
+ */
+static std::string weightParameters(const DescribedNode &node, bool recurrent)
+{
+    static const char *ignored[] = {"momentum", "frozen", "learning_rate", "decay", "bias_initialized_at_one"};
+
+    std::ostringstream s;
+
+    s << std::setprecision(std::numeric_limits<double>::max_digits10);
+
+    for (const auto &parameter : node.parameters) {
+        // The nodes that are always in full precision do not describe it
+        bool full = (parameter.first == "precision" || parameter.first == "quantized") && parameter.second == 0.0;
+
+        if (std::find(std::begin(ignored), std::end(ignored), parameter.first) == std::end(ignored) &&
+            (recurrent || parameter.first != "recurrent") &&
+            !full) {
+            s << ' ' << parameter.first << '=' << parameter.second;
+        }
+    }
+
+    return s.str();
+}
+
+/**
+ * @brief How structure() describes a node
+ */
+enum StructureKind
+{
+    NoWeights,          /*!< @brief Activation or merge node */
+    Weights,            /*!< @brief Node having weights */
+    ActivatedDense,     /*!< @brief TanhDense or SigmoidDense, a Dense followed by its activation */
+    SummedDenses        /*!< @brief DenseSum, Dense nodes followed by a MergeSum */
+};
+
+static StructureKind structureKind(const std::string &type)
+{
+    static const std::string activation("Activation");
+    static const std::string dense("Dense");
+
+    if (type == "DenseSum") {
+        return SummedDenses;
+    } else if (type.compare(0, 5, "Merge") == 0 ||
+               (type.size() > activation.size() && type.compare(type.size() - activation.size(), activation.size(), activation) == 0)) {
+        return NoWeights;
+    } else if (type.size() > dense.size() && type.compare(type.size() - dense.size(), dense.size(), dense) == 0) {
+        return ActivatedDense;
+    }
+
+    return Weights;
+}
+
+/**
+ * @brief Structure of the network described by @p description, identical
+ *        for the networks that have the same weights
+ *
+ * The structure lists the description of the network, of its nodes having
+ * weights, in the order in which they serialize them, and of the node that
+ * produces the output. Nodes are described by their type, their parameters
+ * that change their weights, and their inputs. An input produced by a node
+ * having weights is the index of its weights, the other inputs are described
+ * like nodes, so that the position of the nodes without weights does not
+ * matter.
+ *
+ * A FusedGRU or FusedLSTM is then a GRU or LSTM, a TanhDense or SigmoidDense
+ * a Dense followed by its activation, and a DenseSum the Dense nodes summed
+ * by a MergeSum. The inputs of a MergeSum are compared in any order, and a
+ * LinearActivation is its input (see Network::optimize()).
+ */
+static std::vector<std::string> structure(const std::string &description)
+{
+    std::istringstream s(description);
+    std::string line;
+    std::vector<DescribedNode> nodes;
+
+    while (std::getline(s, line)) {
+        nodes.push_back(parseNode(line));
+    }
+
+    if (nodes.empty()) {
+        return std::vector<std::string>();
+    }
+
+    std::vector<std::string> rs(1, nodes[0].type + weightParameters(nodes[0], true));
+
+    nodes.erase(nodes.begin());
+
+    std::vector<StructureKind> kinds(nodes.size());
+    std::vector<std::size_t> weights(nodes.size());
+    std::vector<std::string> references(nodes.size());
+    std::vector<bool> visiting(nodes.size(), false);
+    std::size_t count = 0;
+
+    // Index of the first weights of each node
+    for (std::size_t i=0; i<nodes.size(); ++i) {
+        DescribedNode &node = nodes[i];
+
+        if (node.type == "FusedGRU" || node.type == "FusedLSTM") {
+            node.type = node.type.substr(5);
+        }
+
+        kinds[i] = structureKind(node.type);
+        weights[i] = count;
+
+        if (kinds[i] == SummedDenses) {
+            for (const auto &input : node.inputs) {
+                count += (input.first == "setInput");
+            }
+        } else if (kinds[i] != NoWeights) {
+            count += 1;
+        }
+    }
+
+    // Description of the output of a node, read by another node
+    std::function<std::string(int)> reference = [&](int i) -> std::string {
+        if (i < 0) {
+            return "input";
+        } else if (i >= int(nodes.size())) {
+            throw invalidDescription("invalid input");
+        } else if (visiting[i]) {
+            return "loop";
+        } else if (!references[i].empty()) {
+            return references[i];
+        }
+
+        const DescribedNode &node = nodes[i];
+        std::string recurrent = (node.parameters.count("recurrent") != 0 ? " recurrent=1" : "");
+        std::vector<std::string> inputs;
+        std::size_t dense = weights[i];
+        std::string rs;
+
+        visiting[i] = true;
+
+        switch (kinds[i]) {
+        case Weights:
+            rs = 'W' + std::to_string(dense);
+            break;
+
+        case ActivatedDense:
+            rs = node.type.substr(0, node.type.size() - 5) + "Activation" + recurrent + "(setInput=W" + std::to_string(dense) + " )";
+            break;
+
+        case SummedDenses:
+        case NoWeights:
+            if (node.type == "LinearActivation" && recurrent.empty() && node.inputs.size() == 1) {
+                // Identity, that optimize() removes
+                rs = reference(node.inputs[0].second);
+                break;
+            }
+
+            for (const auto &input : node.inputs) {
+                if (kinds[i] == SummedDenses) {
+                    inputs.push_back("addInput=" + (input.first == "setInput" ? 'W' + std::to_string(dense++) : reference(input.second)));
+                } else {
+                    inputs.push_back(input.first + '=' + reference(input.second));
+                }
+            }
+
+            if (kinds[i] == SummedDenses || node.type == "MergeSum") {
+                std::sort(inputs.begin(), inputs.end());
+                rs = "MergeSum" + recurrent + '(';
+            } else {
+                rs = node.type + weightParameters(node, true) + '(';
+            }
+
+            for (const std::string &input : inputs) {
+                rs += input + ' ';
+            }
+
+            rs += ')';
+            break;
+        }
+
+        visiting[i] = false;
+        references[i] = rs;
+
+        return rs;
+    };
+
+    // Nodes having weights, in order. The inputs given by different methods
+    // are compared in the order of the methods (a FusedLSTM does not describe
+    // its gates in the order of a LSTM)
+    for (std::size_t i=0; i<nodes.size(); ++i) {
+        DescribedNode node = nodes[i];
+        std::string inputs;
+
+        std::stable_sort(node.inputs.begin(), node.inputs.end(), [](const std::pair<std::string, int> &a, const std::pair<std::string, int> &b) {
+            return a.first < b.first;
+        });
+
+        for (const auto &input : node.inputs) {
+            std::string described = input.first + '=' + reference(input.second) + ' ';
+
+            if (kinds[i] != SummedDenses) {
+                inputs += described;
+            } else if (input.first == "setInput") {
+                rs.push_back("Dense" + weightParameters(node, false) + '(' + described + ')');
+            }
+        }
+
+        if (kinds[i] == Weights) {
+            rs.push_back(node.type + weightParameters(node, true) + '(' + inputs + ')');
+        } else if (kinds[i] == ActivatedDense) {
+            rs.push_back("Dense" + weightParameters(node, false) + '(' + inputs + ')');
+        }
+    }
+
+    if (!nodes.empty()) {
+        rs.push_back("output " + reference(nodes.size() - 1));
+    }
+
+    return rs;
+}
+
+void Network::deserialize(NetworkSerializer &serializer)
+{
+    const std::string &description = serializer.description();
+
+    // Weights of another network would be read without error if they happen
+    // to have the same shapes
+    if (!description.empty()) {
+        std::string own = topology();
+
+        if (!own.empty() && structure(description) != structure(own)) {
+            throw std::runtime_error("The serializer describes another network");
+        }
+    }
+
+    AbstractRecurrentNetworkNode::deserialize(serializer);
+
+    if (serializer.remaining() != 0) {
+        throw std::runtime_error("The serializer has more weights than the network");
+    }
+}
+
+Network *Network::rebuild(NetworkSerializer &serializer, Float *momentum)
+{
+    std::istringstream s(serializer.description());
+    std::string line;
+    std::vector<DescribedNode> described;
+
+    while (std::getline(s, line)) {
+        described.push_back(parseNode(line));
+    }
+
+    if (described.size() < 2 || described[0].type != "Network") {
+        throw std::runtime_error("The serializer does not describe a network");
+    }
+
+    DescribedNode network = described[0];
+    std::unique_ptr<Network> net(new Network(parameter(network, "inputs")));
+    std::vector<std::unique_ptr<AbstractNode> > nodes(described.size() - 1);
+    std::vector<Connector> connectors(nodes.size());
+
+    if (momentum != nullptr) {
+        *momentum = parameter(network, "momentum");
+    }
+
+    described.erase(described.begin());
+
+    for (std::size_t i=0; i<nodes.size(); ++i) {
+        if (described[i].type != "DenseSum") {
+            nodes[i].reset(buildNode(described[i], connectors[i]));
+        }
+    }
+
+    auto port = [&](int index) -> Port * {
+        if (index == -1) {
+            return net->inputPort();
+        } else if (index < 0 || index >= int(nodes.size()) || !nodes[index]) {
+            throw invalidDescription("invalid input");
+        }
+
+        return nodes[index]->output();
+    };
+
+    // Connect the nodes after their inputs (so that the size of the inputs
+    // is known), or in order when a loop is reached
+    std::vector<bool> connected(nodes.size(), false);
+
+    for (std::size_t count=0; count<nodes.size(); ++count) {
+        std::size_t next = nodes.size();
+
+        for (std::size_t i=0; i<nodes.size() && next == nodes.size(); ++i) {
+            bool ready = !connected[i];
+
+            for (const auto &input : described[i].inputs) {
+                ready &= (input.second < 0 || input.second >= int(nodes.size()) || connected[input.second]);
+            }
+
+            if (ready) {
+                next = i;
+            }
+        }
+
+        if (next == nodes.size()) {
+            next = std::find(connected.begin(), connected.end(), false) - connected.begin();
+        }
+
+        const DescribedNode &node = described[next];
+
+        if (node.type == "DenseSum") {
+            // The Dense nodes are only used to build the DenseSum
+            std::vector<std::unique_ptr<Dense> > denses;
+            std::vector<Dense *> pointers;
+
+            std::vector<Port *> inputs;
+
+            for (const auto &input : node.inputs) {
+                if (input.first == "setInput") {
+                    denses.emplace_back(new Dense(parameter(node, "outputs"), parameter(node, "learning_rate"), parameter(node, "decay")));
+                    denses.back()->setInput(port(input.second));
+                    pointers.push_back(denses.back().get());
+                } else if (input.first == "addInput") {
+                    inputs.push_back(port(input.second));
+                } else {
+                    throw invalidDescription("unknown method " + input.first);
+                }
+            }
+
+            if (pointers.empty()) {
+                throw invalidDescription("DenseSum without Dense nodes");
+            }
+
+            nodes[next].reset(new DenseSum(pointers, inputs));
+        } else {
+            for (const auto &input : node.inputs) {
+                connectors[next](input.first, port(input.second));
+            }
+        }
+
+        connected[next] = true;
+    }
+
+    // The network owns the nodes once they are added
+    for (std::size_t i=0; i<nodes.size(); ++i) {
+        AbstractNode *node = nodes[i].release();
+
+        net->addNode(node);
+
+        if (described[i].parameters.count("recurrent") != 0) {
+            net->addRecurrentNode(node);
+        }
+    }
+
+    if (parameter(network, "frozen") != 0.0) {
+        net->freeze();
+    }
+
+    for (std::size_t i=0; i<nodes.size(); ++i) {
+        const DescribedNode &node = described[i];
+        AbstractNode *n = net->_nodes[i];
+
+        if (node.parameters.count("precision") != 0 && parameter(node, "precision") != 0.0) {
+            n->setPrecision(Precision(int(parameter(node, "precision"))));
+        }
+        if (node.parameters.count("quantized") != 0 && parameter(node, "quantized") != 0.0) {
+            n->quantize();
+        }
+    }
+
+    net->deserialize(serializer);
+
+    return net.release();
+}
+
+void Network::setBatchSize(unsigned int batch_size)
+{
+    // Resize the input port and all the nodes
+    _input_port.value.setZero(_input_port.value.rows(), batch_size);
+    _input_port.error.setZero(_input_port.error.rows(), batch_size);
+
+    AbstractRecurrentNetworkNode::setBatchSize(batch_size);
+
+    // The recurrent storage has been cleared, start again at time step zero
+    reset();
+}
+
 void Network::clearError()
 {
     // Clear the error of all the nodes
@@ -61,51 +883,62 @@ void Network::clearError()
 
 void Network::update()
 {
+    if (isFrozen()) {
+        throw std::logic_error("Network::update() called on a frozen network");
+    }
+
     // Tell all the nodes to update their parameters
     AbstractRecurrentNetworkNode::update();
 
     clearError();
 }
 
-void Network::train(const Eigen::MatrixXf &inputs,
-                    const Eigen::MatrixXf &outputs,
+void Network::train(const Matrix &inputs,
+                    const Matrix &outputs,
                     unsigned int batch_size,
                     unsigned int epochs)
 {
     train(inputs, outputs, nullptr, batch_size, epochs);
 }
 
-void Network::trainSequence(const Eigen::MatrixXf &inputs,
-                            const Eigen::MatrixXf &outputs,
+void Network::trainSequence(const Matrix &inputs,
+                            const Matrix &outputs,
                             unsigned int epochs)
 {
     trainSequence(inputs, outputs, nullptr, epochs);
 }
 
-void Network::train(const Eigen::MatrixXf &inputs,
-                    const Eigen::MatrixXf &outputs,
-                    const Eigen::MatrixXf &weights,
+void Network::train(const Matrix &inputs,
+                    const Matrix &outputs,
+                    const Matrix &weights,
                     unsigned int batch_size,
                     unsigned int epochs)
 {
     train(inputs, outputs, &weights, batch_size, epochs);
 }
 
-void Network::trainSequence(const Eigen::MatrixXf &inputs,
-                            const Eigen::MatrixXf &outputs,
-                            const Eigen::MatrixXf &weights,
+void Network::trainSequence(const Matrix &inputs,
+                            const Matrix &outputs,
+                            const Matrix &weights,
                             unsigned int epochs)
 {
     trainSequence(inputs, outputs, &weights, epochs);
 }
 
-void Network::train(const Eigen::MatrixXf &inputs,
-                    const Eigen::MatrixXf &outputs,
-                    const Eigen::MatrixXf *weights,
+void Network::train(const Matrix &inputs,
+                    const Matrix &outputs,
+                    const Matrix *weights,
                     unsigned int batch_size,
                     unsigned int epochs)
 {
+    if (isFrozen()) {
+        throw std::logic_error("Network::train() called on a frozen network");
+    }
+
     std::vector<int> indexes(inputs.cols());
+    Matrix batch_inputs;
+    Matrix batch_outputs;
+    Matrix batch_weights;
 
     for (int i=0; i<inputs.cols(); ++i) {
         indexes[i] = i;
@@ -120,43 +953,92 @@ void Network::train(const Eigen::MatrixXf &inputs,
         // Shuffle the input vectors to improve non-sequence learning
         std::random_shuffle(indexes.begin(), indexes.end());
 
-        // Perform the training
-        unsigned int batch_remaining = batch_size;
+        // Perform the training, one block of batch_size columns at a time
+        for (int start=0; start < inputs.cols(); start += batch_size) {
+            int count = std::min(int(batch_size), int(inputs.cols()) - start);
+
+            // Gather the samples of the batch (resizing the matrices only
+            // happens for the first and the last batches)
+            batch_inputs.resize(inputs.rows(), count);
+            batch_outputs.resize(outputs.rows(), count);
+
+            for (int i=0; i<count; ++i) {
+                batch_inputs.col(i) = inputs.col(indexes[start + i]);
+                batch_outputs.col(i) = outputs.col(indexes[start + i]);
+            }
 
-        for (int index : indexes) {
-            predict(inputs.col(index), nullptr);
+            predict(batch_inputs, nullptr);
 
             if (weights == nullptr) {
-                setExpectedOutput(outputs.col(index));
+                setExpectedOutput(batch_outputs);
             } else {
-                setExpectedOutput(outputs.col(index), weights->col(index));
-            }
+                batch_weights.resize(weights->rows(), count);
 
-            if (--batch_remaining == 0) {
-                batch_remaining = batch_size;
+                for (int i=0; i<count; ++i) {
+                    batch_weights.col(i) = weights->col(indexes[start + i]);
+                }
 
-                update();
+                setExpectedOutput(batch_outputs, batch_weights);
             }
+
+            // Also after a last batch of less than batch_size samples (see
+            // the documentation of train())
+            update();
         }
     }
 }
 
-void Network::trainSequence(const Eigen::MatrixXf &inputs,
-                            const Eigen::MatrixXf &outputs,
-                            const Eigen::MatrixXf *weights,
+void Network::trainSequence(const Matrix &inputs,
+                            const Matrix &outputs,
+                            const Matrix *weights,
                             unsigned int epochs)
 {
-    Eigen::MatrixXf errors(outputs.rows(), outputs.cols());
+    if (isFrozen()) {
+        throw std::logic_error("Network::trainSequence() called on a frozen network");
+    }
+
+    Matrix errors(outputs.rows(), outputs.cols());
+
+    // Sequences are trained one time step at a time
+    if (_input_port.value.cols() != 1) {
+        setBatchSize(1);
+    }
+
+    // Find the nodes that can be run once for the whole sequence
+    splitSequenceNodes();
 
     // Reset the network before any learning
     reset();
 
+    // With checkpointing, the backward pass processes the sequence by segments
+    // of checkpoint_interval time steps, that are forwarded again from their
+    // checkpoint. Otherwise, the whole sequence is one segment.
+    int length = outputs.cols();
+    int segment_length = std::max(1, int(checkpoint_interval != 0 ? checkpoint_interval : length));
+    int last_segment = ((length - 1) / segment_length) * segment_length;
+
+    // Store as many time steps of a segment as activation_memory allows
+    int stored_steps = std::min<std::size_t>(
+        segment_length,
+        activation_memory / (std::max<std::size_t>(_stored_values.rows(), 1) * sizeof(Float))
+    );
+
+    _stored_values.resize(_stored_values.rows(), stored_steps);
+
     // Epochs
     for (unsigned int epoch=0; epoch < epochs; ++epoch) {
+        // The nodes that don't depend on recurrent state are forwarded for
+        // all the time steps at once
+        forwardHoisted(inputs);
+
         // Forward pass in the network, store the errors in a matrix
-        for (int t=0; t<outputs.cols(); ++t) {
+        for (int t=0; t<length; ++t) {
             setCurrentTimestep(t);
-            predict(inputs.col(t), nullptr);
+            forwardStep(inputs, t);
+
+            if (t >= last_segment && t - last_segment < stored_steps) {
+                storeStep(t - last_segment);
+            }
 
             if (weights == nullptr) {
                 errors.col(t) = outputs.col(t) - output()->value;
@@ -166,21 +1048,239 @@ void Network::trainSequence(const Eigen::MatrixXf &inputs,
         }
 
         // Now that the errors through time are computed, the backward pass can be
-        // performed
-        for (int t=outputs.cols()-1; t>=0; --t) {
-            // Rewind the network to the previous time step, and re-forward
-            // it. This allows the network to recover its internal state from
-            // time t-1, which will allow setError (next loop iteration) to
-            // behave correctly
-            setCurrentTimestep(t);
-            predict(inputs.col(t));
+        // performed, segment by segment
+        for (int end=length; end > 0; ) {
+            int start = ((end - 1) / segment_length) * segment_length;
+
+            if (end != length) {
+                // The recurrent nodes only have the values of the last forwarded
+                // segment. Forward this one again, starting from its checkpoint.
+                for (int t=start; t<end; ++t) {
+                    setCurrentTimestep(t);
+                    forwardStep(inputs, t);
+
+                    if (t - start < stored_steps) {
+                        storeStep(t - start);
+                    }
+                }
+            }
+
+            for (int t=end-1; t>=start; --t) {
+                // Rewind the network to the previous time step, and recover the
+                // values it produced at time t, either from the stored values or by
+                // forwarding it again. This allows setError (next loop iteration)
+                // to behave correctly
+                setCurrentTimestep(t);
 
-            // Set the error at the output of the network and backpropagate it.
-            // Some nodes (GRU, LSTM) will also backpropagate error from t+1 to t.
-            setError(errors.col(t));
+                if (t - start < stored_steps) {
+                    restoreStep(inputs, t, t - start);
+                } else {
+                    forwardStep(inputs, t);
+                }
+
+                // Set the error at the output of the network and backpropagate it.
+                // Some nodes (GRU, LSTM) will also backpropagate error from t+1 to t.
+                backwardStep(errors, t);
+            }
+
+            end = start;
         }
 
+        // Backpropagate the errors of all the time steps through the hoisted
+        // nodes, which accumulates their gradients in one matrix product
+        backwardHoisted(inputs);
+
         update();
         reset();
     }
 }
+
+void Network::splitSequenceNodes()
+{
+    std::vector<Port *> known_ports{&_input_port};      // Ports whose values are known for all the time steps
+    std::vector<Port *> sequential_inputs;              // Ports read by the non-hoisted nodes
+
+    _hoisted_nodes.clear();
+    _sequential_nodes.clear();
+
+    for (AbstractNode *node : _nodes) {
+        std::vector<Port *> inputs = node->inputs();
+
+        std::vector<Port *> ports;
+
+        node->collectPorts(ports);
+
+        // A node can be hoisted if it has no memory, reads only ports known
+        // for the whole sequence, and is not read by a node forwarded before
+        // it (that would read its value at the previous time step). Its only
+        // state must be its output port, whose buffers are swapped with the
+        // ones of all the time steps.
+        bool hoisted = !inputs.empty() &&
+                       ports.size() == 1 &&
+                       !node->isRecurrent() &&
+                       !isRecurrentNode(node) &&
+                       std::find(sequential_inputs.begin(), sequential_inputs.end(), node->output()) == sequential_inputs.end();
+
+        for (Port *input : inputs) {
+            if (std::find(known_ports.begin(), known_ports.end(), input) == known_ports.end()) {
+                hoisted = false;
+            }
+        }
+
+        if (hoisted) {
+            _hoisted_nodes.push_back(node);
+            known_ports.push_back(node->output());
+        } else {
+            _sequential_nodes.push_back(node);
+            sequential_inputs.insert(sequential_inputs.end(), inputs.begin(), inputs.end());
+        }
+    }
+
+    _hoisted_ports.resize(_hoisted_nodes.size());
+
+    // List the ports whose values have to be stored at every time step
+    int rows = 0;
+
+    _sequential_ports.clear();
+
+    for (AbstractNode *node : _sequential_nodes) {
+        node->collectPorts(_sequential_ports);
+    }
+
+    for (Port *port : _sequential_ports) {
+        rows += port->value.rows();
+    }
+
+    _stored_values.resize(rows, _stored_values.cols());
+}
+
+void Network::forwardHoisted(const Matrix &inputs)
+{
+    if (_hoisted_nodes.size() == 0) {
+        return;
+    }
+
+    // Forward all the time steps as if they were a batch of samples. The ports
+    // exchange their buffers with buffers of the size of the sequence, that
+    // are allocated only once.
+    _input_port.value.swap(_sequence_input_port.value);
+    _input_port.value = inputs;
+
+    for (std::size_t i=0; i<_hoisted_nodes.size(); ++i) {
+        AbstractNode *node = _hoisted_nodes[i];
+        Port &port = _hoisted_ports[i];
+
+        port.value.resize(node->output()->value.rows(), inputs.cols());
+        port.error.resize(node->output()->error.rows(), inputs.cols());
+
+        node->output()->value.swap(port.value);
+        node->forward();
+    }
+
+    // Keep the values for the time steps, and let the nodes produce one time
+    // step at a time again
+    for (std::size_t i=0; i<_hoisted_nodes.size(); ++i) {
+        _hoisted_nodes[i]->output()->value.swap(_hoisted_ports[i].value);
+    }
+
+    _input_port.value.swap(_sequence_input_port.value);
+}
+
+void Network::backwardHoisted(const Matrix &inputs)
+{
+    if (_hoisted_nodes.size() == 0) {
+        return;
+    }
+
+    // Put the values and errors of all the time steps back in the nodes
+    _input_port.value.swap(_sequence_input_port.value);
+    _input_port.error.swap(_sequence_input_port.error);
+    _input_port.value = inputs;
+    _input_port.error.setZero(inputs.rows(), inputs.cols());
+
+    for (std::size_t i=0; i<_hoisted_nodes.size(); ++i) {
+        AbstractNode *node = _hoisted_nodes[i];
+        Port &port = _hoisted_ports[i];
+
+        node->output()->value.swap(port.value);
+        node->output()->error.swap(port.error);
+    }
+
+    // Backpropagate through the hoisted nodes, in reverse order
+    for (int i=_hoisted_nodes.size()-1; i>=0; --i) {
+        _hoisted_nodes[i]->backward();
+    }
+
+    // Go back to one time step at a time
+    for (std::size_t i=0; i<_hoisted_nodes.size(); ++i) {
+        AbstractNode *node = _hoisted_nodes[i];
+        Port &port = _hoisted_ports[i];
+
+        node->output()->value.swap(port.value);
+        node->output()->error.swap(port.error);
+    }
+
+    _input_port.value.swap(_sequence_input_port.value);
+    _input_port.error.swap(_sequence_input_port.error);
+}
+
+void Network::forwardStep(const Matrix &inputs, int t)
+{
+    loadStep(inputs, t);
+
+    for (AbstractNode *node : _sequential_nodes) {
+        node->forward();
+    }
+}
+
+void Network::loadStep(const Matrix &inputs, int t)
+{
+    _input_port.value = inputs.col(t);
+
+    // The hoisted nodes have already been forwarded
+    for (std::size_t i=0; i<_hoisted_nodes.size(); ++i) {
+        _hoisted_nodes[i]->output()->value = _hoisted_ports[i].value.col(t);
+    }
+}
+
+void Network::storeStep(int column)
+{
+    int row = 0;
+
+    for (Port *port : _sequential_ports) {
+        _stored_values.block(row, column, port->value.rows(), 1) = port->value;
+        row += port->value.rows();
+    }
+}
+
+void Network::restoreStep(const Matrix &inputs, int t, int column)
+{
+    int row = 0;
+
+    loadStep(inputs, t);
+
+    // Setting the value of every port is equivalent to forwarding the nodes:
+    // forward() only changes output values, and the recurrent storage that
+    // already contains the values of time step t.
+    for (Port *port : _sequential_ports) {
+        port->value = _stored_values.block(row, column, port->value.rows(), 1);
+        row += port->value.rows();
+    }
+}
+
+void Network::backwardStep(const Matrix &errors, int t)
+{
+    output()->error = errors.col(t);
+
+    for (int i=_sequential_nodes.size()-1; i>=0; --i) {
+        _sequential_nodes[i]->backward();
+    }
+
+    backwardRecurrent();
+
+    // Keep the error of the hoisted nodes, they will be backpropagated at the
+    // end of the sequence
+    for (std::size_t i=0; i<_hoisted_nodes.size(); ++i) {
+        _hoisted_ports[i].error.col(t) = _hoisted_nodes[i]->output()->error;
+    }
+}
@@ -25,6 +25,12 @@
 
 #include "abstractrecurrentnetworknode.h"
 
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+class Session;
+
 /**
  * @brief Neural network, made of nodes
  *
@@ -45,6 +51,27 @@
  */
 class Network : public AbstractRecurrentNetworkNode
 {
+    public:
+        /**
+         * @brief Maximum number of bytes that trainSequence() uses to store the
+         *        values produced by the nodes during the forward pass.
+         *
+         * The values of the time steps that fit in this budget are restored
+         * during the backward pass. The other time steps are forwarded again.
+         */
+        static std::size_t activation_memory;
+
+        /**
+         * @brief Difference between the outputs of a network before and
+         *        after its quantization
+         */
+        struct QuantizationReport
+        {
+            unsigned int nodes;         /*!< @brief Number of nodes that have been quantized */
+            Float max_error;            /*!< @brief Largest absolute difference between two outputs */
+            Float mean_squared_error;   /*!< @brief Mean of the squared differences between the outputs */
+        };
+
     public:
         /**
          * @param inputs Number of inputs of this network
@@ -74,15 +101,198 @@ class Network : public AbstractRecurrentNetworkNode
         template<typename Derived>
         Vector predict(const Eigen::MatrixBase<Derived> &input);
 
+        /**
+         * @brief Produce the outputs corresponding to a matrix of inputs
+         *
+         * The inputs are forwarded through the network in one pass, as a
+         * minibatch, and the output of the network is written in @p outputs.
+         * When @p outputs already has the right shape, and the network has
+         * already seen a batch of the same size, no memory is allocated.
+         *
+         * @param inputs Matrix having one column per input vector
+         * @param outputs Matrix that receives one column per output vector
+         *
+         * @note Recurrent networks consider each column as a different sequence,
+         *       all the sequences being at the current time step. When the
+         *       number of columns differs from the one of the previous batch,
+         *       the network is resized by setBatchSize(), that resets it: the
+         *       recurrent state is discarded and the sequences start at time
+         *       step zero.
+         */
+        void predictBatch(const Matrix &inputs, Matrix &outputs);
+
+        /**
+         * @brief Produce the output corresponding to the next input of a stream
+         *
+         * The first call enables the streaming mode and starts a new stream,
+         * every call then moves the stream one time step forward. Only the
+         * values of the recurrent nodes at the previous time step are kept, so
+         * memory usage and latency do not depend on the length of the stream.
+         * No error is kept, the network cannot be trained in streaming mode.
+         *
+         * The stream ends when reset() is called (this also leaves the streaming
+         * mode), or when predict(), train() or trainSequence() are called.
+         *
+         * @param input Matrix having one column per stream, the streams being
+         *              processed in lockstep
+         * @return Output of the network, valid until the next call to step()
+         */
+        template<typename Derived>
+        const Matrix &step(const Eigen::MatrixBase<Derived> &input);
+
+        /**
+         * @brief Produce the outputs corresponding to the next inputs of
+         *        several independent sessions
+         *
+         * The weights of the network are shared by all the sessions, each
+         * session containing only the recurrent state of its stream. The
+         * sessions are forwarded together, as a minibatch, so that every Dense
+         * performs one matrix-matrix product for all of them. Sessions whose
+         * time steps make recurrent nodes behave differently (the units of
+         * CWRNN that are enabled, for instance) are forwarded in separate
+         * minibatches. The network is sized for the largest of them, the
+         * smaller ones using its first columns.
+         *
+         * This method uses the streaming mode, and ends the stream of step().
+         *
+         * @param sessions Sessions to step, each one being moved one time step forward
+         * @param inputs Matrix having one column per session
+         * @param outputs Matrix that receives one column per session
+         *
+         * @throw std::invalid_argument if a session appears more than once in
+         *        @p sessions
+         */
+        void step(const std::vector<Session *> &sessions,
+                  const Matrix &inputs,
+                  Matrix &outputs);
+
         /**
          * @brief Clear the internal memory of the network but preserve its weights
          *
          * This method can be used between input sequences in order to clear the
          * internal memory of recurrent networks. It also resets the time-step to
-         * zero.
+         * zero and leaves the streaming mode.
          */
         void reset();
 
+        /**
+         * @brief Simplify the graph of nodes of the network, without changing
+         *        what it computes
+         *
+         * LinearActivation nodes that only copy the output of a node forwarded
+         * before them are removed, the nodes that read their output reading
+         * their input instead. A MergeSum and the Dense nodes among its inputs
+         * that only it reads, added one after the other, are replaced by one
+         * DenseSum node that computes their sum using one matrix-matrix
+         * product, and adds the other inputs of the MergeSum. Nodes
+         * registered as recurrent and the last node are never changed.
+         *
+         * The sub-nodes of the nodes (the gates of GRU and LSTM for instance)
+         * are simplified in the same way.
+         *
+         * This method is meant to be called once, after all the nodes have
+         * been added and before training or predicting. The nodes that are
+         * removed are deleted, pointers to them become invalid. The weights
+         * are serialized in the same format as before.
+         *
+         * @return Number of nodes before and after the optimization, the
+         *         sub-nodes of the nodes included
+         */
+        std::pair<unsigned int, unsigned int> optimize();
+
+        /**
+         * @brief Release all the memory used only for training
+         *
+         * The errors of all the ports and the gradients and statistics of the
+         * Dense nodes are released. The network can then only be used for
+         * inference: train(), trainSequence(), setError() and update() throw
+         * std::logic_error. Serializing a frozen network produces zeros in
+         * place of the statistics of its Dense nodes.
+         */
+        virtual void freeze();
+
+        /**
+         * @brief Freeze the network and quantize its nodes (see Dense::quantize())
+         *
+         * The nodes that do not support quantization, the recurrent weights of
+         * FusedGRU, FusedLSTM and CWRNN for instance, keep their weights as
+         * they are.
+         */
+        virtual unsigned int quantize();
+
+        /**
+         * @brief Quantize the network, and measure the effect of the
+         *        quantization on its outputs
+         *
+         * @p calibration_inputs are forwarded using predictBatch() before
+         * and after the quantization, and the outputs are compared. The
+         * network is reset before and after each forward pass.
+         *
+         * @param calibration_inputs Matrix having one column per input vector,
+         *        representative of the inputs the network will receive
+         */
+        QuantizationReport quantize(const Matrix &calibration_inputs);
+
+        /**
+         * @brief Set the number of samples processed at once by the network
+         *
+         * Every port of the network then has one column per sample, so that
+         * a whole minibatch is forwarded and backpropagated using matrix-matrix
+         * products. The network is reset by this method. predict() calls it
+         * automatically when it receives an input having a different number
+         * of columns than the previous one.
+         */
+        virtual void setBatchSize(unsigned int batch_size);
+
+        /**
+         * @brief Serialize the weights of the nodes, and the description of
+         *        the network (see topology())
+         */
+        virtual void serialize(NetworkSerializer &serializer);
+
+        /**
+         * @brief Deserialize the weights of the nodes
+         *
+         * If the serializer has a description, it must describe this
+         * network, except for the parameters that do not change the weights
+         * (learning rates, decays, momentum, whether the network is frozen).
+         * Networks that store the same weights in the same order are
+         * equivalent: a FusedGRU or FusedLSTM loads the weights of a GRU or
+         * LSTM, a TanhDense or SigmoidDense those of a Dense followed by a
+         * TanhActivation or SigmoidActivation, and a DenseSum those of Dense
+         * nodes summed by a MergeSum (see optimize()), and conversely.
+         *
+         * @throw std::runtime_error if the serializer describes another
+         *        network, or does not contain exactly the weights of this one
+         */
+        virtual void deserialize(NetworkSerializer &serializer);
+
+        /**
+         * @brief Description of the network, then of its nodes (their type,
+         *        parameters and inputs), one per line
+         *
+         * serialize() stores it in the serializer, so that rebuild() can
+         * build the network from a file alone. It is empty if a node cannot
+         * be described (see AbstractNode::describe()), or reads a port that
+         * is produced inside another node.
+         */
+        std::string topology();
+
+        /**
+         * @brief Build the network described by @p serializer (see
+         *        topology()), and deserialize its weights
+         *
+         * The network is frozen, and its nodes quantized or stored in 16
+         * bits, if they were. Dense::momentum, shared by all the networks,
+         * is not changed: the value it had when the network was serialized
+         * is stored in @p momentum if it is not null.
+         *
+         * @return New network, owned by the caller
+         * @throw std::runtime_error if the serializer has no description, or
+         *        if its weights do not match the description
+         */
+        static Network *rebuild(NetworkSerializer &serializer, Float *momentum = nullptr);
+
         /**
          * @brief Set the expected output of this network and back-propagate the
          *        errors, without performing any gradient update.
@@ -156,15 +366,24 @@ class Network : public AbstractRecurrentNetworkNode
          *
          * @param inputs Matrix having one column per input vector
          * @param outputs Matrix having one column per output vector
-         * @param batch_size Number of vectors handled before a gradient update is performed
+         * @param batch_size Number of vectors handled before a gradient update
+         *                   is performed. The vectors of a batch are forwarded
+         *                   and backpropagated together, as a matrix.
          * @param epochs Number of epochs of training
          *
+         * If the number of vectors is not a multiple of @p batch_size, the
+         * last batch of each epoch is smaller, and an update is performed
+         * after it. Versions of nnetcpp before the minibatches did not
+         * update after these vectors, whose gradient was added to the one of
+         * the first batch of the next epoch, and therefore train slightly
+         * differently in this case.
+         *
          * @note Use trainSequence() if the input data represents a time series.
          *       Only trainSequence() correctly backpropagates errors through time,
          *       resets the network between epochs and keeps sample in-order.
          */
-        void train(const Eigen::MatrixXf &inputs,
-                   const Eigen::MatrixXf &outputs,
+        void train(const Matrix &inputs,
+                   const Matrix &outputs,
                    unsigned int batch_size,
                    unsigned int epochs);
 
@@ -174,21 +393,33 @@ class Network : public AbstractRecurrentNetworkNode
          * @param weights Matrix having one column per weight vector. The weight
          *                vectors are used as described in trainSample().
          */
-        void train(const Eigen::MatrixXf &inputs,
-                   const Eigen::MatrixXf &outputs,
-                   const Eigen::MatrixXf &weights,
+        void train(const Matrix &inputs,
+                   const Matrix &outputs,
+                   const Matrix &weights,
                    unsigned int batch_size,
                    unsigned int epochs);
 
         /**
          * @brief Train the network on a sequence of inputs and outputs
          *
+         * The nodes that only depend on the inputs of the network, and not on
+         * any recurrent state (the Dense nodes projecting the inputs to the
+         * gates of a GRU for instance), are forwarded and backpropagated for
+         * all the time steps at once, using matrix-matrix products. Only the
+         * other nodes are run time step by time step. The values they produce
+         * are stored during the forward pass and restored during the backward
+         * pass, within the limits of activation_memory.
+         *
+         * If AbstractRecurrentNetworkNode::checkpoint_interval is not zero, the
+         * backward pass processes the sequence by segments, each segment being
+         * forwarded again from its checkpoint before being backpropagated.
+         *
          * @param inputs Matrix having one column per input sample
          * @param outputs Matrix having one column per output sample
          * @param epochs Number of epochs of training
          */
-        void trainSequence(const Eigen::MatrixXf &inputs,
-                           const Eigen::MatrixXf &outputs,
+        void trainSequence(const Matrix &inputs,
+                           const Matrix &outputs,
                            unsigned int epochs);
 
         /**
@@ -198,11 +429,14 @@ class Network : public AbstractRecurrentNetworkNode
          * @param weights Matrix having one column per weight vector. The weight
          *                vectors are used as described in trainSample().
          */
-        void trainSequence(const Eigen::MatrixXf &inputs,
-                           const Eigen::MatrixXf &outputs,
-                           const Eigen::MatrixXf &weights,
+        void trainSequence(const Matrix &inputs,
+                           const Matrix &outputs,
+                           const Matrix &weights,
                            unsigned int epochs);
 
+    protected:
+        virtual bool isGraphInput(Port *port);
+
     private:
         template<typename Derived>
         void predict(const Eigen::MatrixBase<Derived> &input, Vector *rs);
@@ -216,18 +450,79 @@ class Network : public AbstractRecurrentNetworkNode
                           const Eigen::MatrixBase<DerivedB> &output,
                           const Eigen::MatrixBase<DerivedC> *weights);
 
-        void train(const Eigen::MatrixXf &inputs,
-                   const Eigen::MatrixXf &outputs,
-                   const Eigen::MatrixXf *weights,
+        void train(const Matrix &inputs,
+                   const Matrix &outputs,
+                   const Matrix *weights,
                    unsigned int batch_size,
                    unsigned int epochs);
-        void trainSequence(const Eigen::MatrixXf &inputs,
-                           const Eigen::MatrixXf &outputs,
-                           const Eigen::MatrixXf *weights,
+        void trainSequence(const Matrix &inputs,
+                           const Matrix &outputs,
+                           const Matrix *weights,
                            unsigned int epochs);
 
+        /**
+         * @brief Split the nodes of the network in nodes that only depend on
+         *        the input of the network (hoisted out of the time loop of
+         *        trainSequence()) and nodes that have to be run at every time step.
+         */
+        void splitSequenceNodes();
+
+        /**
+         * @brief Forward the hoisted nodes for all the time steps of @p inputs
+         */
+        void forwardHoisted(const Matrix &inputs);
+
+        /**
+         * @brief Backpropagate the errors of all the time steps through the
+         *        hoisted nodes, and accumulate their gradients
+         */
+        void backwardHoisted(const Matrix &inputs);
+
+        /**
+         * @brief Forward the time step @p t, the hoisted nodes taking their
+         *        values from what forwardHoisted() has computed.
+         */
+        void forwardStep(const Matrix &inputs, int t);
+
+        /**
+         * @brief Put the input and the values of the hoisted nodes at time
+         *        step @p t in their ports
+         */
+        void loadStep(const Matrix &inputs, int t);
+
+        /**
+         * @brief Store the current values of the non-hoisted nodes in column
+         *        @p column of _stored_values
+         */
+        void storeStep(int column);
+
+        /**
+         * @brief Restore the state of the network at time step @p t, stored
+         *        in column @p column by storeStep(), instead of forwarding it again
+         */
+        void restoreStep(const Matrix &inputs, int t, int column);
+
+        /**
+         * @brief Backpropagate the error of time step @p t through the
+         *        non-hoisted nodes and store the errors of the hoisted ones.
+         */
+        void backwardStep(const Matrix &errors, int t);
+
     private:
         Port _input_port;
+        Port _sequence_input_port;              /*!< @brief Buffers swapped with _input_port when the hoisted nodes process all the time steps */
+        unsigned int _stream_timestep;          /*!< @brief Time step of the next call to step(), modulo the period of the network after the first period */
+
+        std::vector<int> _session_indexes;      /*!< @brief Sessions being stepped, sorted by phase */
+        std::vector<Session *> _sorted_sessions;        /*!< @brief Sessions being stepped, sorted by address to find duplicates */
+        std::vector<Matrix::ColsBlockXpr> _states;      /*!< @brief Recurrent state of the network in streaming mode */
+
+        std::vector<AbstractNode *> _hoisted_nodes;
+        std::vector<AbstractNode *> _sequential_nodes;
+        std::vector<Port> _hoisted_ports;       /*!< @brief Values and errors of the hoisted nodes, one column per time step */
+
+        std::vector<Port *> _sequential_ports;  /*!< @brief Ports produced by the non-hoisted nodes and their sub-nodes */
+        Matrix _stored_values;         /*!< @brief Values of _sequential_ports, one column per stored time step of the current segment */
 };
 
 template<typename Derived>
@@ -245,12 +540,21 @@ void Network::predict(const Eigen::MatrixBase<Derived> &input, Vector *rs)
 {
     assert(input.rows() == _input_port.value.rows());
 
+    if (isStreaming()) {
+        // End the stream, predict() needs the storage of all the time steps
+        reset();
+    }
+
+    if (input.cols() != _input_port.value.cols()) {
+        // The input contains a different number of samples than the previous
+        // one, resize all the ports of the network
+        setBatchSize(input.cols());
+    }
+
     // Put the input in the input port, and propagate it through the network
     _input_port.value = input;
 
-    for (AbstractNode *node : _nodes) {
-        node->forward();
-    }
+    forwardNodes();
 
     if (rs) {
         // Return the output value of the network
@@ -258,10 +562,43 @@ void Network::predict(const Eigen::MatrixBase<Derived> &input, Vector *rs)
     }
 }
 
+template<typename Derived>
+const Matrix &Network::step(const Eigen::MatrixBase<Derived> &input)
+{
+    assert(input.rows() == _input_port.value.rows());
+
+    if (input.cols() != _input_port.value.cols()) {
+        // Different number of streams, resize the network (this resets it)
+        setBatchSize(input.cols());
+    }
+
+    if (!isStreaming()) {
+        // Start a new stream
+        setStreaming(true);
+        _stream_timestep = 0;
+    }
+
+    // After the first period, the time step goes from 2 * period - 1 back to
+    // period instead of growing: it keeps its phase in the period of the
+    // nodes (CWRNN) and never returns to zero, that would clear the recurrent
+    // state, however long the stream is.
+    unsigned int period = this->period();
+    unsigned int timestep = _stream_timestep;
+
+    _stream_timestep = (timestep >= period && timestep - period == period - 1 ? period : timestep + 1);
+    setCurrentTimestep(timestep);
+
+    _input_port.value = input;
+
+    forwardNodes();
+
+    return output()->value;
+}
+
 template<typename Derived>
 Float Network::setExpectedOutput(const Eigen::MatrixBase<Derived> &output)
 {
-    return setExpectedOutput(output, (Eigen::MatrixXf *)0);
+    return setExpectedOutput(output, (Matrix *)0);
 }
 
 template<typename DerivedA, typename DerivedB>
@@ -285,8 +622,13 @@ Float Network::setExpectedOutput(const Eigen::MatrixBase<DerivedA> &output,
 template<typename Derived>
 Float Network::setError(const Eigen::MatrixBase<Derived> &error)
 {
+    if (isFrozen()) {
+        throw std::logic_error("Network::setError() called on a frozen network");
+    }
+
     // Set the error of the last node
     assert(error.rows() == output()->error.rows());
+    assert(error.cols() == output()->error.cols());
 
     output()->error = error;
 
@@ -300,7 +642,7 @@ template<typename DerivedA, typename DerivedB>
 Float Network::trainSample(const Eigen::MatrixBase<DerivedA> &input,
                            const Eigen::MatrixBase<DerivedB> &output)
 {
-    return trainSample(input, output, (Eigen::MatrixXf *)0);
+    return trainSample(input, output, (Matrix *)0);
 }
 
 template<typename DerivedA, typename DerivedB, typename DerivedC>
@@ -23,46 +23,651 @@
 #include "networkserializer.h"
 
 #include <assert.h>
+#include <algorithm>
+#include <cstring>
+#include <cstdint>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/**
+ * @brief Beginning of a file written by NetworkSerializer::save()
+ *
+ * It is followed by a FileTensor per tensor, the description of the network,
+ * then the tensors, each one starting on a multiple of alignment bytes. The
+ * numbers are stored in the byte order of the machine.
+ */
+struct FileHeader
+{
+    char magic[8];              /*!< @brief "NNETCPP" */
+    uint32_t version;
+    uint32_t alignment;         /*!< @brief Alignment of the tensors in the file, in bytes */
+    uint64_t tensors;           /*!< @brief Number of tensors */
+    uint64_t description;       /*!< @brief Size of the description, in bytes */
+    uint32_t mode;              /*!< @brief NetworkSerializer::Mode of the file */
+    uint32_t scalar;            /*!< @brief Size of the values, in bytes: 4 for float, 8 for double */
+};
+
+/**
+ * @brief Position, shape and checksum of a tensor in a file
+ */
+struct FileTensor
+{
+    uint64_t offset;            /*!< @brief Position of the first value in the file, in bytes */
+    uint64_t size;              /*!< @brief Number of values */
+    uint32_t rows;              /*!< @brief Shape of the tensor */
+    uint32_t cols;
+    uint64_t checksum;          /*!< @brief checksum() of the values */
+    uint64_t bytes;             /*!< @brief Number of bytes written by NetworkSerializer::writeBytes(), zero for a tensor of values */
+};
+
+static const char file_magic[8] = "NNETCPP";
+static const uint32_t file_version = 1;
+static const std::size_t file_alignment = 64;
+
+/**
+ * @brief Number of bytes before the first tensor of a file of @p size bytes
+ *        starting with @p header, read by readHeader()
+ *
+ * @throw std::runtime_error if the table of the tensors and the description
+ *        do not fit in the file
+ */
+static std::size_t frontSize(const FileHeader &header, std::size_t size)
+{
+    std::size_t rs = sizeof(FileHeader);
+
+    if (header.tensors > (size - rs) / sizeof(FileTensor) ||
+        header.description > size - rs - header.tensors * sizeof(FileTensor)) {
+        throw std::runtime_error("Truncated network file");
+    }
+
+    return rs + header.tensors * sizeof(FileTensor) + header.description;
+}
+
+/**
+ * @brief Read the header of a file from its first @p size bytes
+ *
+ * @return Whether the file starts with the magic number of the network files
+ * @throw std::runtime_error if the header is truncated or invalid, or the
+ *        version of the file is not supported
+ */
+static bool readHeader(const char *data, std::size_t size, FileHeader &header)
+{
+    if (size < sizeof(file_magic) || std::memcmp(data, file_magic, sizeof(file_magic)) != 0) {
+        return false;
+    }
+
+    if (size < sizeof(FileHeader)) {
+        throw std::runtime_error("Truncated network file");
+    }
+
+    std::memcpy(&header, data, sizeof(FileHeader));
+
+    if (header.version != file_version) {
+        throw std::runtime_error("Unsupported version of the network file");
+    }
+
+    if (header.mode > NetworkSerializer::Export ||
+        (header.scalar != sizeof(float) && header.scalar != sizeof(double))) {
+        throw std::runtime_error("Invalid network file");
+    }
+
+    return true;
+}
+
+/**
+ * @brief Read the table of the tensors and the description from the
+ *        frontSize() first bytes of a file of @p size bytes
+ *
+ * @throw std::runtime_error if the tensors are not in the file one after
+ *        the other
+ */
+static void readFront(const char *front,
+                      std::size_t size,
+                      const FileHeader &header,
+                      std::vector<FileTensor> &table,
+                      std::string &description)
+{
+    std::size_t entry = sizeof(FileTensor);
+    const char *entries = front + sizeof(FileHeader);
+    std::size_t pos = frontSize(header, size);
+
+    table.assign(header.tensors, FileTensor());
+
+    for (std::size_t i=0; i<table.size(); ++i) {
+        FileTensor &tensor = table[i];
+
+        std::memcpy(&tensor, entries + i * entry, entry);
+
+        if (tensor.offset < pos ||
+            tensor.offset % header.scalar != 0 ||
+            tensor.offset > size ||
+            tensor.size > (size - tensor.offset) / header.scalar) {
+            throw std::runtime_error("Truncated network file");
+        }
+
+        if (tensor.bytes > tensor.size * header.scalar) {
+            throw std::runtime_error("Invalid network file");
+        }
+
+        pos = tensor.offset + tensor.size * header.scalar;
+    }
+
+    description.assign(entries + table.size() * entry, header.description);
+}
+
+/**
+ * @brief Add 8 values to the sums of checksum()
+ */
+static inline void accumulate(const uint32_t *values, uint32_t *a, uint32_t *b)
+{
+    for (int j=0; j<8; ++j) {
+        a[j] += values[j];
+        b[j] += a[j];
+    }
+}
+
+/**
+ * @brief Checksum of @p bytes bytes, a multiple of 4, computed on 32-bit words
+ *
+ * Eight Fletcher-like sums (a sum of the words, and a sum of these sums so
+ * that the order of the words matters) are computed on interleaved words,
+ * independently of each other, so that the loop is vectorized.
+ */
+static uint64_t checksum(const void *bytes, std::size_t size)
+{
+    const uint32_t *data = static_cast<const uint32_t *>(bytes);
+
+    uint32_t a[8] = {0};
+    uint32_t b[8] = {0};
+    uint32_t block[8] = {0};
+    std::size_t i = 0;
+
+    size /= sizeof(uint32_t);
+
+    uint64_t rs = size;
+
+    for (; i + 8 <= size; i += 8) {
+        std::memcpy(block, data + i, sizeof(block));
+        accumulate(block, a, b);
+    }
+
+    // Last values, followed by zeros
+    if (i < size) {
+        std::memset(block, 0, sizeof(block));
+        std::memcpy(block, data + i, (size - i) * sizeof(uint32_t));
+        accumulate(block, a, b);
+    }
+
+    for (int j=0; j<8; ++j) {
+        rs = (rs * 0x100000001b3ULL) ^ ((uint64_t(a[j]) << 32) | b[j]);
+    }
+
+    return rs;
+}
+
+/**
+ * @brief Compare the checksum() of @p size bytes with @p expected
+ *
+ * @throw std::runtime_error if they differ
+ */
+static void verifyChecksum(const void *data, std::size_t size, uint64_t expected)
+{
+    if (checksum(data, size) != expected) {
+        throw std::runtime_error("Corrupted network file: the checksum of a tensor differs");
+    }
+}
+
+/**
+ * @brief First multiple of the alignment of the tensors not below @p pos
+ */
+static std::size_t align(std::size_t pos)
+{
+    return (pos + file_alignment - 1) / file_alignment * file_alignment;
+}
+
+/**
+ * @brief File mapped in memory, unmapped when the last serializer or node
+ *        that uses it is destroyed
+ */
+struct NetworkSerializer::Mapping
+{
+    Mapping(void *data, std::size_t size) : data(data), size(size) {}
+    ~Mapping() { munmap(data, size); }
+
+    void *data;
+    std::size_t size;
+};
 
 NetworkSerializer::NetworkSerializer()
-: _pos(0)
+: _mode(Checkpoint),
+  _tensor(0),
+  _pos(0)
+{
+}
+
+void NetworkSerializer::clear()
+{
+    _data.clear();
+    _tensors.clear();
+    _checksums.clear();
+    _description.clear();
+    _tensor = 0;
+    _pos = 0;
+    _mapping.reset();
+}
+
+void NetworkSerializer::setMode(Mode mode)
+{
+    _mode = mode;
+}
+
+NetworkSerializer::Mode NetworkSerializer::mode() const
+{
+    return _mode;
+}
+
+void NetworkSerializer::writeWeight(Float value)
+{
+    *write(1, 1) = value;
+}
+
+Float NetworkSerializer::readWeight()
+{
+    return *readInPlace(1);
+}
+
+void NetworkSerializer::writeBytes(const void *data, std::size_t size)
+{
+    if (size == 0) {
+        return;
+    }
+
+    // Zero padding up to the next weight
+    std::size_t count = (size + sizeof(Float) - 1) / sizeof(Float);
+
+    std::memcpy(write(count, 1), data, size);
+    _tensors.back().bytes = size;
+}
+
+void NetworkSerializer::readBytes(void *data, std::size_t size)
+{
+    if (size == 0) {
+        return;
+    }
+
+    std::memcpy(data, readInPlace((size + sizeof(Float) - 1) / sizeof(Float)), size);
+}
+
+Float *NetworkSerializer::write(std::size_t rows, std::size_t cols)
+{
+    std::size_t offset = _data.size();
+    std::size_t size = rows * cols;
+
+    assert(!_mapping);
+
+    if (size != 0) {
+        _data.resize(offset + size, Float(0));
+        _tensors.push_back(Tensor{offset, size, rows, cols, 0});
+    }
+
+    return _data.data() + offset;
+}
+
+const Float *NetworkSerializer::readInPlace(std::size_t size)
+{
+    return read(size, 0, 0);
+}
+
+const Float *NetworkSerializer::readInPlace(std::size_t rows, std::size_t cols)
 {
+    return read(rows * cols, rows, cols);
 }
 
-void NetworkSerializer::writeWeight(float value)
+std::size_t NetworkSerializer::remaining() const
 {
-    _data.push_back(value);
+    std::size_t rs = 0;
+
+    for (std::size_t i=_tensor; i<_tensors.size(); ++i) {
+        rs += _tensors[i].size;
+    }
+
+    return rs - (_tensor < _tensors.size() ? _pos : 0);
 }
 
-float NetworkSerializer::readWeight()
+const Float *NetworkSerializer::read(std::size_t size, std::size_t rows, std::size_t cols)
 {
-    assert(_pos < _data.size());
+    if (size == 0) {
+        return nullptr;
+    }
+
+    // Move to the next tensor once the current one has been read
+    while (_tensor < _tensors.size() && _pos == _tensors[_tensor].size) {
+        _tensor++;
+        _pos = 0;
+    }
+
+    if (_tensor == _tensors.size() || _pos + size > _tensors[_tensor].size) {
+        throw std::runtime_error("The network has more weights than the serializer");
+    }
+
+    // Tensors of known shape are read at once, with their shape
+    const Tensor &tensor = _tensors[_tensor];
+
+    if (tensor.rows != 0 && (size != tensor.size || (rows != 0 && (rows != tensor.rows || cols != tensor.cols)))) {
+        throw std::runtime_error("The shapes of the weights of the network and of the serializer differ");
+    }
 
-    return _data[_pos++];
+    const Float *rs = values() + tensor.offset + _pos;
+
+    _pos += size;
+    return rs;
+}
+
+const Float *NetworkSerializer::values() const
+{
+    return _mapping ? static_cast<const Float *>(_mapping->data) : _data.data();
+}
+
+void NetworkSerializer::convert(const char *data, std::size_t scalar, std::size_t size, std::size_t rows, std::size_t cols, std::size_t bytes)
+{
+    // Bytes are copied as they are, in as many values of this serializer as
+    // needed
+    std::size_t count = (bytes != 0 ? (bytes + sizeof(Float) - 1) / sizeof(Float) : size);
+
+    if (count == 0) {
+        return;
+    }
+
+    Float *values = write(count, 1);
+    Tensor &tensor = _tensors.back();
+
+    if (bytes != 0) {
+        std::memcpy(values, data, bytes);
+        tensor.bytes = bytes;
+    } else if (scalar == sizeof(float)) {
+        Eigen::Map<Vector>(values, size) = Eigen::Map<const Eigen::VectorXf>((const float *)data, size).cast<Float>();
+    } else {
+        Eigen::Map<Vector>(values, size) = Eigen::Map<const Eigen::VectorXd>((const double *)data, size).cast<Float>();
+    }
+
+    if (bytes == 0) {
+        tensor.rows = rows;
+        tensor.cols = cols;
+    }
+}
+
+void NetworkSerializer::setDescription(const std::string &description)
+{
+    _description = description;
+}
+
+const std::string &NetworkSerializer::description() const
+{
+    return _description;
 }
 
 void NetworkSerializer::save(std::ostream &s)
 {
-    s.write((const char *)_data.data(), _data.size() * sizeof(float));
+    static const char padding[file_alignment] = {0};
+
+    FileHeader header;
+    std::vector<FileTensor> table(_tensors.size());
+    std::size_t pos = sizeof(header) + table.size() * sizeof(FileTensor) + _description.size();
+    std::size_t offset = align(pos);
+
+    std::memcpy(header.magic, file_magic, sizeof(header.magic));
+    header.version = file_version;
+    header.alignment = file_alignment;
+    header.tensors = table.size();
+    header.description = _description.size();
+    header.mode = _mode;
+    header.scalar = sizeof(Float);
+
+    for (std::size_t i=0; i<table.size(); ++i) {
+        const Tensor &tensor = _tensors[i];
+
+        table[i].offset = offset;
+        table[i].size = tensor.size;
+        table[i].rows = tensor.rows;
+        table[i].cols = tensor.cols;
+        table[i].checksum = checksum(values() + tensor.offset, tensor.size * sizeof(Float));
+        table[i].bytes = tensor.bytes;
+
+        offset = align(offset + tensor.size * sizeof(Float));
+    }
+
+    s.write((const char *)&header, sizeof(header));
+    s.write((const char *)table.data(), table.size() * sizeof(FileTensor));
+    s.write(_description.data(), _description.size());
+
+    for (std::size_t i=0; i<table.size(); ++i) {
+        std::size_t size = _tensors[i].size * sizeof(Float);
+
+        s.write(padding, table[i].offset - pos);
+        s.write((const char *)(values() + _tensors[i].offset), size);
+
+        pos = table[i].offset + size;
+    }
 }
 
 void NetworkSerializer::load(std::istream &s)
 {
-    float v;
+    FileHeader header;
+    std::vector<char> front(sizeof(header));
+    std::streampos start = s.tellg();
+
+    // Size of the file, so that it is validated and read at once
+    s.seekg(0, std::ios::end);
 
-    while (!s.eof()) {
-        s.read((char *)&v, sizeof(float));
+    std::size_t size = s.tellg() - start;
 
-        writeWeight(v);
+    s.seekg(start);
+
+    clear();
+    _mode = Checkpoint;
+
+    if (!s) {
+        throw std::runtime_error("Cannot read the network file");
+    }
+
+    s.read(front.data(), std::min(size, front.size()));
+
+    if (s && readHeader(front.data(), size, header)) {
+        std::vector<FileTensor> table;
+        std::size_t pos = frontSize(header, size);
+        std::size_t count = 0;
+
+        // Read the table and the description
+        if (pos > front.size()) {
+            front.resize(pos);
+            s.read(front.data() + sizeof(header), pos - sizeof(header));
+        } else {
+            s.seekg(start + std::streamoff(pos));
+        }
+
+        readFront(front.data(), size, header, table, _description);
+        _mode = Mode(header.mode);
+
+        if (header.scalar == sizeof(Float)) {
+            for (const FileTensor &tensor : table) {
+                count += tensor.size;
+            }
+
+            // Read each tensor after its padding, in memory allocated at once
+            _data.resize(count);
+            count = 0;
+
+            for (const FileTensor &tensor : table) {
+                s.ignore(tensor.offset - pos);
+                s.read((char *)(_data.data() + count), tensor.size * sizeof(Float));
+
+                _tensors.push_back(Tensor{count, tensor.size, tensor.rows, tensor.cols, tensor.bytes});
+                pos = tensor.offset + tensor.size * sizeof(Float);
+                count += tensor.size;
+
+                _checksums.push_back(tensor.checksum);
+            }
+        } else {
+            // Values of another type, converted once their checksum is verified
+            std::vector<char> buffer;
+
+            for (const FileTensor &tensor : table) {
+                buffer.resize(tensor.size * header.scalar);
+
+                s.ignore(tensor.offset - pos);
+                s.read(buffer.data(), buffer.size());
+
+                if (!s) {
+                    break;
+                }
+
+                verifyChecksum(buffer.data(), buffer.size(), tensor.checksum);
+                convert(buffer.data(), header.scalar, tensor.size, tensor.rows, tensor.cols, tensor.bytes);
+                pos = tensor.offset + buffer.size();
+            }
+        }
+
+        if (s) {
+            verify();
+        }
+    } else if (s) {
+        throw std::runtime_error("Not a network file (files of previous versions are read by NetworkSerializer::loadLegacy())");
+    }
+
+    if (!s) {
+        throw std::runtime_error("Cannot read the network file");
+    }
+}
+
+void NetworkSerializer::loadLegacy(std::istream &s)
+{
+    std::streampos start = s.tellg();
+
+    s.seekg(0, std::ios::end);
+
+    std::size_t size = s.tellg() - start;
+
+    s.seekg(start);
+
+    clear();
+    _mode = Checkpoint;
+
+    if (size % sizeof(float) != 0) {
+        throw std::runtime_error("Invalid network file");
+    }
+
+    // The values form one tensor of unknown shape, of floats
+    std::vector<char> buffer(size);
+
+    s.read(buffer.data(), size);
+
+    if (!s) {
+        throw std::runtime_error("Cannot read the network file");
+    }
+
+    convert(buffer.data(), sizeof(float), size / sizeof(float), 0, 0, 0);
+}
+
+void NetworkSerializer::map(const std::string &filename)
+{
+    int fd = open(filename.c_str(), O_RDONLY);
+    struct stat st;
+
+    if (fd == -1 || fstat(fd, &st) != 0) {
+        if (fd != -1) {
+            close(fd);
+        }
+
+        throw std::runtime_error("Cannot open the network file " + filename);
+    }
+
+    // The mapping remains valid once the file is closed
+    std::size_t size = st.st_size;
+    void *data = (size != 0 ? mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0) : MAP_FAILED);
+
+    close(fd);
+
+    if (data == MAP_FAILED) {
+        throw std::runtime_error("Cannot map the network file " + filename);
+    }
+
+    std::shared_ptr<Mapping> mapping = std::make_shared<Mapping>(data, size);
+    FileHeader header;
+    std::vector<FileTensor> table;
+    std::vector<Tensor> tensors;
+    std::vector<uint64_t> checksums;
+    std::string description;
+
+    if (!readHeader(static_cast<const char *>(data), size, header)) {
+        throw std::runtime_error(filename + " is not a network file");
+    }
+
+    readFront(static_cast<const char *>(data), size, header, table, description);
+
+    if (header.scalar != sizeof(Float)) {
+        // Values of another type cannot be read in place, they are converted
+        NetworkSerializer converted;
+
+        for (const FileTensor &tensor : table) {
+            const char *values = static_cast<const char *>(data) + tensor.offset;
+
+            verifyChecksum(values, tensor.size * header.scalar, tensor.checksum);
+            converted.convert(values, header.scalar, tensor.size, tensor.rows, tensor.cols, tensor.bytes);
+        }
+
+        converted._description.swap(description);
+        converted._mode = Mode(header.mode);
+        *this = std::move(converted);
+        return;
+    }
+
+    for (const FileTensor &tensor : table) {
+        tensors.push_back(Tensor{tensor.offset / sizeof(Float), tensor.size, tensor.rows, tensor.cols, tensor.bytes});
+        checksums.push_back(tensor.checksum);
+    }
+
+    _data.clear();
+    _tensors.swap(tensors);
+    _checksums.swap(checksums);
+    _description.swap(description);
+    _mode = Mode(header.mode);
+    _tensor = 0;
+    _pos = 0;
+    _mapping = mapping;
+}
+
+void NetworkSerializer::verify() const
+{
+    for (std::size_t i=0; i<_checksums.size(); ++i) {
+        verifyChecksum(values() + _tensors[i].offset, _tensors[i].size * sizeof(Float), _checksums[i]);
     }
 }
 
-float *NetworkSerializer::data()
+std::shared_ptr<const void> NetworkSerializer::mapping() const
 {
+    return _mapping;
+}
+
+Float *NetworkSerializer::data()
+{
+    assert(!_mapping);
+
     return _data.data();
 }
 
 unsigned int NetworkSerializer::size() const
 {
-    return _data.size();
+    std::size_t rs = _data.size();
+
+    if (_mapping) {
+        for (const Tensor &tensor : _tensors) {
+            rs += tensor.size;
+        }
+    }
+
+    return rs;
 }
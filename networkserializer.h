@@ -26,24 +26,175 @@
 #include <ostream>
 #include <istream>
 #include <vector>
+#include <memory>
+#include <string>
+#include <cstdint>
+
+#include "abstractnode.h"
 
 /**
  * @brief Data store to/from which the weights of a neural network can be stored/retrieved
+ *
+ * The values are stored in the Float type of the library, that the files
+ * record: a file written with another Float type is converted when it is
+ * loaded or mapped.
+ *
+ * Every call that writes values produces a tensor, whose shape is recorded.
+ * It must be read by a single call, with the same shape if it is read by
+ * readTensor() or readInPlace(rows, cols). Only the tensors of files written
+ * by previous versions, whose shape is unknown, can be read by several calls.
+ *
+ * save() writes a header, the offset, shape and checksum of each tensor, the
+ * description of the network (see Network::topology()), then the tensors
+ * aligned on 64 bytes, so that map() can read a file in place.
+ *
+ * The nodes write the statistics of their optimizer (the averages of the
+ * squared gradients used by RMSprop) using writeStatistics(), so that they
+ * are omitted from the files exported for inference (see Mode).
  */
 class NetworkSerializer
 {
     public:
+        /**
+         * @brief What the nodes serialize
+         */
+        enum Mode
+        {
+            Checkpoint,     /*!< @brief Weights and statistics, from which training can be resumed (the default) */
+            Export          /*!< @brief Weights only, half the size, for inference */
+        };
+
         NetworkSerializer();
 
         /**
-         * @brief Write a value to the buffer
+         * @brief Remove the tensors and the description
+         *
+         * The memory of the tensors stays allocated, so that serializing a
+         * network again into this serializer does not allocate it again.
+         */
+        void clear();
+
+        /**
+         * @brief Set what the nodes serialize from now on
+         *
+         * load() and map() set the mode of the file they read.
+         */
+        void setMode(Mode mode);
+
+        /**
+         * @brief What the nodes serialize, or have serialized
+         */
+        Mode mode() const;
+
+        /**
+         * @brief Write a value to the buffer, as a tensor of one value
          */
-        void writeWeight(float value);
+        void writeWeight(Float value);
 
         /**
          * @brief Read a value from the buffer and advance its read pointer
          */
-        float readWeight();
+        Float readWeight();
+
+        /**
+         * @brief Write the coefficients of an Eigen matrix or block, in
+         *        column-major order, as a tensor
+         *
+         * The values are copied at once, without a call per value.
+         */
+        template<typename Derived>
+        void writeTensor(const Eigen::MatrixBase<Derived> &tensor)
+        {
+            Eigen::Map<Matrix>(write(tensor.rows(), tensor.cols()), tensor.rows(), tensor.cols()) = tensor.template cast<Float>();
+        }
+
+        /**
+         * @brief Read into an Eigen matrix or block values written by writeTensor()
+         *
+         * @throw std::runtime_error if the next tensor has another shape
+         */
+        template<typename Derived>
+        void readTensor(const Eigen::MatrixBase<Derived> &tensor)
+        {
+            // Blocks are temporaries, that Eigen lets write through a const reference
+            Eigen::MatrixBase<Derived> &t = const_cast<Eigen::MatrixBase<Derived> &>(tensor);
+
+            t = Eigen::Map<const Matrix>(read(t.size(), t.rows(), t.cols()), t.rows(), t.cols()).template cast<typename Derived::Scalar>();
+        }
+
+        /**
+         * @brief Write statistics of the optimizer, as a tensor, unless the
+         *        mode is Export
+         */
+        template<typename Derived>
+        void writeStatistics(const Eigen::MatrixBase<Derived> &tensor)
+        {
+            if (_mode == Checkpoint) {
+                writeTensor(tensor);
+            }
+        }
+
+        /**
+         * @brief Read statistics written by writeStatistics(), or set them to
+         *        zero if the mode is Export
+         */
+        template<typename Derived>
+        void readStatistics(const Eigen::MatrixBase<Derived> &tensor)
+        {
+            if (_mode == Checkpoint) {
+                readTensor(tensor);
+            } else {
+                const_cast<Eigen::MatrixBase<Derived> &>(tensor).setZero();
+            }
+        }
+
+        /**
+         * @brief Write @p size bytes, packed in as many weights as needed
+         *
+         * This is used for parameters that are not stored as Float values,
+         * the 8-bit weights of a quantized Dense for instance. The bytes are
+         * copied as they are when a file of another Float type is converted.
+         */
+        void writeBytes(const void *data, std::size_t size);
+
+        /**
+         * @brief Read @p size bytes written by writeBytes()
+         */
+        void readBytes(void *data, std::size_t size);
+
+        /**
+         * @brief Pointer to the next @p size values, that are skipped
+         *
+         * The values are not copied. The pointer remains valid as long as
+         * the mapping of a mapped file (see mapping()), and until the next
+         * write otherwise.
+         *
+         * @throw std::runtime_error if there are less than @p size values
+         *        left, or the next tensor has another size
+         */
+        const Float *readInPlace(std::size_t size);
+
+        /**
+         * @brief readInPlace() of a tensor of @p rows x @p cols values
+         *
+         * @throw std::runtime_error if the next tensor has another shape
+         */
+        const Float *readInPlace(std::size_t rows, std::size_t cols);
+
+        /**
+         * @brief Number of values that have not been read yet
+         */
+        std::size_t remaining() const;
+
+        /**
+         * @brief Set the description of the network, saved with the tensors
+         */
+        void setDescription(const std::string &description);
+
+        /**
+         * @brief Description of the network, empty if the file has none
+         */
+        const std::string &description() const;
 
         /**
          * @brief Save the contents of the serializer to a file
@@ -51,14 +202,73 @@ class NetworkSerializer
         void save(std::ostream &s);
 
         /**
-         * @brief Load the contents of the serializer from a file
+         * @brief Load the contents of the serializer from a file written by
+         *        save()
+         *
+         * @p s must be seekable (a file or a string stream): its size is used
+         * to validate and read the file at once.
+         *
+         * The checksums of the tensors are verified (see verify()). The
+         * values of a file written with another Float type are converted.
+         *
+         * @throw std::runtime_error if the file is truncated, invalid or
+         *        corrupted
          */
         void load(std::istream &s);
 
         /**
-         * @brief Pointer to the data currently in the serializer
+         * @brief Load a file written before the files had a header, that is
+         *        only an array of floats
+         *
+         * Nothing in such a file tells which network it contains: the
+         * values, single-precision floats, are read in sequence whatever
+         * their shape. load() does not
+         * accept these files, so that a damaged or unrelated file is not
+         * read as weights.
+         *
+         * @throw std::runtime_error if the size of the file is not a
+         *        multiple of the size of a float
+         */
+        void loadLegacy(std::istream &s);
+
+        /**
+         * @brief Map a file written by save() in memory, instead of loading it
+         *
+         * The pages of the file are read when they are first accessed, and
+         * shared by all the processes that map the file. The serializer can
+         * then only be read.
+         *
+         * A file written with another Float type is converted in memory
+         * instead, after its checksums have been verified, and mapping()
+         * is then nullptr.
+         *
+         * @throw std::runtime_error if the file cannot be mapped or is not
+         *        in the format of save()
          */
-        float *data();
+        void map(const std::string &filename);
+
+        /**
+         * @brief Compare the tensors with the checksums stored in the file
+         *        they come from, if it has checksums
+         *
+         * load() calls it. map() does not, because it would read the whole
+         * file.
+         *
+         * @throw std::runtime_error if a tensor does not match its checksum
+         */
+        void verify() const;
+
+        /**
+         * @brief Memory mapped by map(), that remains mapped as long as a
+         *        copy of this pointer exists, or nullptr
+         */
+        std::shared_ptr<const void> mapping() const;
+
+        /**
+         * @brief Pointer to the data currently in the serializer (not
+         *        available for a mapped file)
+         */
+        Float *data();
 
         /**
          * @brief Number of elements in the serializer
@@ -66,8 +276,50 @@ class NetworkSerializer
         unsigned int size() const;
 
     private:
-        std::vector<float> _data;
-        unsigned int _pos;
+        /**
+         * @brief Add a tensor of @p rows x @p cols values, whose data are
+         *        returned
+         */
+        Float *write(std::size_t rows, std::size_t cols);
+
+        /**
+         * @brief readInPlace() of a tensor of @p rows x @p cols values, or of
+         *        any shape if @p rows is zero
+         */
+        const Float *read(std::size_t size, std::size_t rows, std::size_t cols);
+
+        /**
+         * @brief Beginning of the data, in memory or mapped
+         */
+        const Float *values() const;
+
+        /**
+         * @brief Add a tensor of @p size values of @p scalar bytes, read from
+         *        @p data and converted to Float, or of @p bytes bytes if
+         *        @p bytes is not zero
+         */
+        void convert(const char *data, std::size_t scalar, std::size_t size, std::size_t rows, std::size_t cols, std::size_t bytes);
+
+    private:
+        struct Tensor
+        {
+            std::size_t offset;     /*!< @brief Index of the first value of the tensor in values() */
+            std::size_t size;       /*!< @brief Number of values */
+            std::size_t rows;       /*!< @brief Shape of the tensor, zero if it is unknown */
+            std::size_t cols;
+            std::size_t bytes;      /*!< @brief Number of bytes written by writeBytes(), zero for a tensor of values */
+        };
+
+        struct Mapping;
+
+        std::vector<Float> _data;
+        std::vector<Tensor> _tensors;
+        std::vector<uint64_t> _checksums;       /*!< @brief Checksums of the tensors in the file read, if any */
+        std::string _description;
+        Mode _mode;
+        std::size_t _tensor;                    /*!< @brief Tensor being read */
+        std::size_t _pos;                       /*!< @brief Position in the tensor being read */
+        std::shared_ptr<Mapping> _mapping;
 };
 
 #endif
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2015 Vrije Universiteit Brussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "session.h"
+
+Session::Session()
+: _state(nullptr),
+  _state_size(0),
+  _timestep(0)
+{
+}
+
+void Session::reset()
+{
+    // The state at time step zero is considered as zero by Network::step()
+    _timestep = 0;
+}
+
+std::uint64_t Session::timestep() const
+{
+    return _timestep;
+}
+
+Eigen::Map<Vector> Session::state()
+{
+    return Eigen::Map<Vector>(_state, _state_size);
+}
+
+Float *Session::stateData(int size)
+{
+    if (size != _state_size) {
+        // First step of a session that has its own storage
+        _own_state.resize(size);
+        _state = _own_state.data();
+        _state_size = size;
+    }
+
+    return _state;
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2015 Vrije Universiteit Brussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __SESSION_H__
+#define __SESSION_H__
+
+#include "abstractnode.h"
+
+#include <cstdint>
+
+/**
+ * @brief Recurrent state of one stream processed by a Network
+ *
+ * A Network contains the weights, that can be shared by many independent
+ * streams, each stream having its own Session. Network::step() forwards the
+ * next time step of several sessions at once, loading their recurrent state
+ * in the network before the forward pass and storing it back after it.
+ *
+ * A session does not reference the network it is used with, but its state
+ * has the layout of the recurrent nodes of that network. It must therefore
+ * always be stepped by the same network.
+ */
+class Session
+{
+    public:
+        Session();
+
+        Session(const Session &) = delete;
+        Session &operator=(const Session &) = delete;
+
+        /**
+         * @brief Go back to the beginning of the stream, the recurrent state
+         *        being zero.
+         */
+        void reset();
+
+        /**
+         * @brief Time step of the next input of the stream
+         *
+         * It is a 64-bit counter, so that it does not go back to zero, which
+         * would start a new stream, in the lifetime of a session.
+         */
+        std::uint64_t timestep() const;
+
+        /**
+         * @brief Values of all the recurrent nodes of the network after the
+         *        last time step, concatenated. Empty before the first step.
+         */
+        Eigen::Map<Vector> state();
+
+    private:
+        friend class Network;
+        friend class SessionCache;
+
+        /**
+         * @brief Storage for a state of @p size values, allocated the first
+         *        time it is needed if the session uses its own storage
+         */
+        Float *stateData(int size);
+
+    private:
+        Vector _own_state;      /*!< @brief Storage of the state, unless SessionCache gives an external one */
+        Float *_state;
+        int _state_size;
+        std::uint64_t _timestep;
+};
+
+#endif
@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2015 Vrije Universiteit Brussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "sessioncache.h"
+#include "network.h"
+
+#include <assert.h>
+#include <algorithm>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+SessionCache::SessionCache(Network *network, std::size_t capacity, const std::string &spill_file)
+: _network(network),
+  _state_size(network->stateSize()),
+  _pool(Matrix::Zero(_state_size, capacity)),
+  _sessions(capacity),
+  _spill(nullptr),
+  _spill_records(0),
+  _used_records(0),
+  _hits(0),
+  _misses(0),
+  _evictions(0)
+{
+    // evict() needs a session in memory to make room for another one
+    if (capacity == 0) {
+        throw std::invalid_argument("A SessionCache needs a capacity of at least one session");
+    }
+
+    // The sessions store their state in the columns of the pool
+    for (std::size_t i=0; i<capacity; ++i) {
+        _sessions[i]._state = _pool.col(i).data();
+        _sessions[i]._state_size = _state_size;
+
+        _free_slots.push_back(capacity - i - 1);
+    }
+
+    _spill_fd = open(spill_file.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+
+    if (_spill_fd == -1) {
+        throw std::runtime_error("Cannot create the spill file " + spill_file);
+    }
+}
+
+SessionCache::~SessionCache()
+{
+    if (_spill != nullptr) {
+        munmap(_spill, _spill_records * _state_size * sizeof(Float));
+    }
+
+    close(_spill_fd);
+}
+
+void SessionCache::step(const std::vector<Key> &keys,
+                        const Matrix &inputs,
+                        Matrix &outputs)
+{
+    // Every session is moved to the front of the LRU list when it is acquired,
+    // so the sessions of this step are never evicted by the next ones, as
+    // long as they all fit in memory
+    if (keys.size() > _sessions.size()) {
+        throw std::invalid_argument("SessionCache::step() called with more keys than the capacity of the cache");
+    }
+
+    // A repeated key would step its session twice from the same state, the
+    // second result overwriting the first one
+    _step_keys.assign(keys.begin(), keys.end());
+    std::sort(_step_keys.begin(), _step_keys.end());
+
+    if (std::adjacent_find(_step_keys.begin(), _step_keys.end()) != _step_keys.end()) {
+        throw std::invalid_argument("SessionCache::step() called with a repeated key");
+    }
+
+    _step_sessions.clear();
+
+    for (Key key : keys) {
+        _step_sessions.push_back(&_sessions[acquire(key)]);
+    }
+
+    _network->step(_step_sessions, inputs, outputs);
+}
+
+void SessionCache::remove(Key key)
+{
+    auto it = _entries.find(key);
+
+    if (it == _entries.end()) {
+        return;
+    }
+
+    Entry &entry = it->second;
+
+    if (entry.in_memory) {
+        _lru.erase(entry.lru);
+        _free_slots.push_back(entry.index);
+    } else {
+        _free_records.push_back(entry.index);
+    }
+
+    _entries.erase(it);
+}
+
+std::size_t SessionCache::size() const
+{
+    return _entries.size();
+}
+
+std::size_t SessionCache::hits() const
+{
+    return _hits;
+}
+
+std::size_t SessionCache::misses() const
+{
+    return _misses;
+}
+
+std::size_t SessionCache::evictions() const
+{
+    return _evictions;
+}
+
+std::size_t SessionCache::acquire(Key key)
+{
+    auto it = _entries.find(key);
+
+    if (it != _entries.end() && it->second.in_memory) {
+        // Hit, the session becomes the most recently used one
+        _hits += 1;
+        _lru.splice(_lru.begin(), _lru, it->second.lru);
+
+        return it->second.index;
+    }
+
+    _misses += 1;
+
+    // Find a column of the pool for the session
+    std::size_t slot;
+
+    if (_free_slots.size() != 0) {
+        slot = _free_slots.back();
+        _free_slots.pop_back();
+    } else {
+        slot = evict();
+    }
+
+    Session &session = _sessions[slot];
+
+    if (it == _entries.end()) {
+        // New stream
+        session._timestep = 0;
+        it = _entries.insert(std::make_pair(key, Entry())).first;
+    } else {
+        // Load the session from the spill file
+        _pool.col(slot) = record(it->second.index);
+        session._timestep = it->second.timestep;
+
+        _free_records.push_back(it->second.index);
+    }
+
+    Entry &entry = it->second;
+
+    _lru.push_front(key);
+
+    entry.in_memory = true;
+    entry.index = slot;
+    entry.lru = _lru.begin();
+
+    return slot;
+}
+
+std::size_t SessionCache::evict()
+{
+    assert(_lru.size() != 0);
+
+    Key key = _lru.back();
+    Entry &entry = _entries[key];
+    std::size_t slot = entry.index;
+    std::size_t spilled = allocateRecord();
+
+    // Copy the session to the spill file
+    record(spilled) = _pool.col(slot);
+
+    _lru.pop_back();
+    _evictions += 1;
+
+    entry.in_memory = false;
+    entry.index = spilled;
+    entry.timestep = _sessions[slot]._timestep;
+
+    return slot;
+}
+
+std::size_t SessionCache::allocateRecord()
+{
+    if (_free_records.size() != 0) {
+        std::size_t rs = _free_records.back();
+
+        _free_records.pop_back();
+        return rs;
+    }
+
+    if (_used_records == _spill_records) {
+        // Double the size of the spill file, and map it again
+        std::size_t record_size = _state_size * sizeof(Float);
+        std::size_t records = std::max<std::size_t>(2 * _spill_records, _sessions.size());
+
+        if (_spill != nullptr) {
+            munmap(_spill, _spill_records * record_size);
+            _spill = nullptr;
+        }
+
+        if (ftruncate(_spill_fd, records * record_size) != 0) {
+            throw std::runtime_error("Cannot enlarge the spill file");
+        }
+
+        if (record_size != 0) {
+            void *mapping = mmap(nullptr, records * record_size, PROT_READ | PROT_WRITE, MAP_SHARED, _spill_fd, 0);
+
+            if (mapping == MAP_FAILED) {
+                throw std::runtime_error("Cannot map the spill file");
+            }
+
+            _spill = (Float *)mapping;
+        }
+
+        _spill_records = records;
+    }
+
+    return _used_records++;
+}
+
+Eigen::Map<Vector> SessionCache::record(std::size_t record)
+{
+    return Eigen::Map<Vector>(_spill + record * _state_size, _state_size);
+}
@@ -0,0 +1,167 @@
+/*
+ * Copyright (c) 2015 Vrije Universiteit Brussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __SESSIONCACHE_H__
+#define __SESSIONCACHE_H__
+
+#include "session.h"
+
+#include <list>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+class Network;
+
+/**
+ * @brief Store of the sessions of many streams of a Network
+ *
+ * The recurrent states of the most recently used sessions are kept in memory,
+ * in one matrix having a column per session. When more sessions than the
+ * capacity of the cache are used, the least recently used ones are evicted
+ * to a memory-mapped spill file, and loaded back in memory the next time
+ * they are stepped.
+ *
+ * Sessions are identified by keys chosen by the user of the cache, a new
+ * stream starting the first time a key is seen.
+ */
+class SessionCache
+{
+    public:
+        typedef unsigned long long Key;
+
+        /**
+         * @param network Network whose sessions are stored in this cache
+         * @param capacity Maximum number of sessions kept in memory
+         * @param spill_file Path of the file that receives the evicted
+         *                   sessions. It is created, or truncated if it exists.
+         *
+         * @throw std::invalid_argument if @p capacity is zero
+         * @throw std::runtime_error if the spill file cannot be created
+         */
+        SessionCache(Network *network, std::size_t capacity, const std::string &spill_file);
+        ~SessionCache();
+
+        SessionCache(const SessionCache &) = delete;
+        SessionCache &operator=(const SessionCache &) = delete;
+
+        /**
+         * @brief Move the sessions identified by @p keys one time step forward
+         *
+         * @param keys Distinct keys of the sessions to step, at most as many
+         *             as the capacity of the cache
+         * @param inputs Matrix having one column per session
+         * @param outputs Matrix that receives one column per session
+         *
+         * @throw std::invalid_argument if a key appears twice in @p keys, or
+         *        if there are more keys than the capacity of the cache
+         *
+         * @sa Network::step()
+         */
+        void step(const std::vector<Key> &keys,
+                  const Matrix &inputs,
+                  Matrix &outputs);
+
+        /**
+         * @brief Forget the session identified by @p key. The next time it is
+         *        stepped, a new stream starts.
+         */
+        void remove(Key key);
+
+        /**
+         * @brief Number of sessions, in memory or spilled
+         */
+        std::size_t size() const;
+
+        /**
+         * @brief Number of times a session was found in memory
+         */
+        std::size_t hits() const;
+
+        /**
+         * @brief Number of times a session had to be loaded from the spill
+         *        file or created
+         */
+        std::size_t misses() const;
+
+        /**
+         * @brief Number of sessions spilled to disk
+         */
+        std::size_t evictions() const;
+
+    private:
+        struct Entry
+        {
+            bool in_memory;
+            std::size_t index;                  /*!< @brief Column of _pool, or record of the spill file */
+            std::uint64_t timestep;             /*!< @brief Time step of a spilled session */
+            std::list<Key>::iterator lru;       /*!< @brief Position in _lru of a session in memory */
+        };
+
+        /**
+         * @brief Column of _pool containing the session @p key, loading or
+         *        creating it if needed
+         */
+        std::size_t acquire(Key key);
+
+        /**
+         * @brief Spill the least recently used session, and return the
+         *        column of _pool that it used
+         */
+        std::size_t evict();
+
+        /**
+         * @brief Record of the spill file that can receive a session, the
+         *        file being enlarged if needed
+         */
+        std::size_t allocateRecord();
+
+        /**
+         * @brief Values of record @p record of the spill file
+         */
+        Eigen::Map<Vector> record(std::size_t record);
+
+    private:
+        Network *_network;
+        unsigned int _state_size;
+
+        Matrix _pool;                           /*!< @brief States of the sessions in memory, one column per session */
+        std::vector<Session> _sessions;         /*!< @brief Sessions using the columns of _pool */
+        std::vector<std::size_t> _free_slots;   /*!< @brief Unused columns of _pool */
+        std::vector<Session *> _step_sessions;
+        std::vector<Key> _step_keys;            /*!< @brief Sorted keys of step(), to find repeated ones */
+
+        std::unordered_map<Key, Entry> _entries;
+        std::list<Key> _lru;                    /*!< @brief Sessions in memory, most recently used first */
+
+        int _spill_fd;
+        Float *_spill;                          /*!< @brief Mapping of the spill file */
+        std::size_t _spill_records;             /*!< @brief Number of records that fit in the spill file */
+        std::size_t _used_records;              /*!< @brief Number of records ever used */
+        std::vector<std::size_t> _free_records; /*!< @brief Records that can be reused */
+
+        std::size_t _hits;
+        std::size_t _misses;
+        std::size_t _evictions;
+};
+
+#endif
@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2015 Vrije Universiteit Brussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "stackedweights.h"
+#include "dense.h"
+#include "networkserializer.h"
+
+StackedWeights::StackedWeights(unsigned int blocks, unsigned int size, Float learning_rate, Float decay)
+: _size(size),
+  _learning_rate(learning_rate),
+  _decay(decay),
+  _frozen(false)
+{
+    weights = Matrix::Random(blocks * size, size) * Float(0.01);
+    d_weights = Matrix::Zero(blocks * size, size);
+    _avg_d_weights = Matrix::Zero(blocks * size, size);
+    bias = Vector::Random(blocks * size) * Float(0.01);
+    d_bias = Vector::Zero(blocks * size);
+    _avg_d_bias = Vector::Zero(blocks * size);
+}
+
+void StackedWeights::setBiasToOne(unsigned int block)
+{
+    bias.segment(block * _size, _size).setOnes();
+}
+
+void StackedWeights::serialize(NetworkSerializer &serializer)
+{
+    for (int row=0; row<weights.rows(); row += _size) {
+        // Same layout as Dense::serialize(), zeros replacing the statistics
+        // of a frozen node
+        serializer.writeTensor(weights.middleRows(row, _size));
+
+        if (_frozen) {
+            serializer.writeStatistics(Matrix::Zero(_size, _size));
+        } else {
+            serializer.writeStatistics(_avg_d_weights.middleRows(row, _size));
+        }
+
+        serializer.writeTensor(bias.segment(row, _size));
+
+        if (_frozen) {
+            serializer.writeStatistics(Vector::Zero(_size));
+        } else {
+            serializer.writeStatistics(_avg_d_bias.segment(row, _size));
+        }
+    }
+}
+
+void StackedWeights::deserialize(NetworkSerializer &serializer)
+{
+    Matrix skipped_weights(_size, _size);
+    Vector skipped_bias(_size);
+
+    for (int row=0; row<weights.rows(); row += _size) {
+        // A frozen node skips the statistics
+        serializer.readTensor(weights.middleRows(row, _size));
+        serializer.readStatistics(_frozen ? skipped_weights.middleRows(0, _size) : _avg_d_weights.middleRows(row, _size));
+        serializer.readTensor(bias.segment(row, _size));
+        serializer.readStatistics(_frozen ? skipped_bias.segment(0, _size) : _avg_d_bias.segment(row, _size));
+    }
+}
+
+void StackedWeights::update(unsigned int max_timestep)
+{
+    Float normalization_factor = Float(1) / Float(max_timestep + 1);
+
+    d_weights *= normalization_factor;
+    d_bias *= normalization_factor;
+
+    Dense::rmsprop(weights, d_weights, _avg_d_weights, _learning_rate, _decay);
+    Dense::rmsprop(bias, d_bias, _avg_d_bias, _learning_rate, _decay);
+}
+
+void StackedWeights::clearGradients()
+{
+    d_weights *= Dense::momentum;
+    d_bias *= Dense::momentum;
+}
+
+void StackedWeights::freeze()
+{
+    _frozen = true;
+
+    d_weights.resize(0, 0);
+    _avg_d_weights.resize(0, 0);
+    d_bias.resize(0);
+    _avg_d_bias.resize(0);
+}
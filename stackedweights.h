@@ -0,0 +1,96 @@
+/*
+ * Copyright (c) 2015 Vrije Universiteit Brussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __STACKEDWEIGHTS_H__
+#define __STACKEDWEIGHTS_H__
+
+#include "abstractnode.h"
+
+class NetworkSerializer;
+
+/**
+ * @brief Weights of several square Dense connections from the same input,
+ *        stacked in one matrix so that they are applied by one product
+ *
+ * Block i is made of the rows [i*size, (i+1)*size) of the weights and bias.
+ * The gradients are accumulated, serialized and used to update the weights
+ * exactly as Dense does for each block, so that a fused node can replace
+ * a graph of Dense nodes.
+ */
+class StackedWeights
+{
+    public:
+        /**
+         * @brief @p blocks blocks of @p size x @p size weights, initialized
+         *        like the ones of Dense
+         */
+        StackedWeights(unsigned int blocks, unsigned int size, Float learning_rate, Float decay);
+
+        /**
+         * @brief Initialize the bias of a block to one, like Dense does when
+         *        bias_initialized_at_one is true
+         */
+        void setBiasToOne(unsigned int block);
+
+        /**
+         * @brief Write the blocks in the format of as many Dense nodes
+         */
+        void serialize(NetworkSerializer &serializer);
+
+        /**
+         * @brief Read weights written by serialize()
+         */
+        void deserialize(NetworkSerializer &serializer);
+
+        /**
+         * @brief RMSprop update of the weights, the gradients being normalized
+         *        by the length of the sequence (see Dense::update())
+         */
+        void update(unsigned int max_timestep);
+
+        /**
+         * @brief Multiply the gradients by Dense::momentum
+         */
+        void clearGradients();
+
+        /**
+         * @brief Release the gradients and their statistics
+         */
+        void freeze();
+
+    public:
+        Matrix weights;
+        Matrix d_weights;
+        Vector bias;
+        Vector d_bias;
+
+    private:
+        Matrix _avg_d_weights;
+        Vector _avg_d_bias;
+
+        unsigned int _size;
+        Float _learning_rate;
+        Float _decay;
+        bool _frozen;
+};
+
+#endif
@@ -0,0 +1,700 @@
+/*
+ * Copyright (c) 2015 Vrije Universiteit Brussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "utils.h"
+
+#include <session.h>
+#include <activation.h>
+#include <denseactivation.h>
+#include <threadpool.h>
+#include <checkpointer.h>
+
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <cstdio>
+#include <chrono>
+#include <cmath>
+#include <algorithm>
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+/**
+ * @brief Seconds elapsed since @p start
+ */
+static double elapsed(const std::chrono::steady_clock::time_point &start)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+}
+
+/**
+ * @brief Peak resident memory of this process, in KiB
+ */
+static long peakMemory()
+{
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+
+    return usage.ru_maxrss;
+}
+
+/**
+ * @brief Train a GRU network on a long sequence for several checkpoint intervals
+ *
+ * Each interval is measured in its own process, so that the peak memory
+ * usage of one measurement does not hide the one of the next.
+ */
+static void benchmarkCheckpointing(unsigned int hidden, unsigned int length, unsigned int epochs)
+{
+    std::vector<unsigned int> intervals{0, 2, 4, 8, 16, (unsigned int)std::sqrt(float(length)), 128, 512};
+
+    std::cout << "# GRU, " << hidden << " hidden neurons, sequence of " << length << " time steps" << std::endl;
+    std::cout << "# interval seconds_per_epoch peak_memory_kib" << std::endl;
+
+    for (unsigned int interval : intervals) {
+        pid_t pid = fork();
+
+        if (pid == 0) {
+            Network *network = makeGRU(1, hidden, 1, 1e-3);
+            Matrix inputs = Matrix::Random(1, length);
+            Matrix outputs = Matrix::Random(1, length);
+
+            AbstractRecurrentNetworkNode::checkpoint_interval = interval;
+
+            auto start = std::chrono::steady_clock::now();
+
+            network->trainSequence(inputs, outputs, epochs);
+
+            std::cout << interval << ' ' << elapsed(start) / epochs << ' ' << peakMemory() << std::endl;
+
+            delete network;
+            exit(0);
+        }
+
+        waitpid(pid, nullptr, 0);
+    }
+}
+
+/**
+ * @brief Step a GRU network on a long stream, printing the latency and the
+ *        memory usage as the stream grows
+ */
+static void benchmarkStreaming(unsigned int hidden, unsigned int length)
+{
+    Network *network = makeGRU(1, hidden, 1, 1e-3);
+    Matrix input = Matrix::Random(1, 1);
+
+    std::cout << "# GRU, " << hidden << " hidden neurons, stream of " << length << " time steps" << std::endl;
+    std::cout << "# time_steps microseconds_per_step peak_memory_kib" << std::endl;
+
+    auto start = std::chrono::steady_clock::now();
+    unsigned int last_report = 0;
+    unsigned int next_report = 1000;
+
+    for (unsigned int t=1; t<=length; ++t) {
+        network->step(input);
+
+        // Report after 10^3, 10^4, ... time steps
+        if (t == next_report || t == length) {
+            std::cout << t << ' ' << elapsed(start) * 1e6 / (t - last_report) << ' ' << peakMemory() << std::endl;
+
+            start = std::chrono::steady_clock::now();
+            last_report = t;
+            next_report *= 10;
+        }
+    }
+
+    delete network;
+}
+
+/**
+ * @brief Step many sessions of a GRU network, one session at a time and all
+ *        the sessions at once
+ */
+static void benchmarkSessions(unsigned int hidden, unsigned int num_sessions)
+{
+    const unsigned int rounds = 20;
+
+    Network *network = makeGRU(1, hidden, 1, 1e-3);
+    std::vector<Session> sessions(num_sessions);
+    std::vector<Session *> all_sessions;
+    Matrix inputs = Matrix::Random(1, num_sessions);
+    Matrix outputs;
+
+    for (Session &session : sessions) {
+        all_sessions.push_back(&session);
+    }
+
+    std::cout << "# GRU, " << hidden << " hidden neurons, " << num_sessions << " sessions" << std::endl;
+    std::cout << "# mode microseconds_per_session_step" << std::endl;
+
+    // One session at a time
+    auto start = std::chrono::steady_clock::now();
+
+    for (unsigned int round=0; round<rounds; ++round) {
+        for (unsigned int i=0; i<num_sessions; ++i) {
+            network->step(std::vector<Session *>{all_sessions[i]}, inputs.col(i), outputs);
+        }
+    }
+
+    std::cout << "single " << elapsed(start) * 1e6 / (rounds * num_sessions) << std::endl;
+
+    // All the sessions in one minibatch
+    start = std::chrono::steady_clock::now();
+
+    for (unsigned int round=0; round<rounds; ++round) {
+        network->step(all_sessions, inputs, outputs);
+    }
+
+    std::cout << "batched " << elapsed(start) * 1e6 / (rounds * num_sessions) << std::endl;
+
+    delete network;
+}
+
+/**
+ * @brief Train and stream @p network, then delete it
+ */
+static void benchmarkCell(const char *name, Network *network, unsigned int length, unsigned int epochs)
+{
+    Matrix inputs = Matrix::Random(1, length);
+    Matrix outputs = Matrix::Random(1, length);
+
+    auto start = std::chrono::steady_clock::now();
+
+    network->trainSequence(inputs, outputs, epochs);
+
+    double train = elapsed(start) * 1e6 / (epochs * length);
+
+    start = std::chrono::steady_clock::now();
+
+    for (unsigned int t=0; t<length; ++t) {
+        network->step(inputs.col(t));
+    }
+
+    std::cout << name << ' ' << train << ' ' << elapsed(start) * 1e6 / length << std::endl;
+
+    delete network;
+}
+
+/**
+ * @brief Compare GRU with FusedGRU, and LSTM with FusedLSTM, and time CWRNN
+ */
+static void benchmarkCells(unsigned int hidden, unsigned int length, unsigned int epochs)
+{
+    std::cout << "# " << hidden << " hidden neurons, sequence of " << length << " time steps" << std::endl;
+    std::cout << "# cell microseconds_per_trained_step microseconds_per_streamed_step" << std::endl;
+
+    benchmarkCell("GRU", makeGRU(1, hidden, 1, 1e-3), length, epochs);
+    benchmarkCell("FusedGRU", makeGRU<FusedGRU>(1, hidden, 1, 1e-3), length, epochs);
+    benchmarkCell("LSTM", makeLSTM(1, hidden, 1, 1e-3), length, epochs);
+    benchmarkCell("FusedLSTM", makeLSTM<FusedLSTM>(1, hidden, 1, 1e-3), length, epochs);
+    benchmarkCell("CWRNN", makeCWRNN(4, 1, hidden, 1, 1e-3), length, epochs);
+}
+
+/**
+ * @brief Functors as they were before being vectorized, Eigen calling them
+ *        element by element
+ */
+struct ScalarTanh
+{
+    Float operator()(Float x) const
+    {
+        return 2.0f / (1.0f + std::exp(std::min(std::max(Float(-2) * x, Float(-30)), Float(30)))) - 1.0f;
+    }
+};
+
+struct ScalarSigmoid
+{
+    Float operator()(Float x) const
+    {
+        return 1.0f / (1.0f + std::exp(std::min(std::max(-x, Float(-30)), Float(30))));
+    }
+};
+
+struct ScalarDTanh
+{
+    Float operator()(Float y) const
+    {
+        return 1.0f - y*y;
+    }
+};
+
+struct ScalarDSigmoid
+{
+    Float operator()(Float y) const
+    {
+        return y * (1.0f - y);
+    }
+};
+
+/**
+ * @brief Time the scalar functor @p S, then @p F with each approximation
+ *
+ * @param reference Exact function, used to measure the largest error, or
+ *                  nullptr for the derivatives
+ */
+template<typename S, typename F>
+static void benchmarkFunction(const char *name, const Matrix &x, unsigned int rounds, double (*reference)(double))
+{
+    Matrix y(x.rows(), x.cols());
+
+    std::cout << name;
+
+    // Scalar evaluation
+    auto start = std::chrono::steady_clock::now();
+
+    for (unsigned int round=0; round<rounds; ++round) {
+        y.noalias() = x.unaryExpr(S());
+    }
+
+    std::cout << ' ' << elapsed(start) * 1e9 / (rounds * x.size());
+
+    // Vectorized evaluation, precise then fast
+    for (ActivationFunctions::Approximation approximation : {ActivationFunctions::Precise, ActivationFunctions::Fast}) {
+        ActivationFunctions::approximation = approximation;
+        start = std::chrono::steady_clock::now();
+
+        for (unsigned int round=0; round<rounds; ++round) {
+            y.noalias() = x.unaryExpr(F());
+        }
+
+        std::cout << ' ' << elapsed(start) * 1e9 / (rounds * x.size());
+
+        if (reference != nullptr) {
+            double error = 0.0;
+
+            for (int i=0; i<x.size(); ++i) {
+                error = std::max(error, std::abs(double(y(i)) - reference(x(i))));
+            }
+
+            std::cout << ' ' << error;
+        } else {
+            std::cout << " -";
+        }
+    }
+
+    std::cout << std::endl;
+    ActivationFunctions::approximation = ActivationFunctions::Precise;
+}
+
+static double sigmoid(double x)
+{
+    return 1.0 / (1.0 + std::exp(-x));
+}
+
+/**
+ * @brief Compare the scalar and vectorized activation functions
+ */
+static void benchmarkActivations(unsigned int hidden, unsigned int length)
+{
+    // Values covering the range in which the functions are not saturated
+    Matrix x = Matrix::Random(hidden, 1) * 8.0f;
+    Matrix y = Matrix::Random(hidden, 1);
+
+    std::cout << "# " << hidden << " neurons, " << length << " evaluations" << std::endl;
+    std::cout << "# function scalar_ns precise_ns precise_error fast_ns fast_error" << std::endl;
+
+    benchmarkFunction<ScalarTanh, nnetcppinternal::Tanh>("tanh", x, length, std::tanh);
+    benchmarkFunction<ScalarSigmoid, nnetcppinternal::Sigmoid>("sigmoid", x, length, sigmoid);
+    benchmarkFunction<ScalarDTanh, nnetcppinternal::dTanh>("dtanh", y, length, nullptr);
+    benchmarkFunction<ScalarDSigmoid, nnetcppinternal::dSigmoid>("dsigmoid", y, length, nullptr);
+}
+
+/**
+ * @brief Network of @p hidden inputs and outputs made of a Dense and a
+ *        TanhActivation, or of a TanhDense if @p fused is true
+ */
+static Network *makeTanhLayer(unsigned int hidden, bool fused)
+{
+    Network *network = new Network(hidden);
+
+    if (fused) {
+        TanhDense *dense = new TanhDense(hidden, 1e-3);
+
+        dense->setInput(network->inputPort());
+        network->addNode(dense);
+    } else {
+        Dense *dense = new Dense(hidden, 1e-3);
+        TanhActivation *activation = new TanhActivation;
+
+        dense->setInput(network->inputPort());
+        activation->setInput(dense->output());
+        network->addNode(dense);
+        network->addNode(activation);
+    }
+
+    return network;
+}
+
+/**
+ * @brief Compare a Dense followed by a TanhActivation with a TanhDense
+ */
+static void benchmarkDense(unsigned int hidden, unsigned int length, unsigned int epochs)
+{
+    Matrix inputs = Matrix::Random(hidden, length);
+    Matrix outputs = Matrix::Random(hidden, length);
+
+    std::cout << "# " << hidden << " neurons, " << length << " samples" << std::endl;
+    std::cout << "# layer microseconds_per_trained_sample microseconds_per_predicted_sample" << std::endl;
+
+    for (bool fused : {false, true}) {
+        Network *network = makeTanhLayer(hidden, fused);
+        auto start = std::chrono::steady_clock::now();
+
+        network->train(inputs, outputs, 1, epochs);
+
+        double train = elapsed(start) * 1e6 / (epochs * length);
+
+        start = std::chrono::steady_clock::now();
+
+        for (unsigned int i=0; i<length; ++i) {
+            network->predict(inputs.col(i));
+        }
+
+        std::cout << (fused ? "TanhDense " : "Dense+TanhActivation ") << train << ' ' << elapsed(start) * 1e6 / length << std::endl;
+
+        delete network;
+    }
+}
+
+/**
+ * @brief Compare the predictions of a TanhDense with the ones of its quantized
+ *        version, one sample at a time
+ */
+static void benchmarkQuantize(unsigned int hidden, unsigned int length)
+{
+    Matrix inputs = Matrix::Random(hidden, length);
+
+    std::cout << "# " << hidden << " neurons, " << length << " samples" << std::endl;
+    std::cout << "# weights microseconds_per_predicted_sample max_error" << std::endl;
+
+    for (bool quantized : {false, true}) {
+        Network *network = makeTanhLayer(hidden, true);
+        Float max_error = 0;
+
+        if (quantized) {
+            max_error = network->quantize(inputs).max_error;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+
+        for (unsigned int i=0; i<length; ++i) {
+            network->predict(inputs.col(i));
+        }
+
+        std::cout << (quantized ? "int8 " : "float ") << elapsed(start) * 1e6 / length << ' ' << max_error << std::endl;
+
+        delete network;
+    }
+}
+
+/**
+ * @brief Compare the predictions and checkpoint size of a TanhDense whose
+ *        weights are stored in Float, Half and BFloat16
+ */
+static void benchmarkPrecision(unsigned int hidden, unsigned int length)
+{
+    Matrix inputs = Matrix::Random(hidden, length);
+    Matrix reference;
+
+    std::cout << "# " << hidden << " neurons, " << length << " samples" << std::endl;
+    std::cout << "# weights microseconds_per_predicted_sample max_error serialized_floats" << std::endl;
+
+    for (AbstractNode::Precision precision : {AbstractNode::Full, AbstractNode::Half, AbstractNode::BFloat16}) {
+        // Same weights for all the precisions
+        srand(1);
+
+        Network *network = makeTanhLayer(hidden, true);
+        NetworkSerializer serializer;
+        Matrix outputs(hidden, length);
+
+        network->setPrecision(precision);
+
+        auto start = std::chrono::steady_clock::now();
+
+        for (unsigned int i=0; i<length; ++i) {
+            outputs.col(i) = network->predict(inputs.col(i));
+        }
+
+        double time = elapsed(start);
+
+        if (precision == AbstractNode::Full) {
+            reference = outputs;
+        }
+
+        network->serialize(serializer);
+
+        std::cout << (precision == AbstractNode::Full ? "float " : precision == AbstractNode::Half ? "half " : "bfloat16 ")
+                  << time * 1e6 / length << ' '
+                  << (outputs - reference).cwiseAbs().maxCoeff() << ' '
+                  << serializer.size() << std::endl;
+
+        delete network;
+    }
+}
+
+/**
+ * @brief Network of @p layers TanhDense of @p hidden neurons
+ */
+static Network *makeTanhStack(unsigned int hidden, unsigned int layers)
+{
+    Network *network = new Network(hidden);
+    AbstractNode::Port *port = network->inputPort();
+
+    for (unsigned int i=0; i<layers; ++i) {
+        TanhDense *dense = new TanhDense(hidden, 1e-3);
+
+        dense->setInput(port);
+        network->addNode(dense);
+        port = dense->output();
+    }
+
+    return network;
+}
+
+/**
+ * @brief Save a frozen network to a file, as a checkpoint then as an export
+ *        without statistics, then load it back or map it, and predict one
+ *        sample
+ */
+static void benchmarkLoad(unsigned int hidden, unsigned int layers)
+{
+    const char *filename = "benchmark.nnet";
+    Vector input = Vector::Random(hidden);
+
+    std::cout << "# " << layers << " layers of " << hidden << " neurons" << std::endl;
+    std::cout << "# operation mode milliseconds" << std::endl;
+
+    for (NetworkSerializer::Mode mode : {NetworkSerializer::Checkpoint, NetworkSerializer::Export}) {
+        const char *name = (mode == NetworkSerializer::Checkpoint ? " checkpoint " : " export ");
+        Network *network = makeTanhStack(hidden, layers);
+        NetworkSerializer serializer;
+
+        auto start = std::chrono::steady_clock::now();
+
+        serializer.setMode(mode);
+        network->serialize(serializer);
+
+        {
+            std::ofstream file(filename, std::ios::binary);
+
+            serializer.save(file);
+        }
+
+        std::cout << "save" << name << elapsed(start) * 1e3 << std::endl;
+        delete network;
+
+        for (bool mapped : {false, true}) {
+            Network *network = makeTanhStack(hidden, layers);
+            NetworkSerializer serializer;
+
+            network->freeze();
+            start = std::chrono::steady_clock::now();
+
+            if (mapped) {
+                serializer.map(filename);
+            } else {
+                std::ifstream file(filename, std::ios::binary);
+
+                serializer.load(file);
+            }
+
+            network->deserialize(serializer);
+            network->predict(input);
+
+            std::cout << (mapped ? "map" : "load") << name << elapsed(start) * 1e3 << std::endl;
+            delete network;
+        }
+    }
+
+    std::remove(filename);
+}
+
+/**
+ * @brief Train a stack of TanhDense, saving a checkpoint every 4 samples,
+ *        synchronously or with a Checkpointer, and measure how long training
+ *        waits for each checkpoint
+ */
+static void benchmarkSnapshots(unsigned int hidden, unsigned int layers, unsigned int checkpoints)
+{
+    const char *filename = "benchmark.nnet";
+    Vector input = Vector::Random(hidden);
+    Vector target = Vector::Zero(hidden);
+
+    std::cout << "# " << layers << " layers of " << hidden << " neurons, " << checkpoints << " checkpoints" << std::endl;
+    std::cout << "# writer milliseconds_per_checkpoint total_milliseconds" << std::endl;
+
+    for (bool background : {false, true}) {
+        Network *network = makeTanhStack(hidden, layers);
+        NetworkSerializer serializer;
+        double stalled = 0.0;
+
+        auto start = std::chrono::steady_clock::now();
+
+        {
+            Checkpointer checkpointer(filename, 1);
+
+            for (unsigned int i=0; i<checkpoints; ++i) {
+                for (int j=0; j<4; ++j) {
+                    network->trainSample(input, target);
+                }
+
+                auto save = std::chrono::steady_clock::now();
+
+                if (background) {
+                    checkpointer.save(network);
+                } else {
+                    std::ofstream file(filename, std::ios::binary);
+
+                    serializer.clear();
+                    network->serialize(serializer);
+                    serializer.save(file);
+                }
+
+                stalled += elapsed(save);
+            }
+
+            checkpointer.wait();
+            std::remove(checkpointer.latest().c_str());
+        }
+
+        std::cout << (background ? "background " : "synchronous ")
+                  << stalled * 1e3 / checkpoints << ' '
+                  << elapsed(start) * 1e3 << std::endl;
+
+        delete network;
+    }
+
+    std::remove(filename);
+}
+
+/**
+ * @brief Stream a LSTM network whose input projections have as many inputs
+ *        as hidden neurons, its nodes being forwarded one after the other or
+ *        level by level on a thread pool
+ */
+static void benchmarkThreads(unsigned int hidden, unsigned int length)
+{
+    Matrix input = Matrix::Random(hidden, 1);
+
+    std::cout << "# LSTM, " << hidden << " inputs and hidden neurons, stream of " << length << " time steps" << std::endl;
+    std::cout << "# threads microseconds_per_step" << std::endl;
+
+    for (unsigned int threads : {0, 1, 3}) {
+        ThreadPool pool(threads);
+        Network *network = makeLSTM(hidden, hidden, 1, 1e-3);
+
+        if (threads > 0) {
+            network->setThreadPool(&pool);
+        }
+
+        auto start = std::chrono::steady_clock::now();
+
+        for (unsigned int t=0; t<length; ++t) {
+            network->step(input);
+        }
+
+        std::cout << threads << ' ' << elapsed(start) * 1e6 / length << std::endl;
+
+        delete network;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    unsigned int hidden = 256;
+    unsigned int length = 4000;
+    unsigned int epochs = 2;
+    std::string benchmark;
+
+    // State machine for parsing the arguments
+    enum {
+        Benchmark,
+        HiddenNeurons,
+        Length,
+        Epochs
+    } state = Benchmark;
+
+    for (int i=1; i<argc; ++i) {
+        std::string arg(argv[i]);
+
+        if (arg == "--hidden") {
+            state = HiddenNeurons;
+        } else if (arg == "--length") {
+            state = Length;
+        } else if (arg == "--epochs") {
+            state = Epochs;
+        } else {
+            switch (state) {
+            case Benchmark:
+                benchmark = arg;
+                break;
+
+            case HiddenNeurons:
+                hidden = atoi(argv[i]);
+                break;
+
+            case Length:
+                length = atoi(argv[i]);
+                break;
+
+            case Epochs:
+                epochs = atoi(argv[i]);
+                break;
+            }
+        }
+    }
+
+    if (benchmark == "checkpoint") {
+        benchmarkCheckpointing(hidden, length, epochs);
+    } else if (benchmark == "stream") {
+        benchmarkStreaming(hidden, length);
+    } else if (benchmark == "sessions") {
+        benchmarkSessions(hidden, length);
+    } else if (benchmark == "cells") {
+        benchmarkCells(hidden, length, epochs);
+    } else if (benchmark == "activations") {
+        benchmarkActivations(hidden, length);
+    } else if (benchmark == "dense") {
+        benchmarkDense(hidden, length, epochs);
+    } else if (benchmark == "threads") {
+        benchmarkThreads(hidden, length);
+    } else if (benchmark == "quantize") {
+        benchmarkQuantize(hidden, length);
+    } else if (benchmark == "precision") {
+        benchmarkPrecision(hidden, length);
+    } else if (benchmark == "load") {
+        benchmarkLoad(hidden, length);
+    } else if (benchmark == "snapshots") {
+        benchmarkSnapshots(hidden, length, epochs);
+    } else {
+        std::cerr << "Usage: benchmark checkpoint|stream|sessions|cells|activations|dense|threads|quantize|precision|load|snapshots [--hidden N] [--length T] [--epochs E]" << std::endl;
+        std::cerr << "       (--length is the number of sessions for the sessions benchmark, of evaluations for the activations one, of samples for the dense, quantize and precision ones, and of layers for the load and snapshots ones; --epochs is the number of checkpoints of the snapshots one)" << std::endl;
+        return 1;
+    }
+
+    return 0;
+}
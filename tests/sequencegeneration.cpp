@@ -194,10 +194,9 @@ int main(int argc, char **argv)
     network->reset();
 
     for (std::size_t t=0; t<sequence.size(); ++t) {
-        network->setCurrentTimestep(t);
-
-        // Print the original sequence and the predicted one
-        prediction << sequence[t](0) << ' ' << network->predict(one)(0) << std::endl;
+        // Print the original sequence and the predicted one. Streaming does not
+        // keep the previous time steps in memory
+        prediction << sequence[t](0) << ' ' << network->step(one)(0) << std::endl;
     }
 
     return 0;
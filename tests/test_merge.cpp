@@ -23,8 +23,12 @@
 #include "test_merge.h"
 #include "utils.h"
 
+#include <stdlib.h>
+
 #include <network.h>
+#include <networkserializer.h>
 #include <dense.h>
+#include <activation.h>
 #include <mergesum.h>
 #include <mergeproduct.h>
 
@@ -100,3 +104,170 @@ void TestMerge::testProduct()
 
     delete net;
 }
+
+/**
+ * @brief Network whose input and its tanh go through two Dense nodes that are
+ *        summed, then copied by a LinearActivation to the output Dense node
+ */
+static Network *makeBranches()
+{
+    Network *net = new Network(3);
+    TanhActivation *act = new TanhActivation;
+    Dense *dense1 = new Dense(8, 0.01);
+    Dense *dense2 = new Dense(8, 0.01);
+    MergeSum *sum = new MergeSum;
+    LinearActivation *copy = new LinearActivation;
+    Dense *out = new Dense(2, 0.01);
+
+    act->setInput(net->inputPort());
+    dense1->setInput(net->inputPort());
+    dense2->setInput(act->output());
+    sum->addInput(dense1->output());
+    sum->addInput(dense2->output());
+    copy->setInput(sum->output());
+    out->setInput(copy->output());
+
+    net->addNode(act);
+    net->addNode(dense1);
+    net->addNode(dense2);
+    net->addNode(sum);
+    net->addNode(copy);
+    net->addNode(out);
+
+    return net;
+}
+
+void TestMerge::testOptimize()
+{
+    Network *net = makeBranches();
+    Network *optimized = makeBranches();
+    NetworkSerializer serializer;
+
+    net->serialize(serializer);
+    optimized->deserialize(serializer);
+
+    // The copy is removed, the Dense nodes and MergeSum become one DenseSum
+    std::pair<unsigned int, unsigned int> counts = optimized->optimize();
+
+    CPPUNIT_ASSERT_EQUAL(6u, counts.first);
+    CPPUNIT_ASSERT_EQUAL(3u, counts.second);
+
+    // Same predictions, and same weights after training
+    Matrix inputs = Matrix::Random(3, 40);
+    Matrix outputs = Matrix::Random(2, 40);
+    Matrix predicted(2, 40);
+    Matrix predicted_optimized(2, 40);
+
+    net->predictBatch(inputs, predicted);
+    optimized->predictBatch(inputs, predicted_optimized);
+
+    CPPUNIT_ASSERT_MESSAGE(
+        "An optimized network predicts differently than the original one",
+        (predicted - predicted_optimized).cwiseAbs().maxCoeff() < 1e-6
+    );
+
+    // Network::train() shuffles the samples with rand(), the same order is used
+    srand(3);
+    net->train(inputs, outputs, 4, 10);
+    srand(3);
+    optimized->train(inputs, outputs, 4, 10);
+    net->trainSequence(inputs, outputs, 2);
+    optimized->trainSequence(inputs, outputs, 2);
+
+    NetworkSerializer weights;
+    NetworkSerializer weights_optimized;
+
+    net->serialize(weights);
+    optimized->serialize(weights_optimized);
+
+    Eigen::Map<Vector> a(weights.data(), weights.size());
+    Eigen::Map<Vector> b(weights_optimized.data(), weights_optimized.size());
+
+    CPPUNIT_ASSERT_MESSAGE(
+        "An optimized network is trained differently than the original one",
+        a.size() == b.size() && (a - b).cwiseAbs().maxCoeff() < 1e-5
+    );
+
+    // The files describe a DenseSum instead of Dense nodes and a MergeSum, the
+    // networks are equivalent and load each other's weights
+    CPPUNIT_ASSERT(net->topology() != optimized->topology());
+
+    net->deserialize(weights_optimized);
+    optimized->deserialize(weights);
+
+    // Nothing is left to simplify
+    counts = optimized->optimize();
+
+    CPPUNIT_ASSERT_EQUAL(3u, counts.second);
+
+    delete net;
+    delete optimized;
+}
+
+/**
+ * @brief Check that @p optimized, having the weights of @p net, goes from
+ *        @p before to @p after nodes when optimized, and then predicts and is
+ *        trained like @p net on sequences
+ */
+static void compareOptimizedSequences(Network *net, Network *optimized, unsigned int before, unsigned int after)
+{
+    NetworkSerializer serializer;
+
+    net->serialize(serializer);
+    optimized->deserialize(serializer);
+
+    std::pair<unsigned int, unsigned int> counts = optimized->optimize();
+
+    CPPUNIT_ASSERT_EQUAL(before, counts.first);
+    CPPUNIT_ASSERT_EQUAL(after, counts.second);
+
+    // The description does not change, so that the weights are exchanged with
+    // non-optimized networks
+    CPPUNIT_ASSERT_EQUAL(net->topology(), optimized->topology());
+
+    Matrix inputs = Matrix::Random(2, 20);
+    Matrix outputs = Matrix::Random(1, 20);
+
+    for (int t=0; t<inputs.cols(); ++t) {
+        net->setCurrentTimestep(t);
+        optimized->setCurrentTimestep(t);
+
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(
+            net->predict(inputs.col(t))(0),
+            optimized->predict(inputs.col(t))(0),
+            1e-6
+        );
+    }
+
+    net->trainSequence(inputs, outputs, 2);
+    optimized->trainSequence(inputs, outputs, 2);
+
+    NetworkSerializer weights;
+    NetworkSerializer weights_optimized;
+
+    net->serialize(weights);
+    optimized->serialize(weights_optimized);
+
+    Eigen::Map<Vector> a(weights.data(), weights.size());
+    Eigen::Map<Vector> b(weights_optimized.data(), weights_optimized.size());
+
+    CPPUNIT_ASSERT_MESSAGE(
+        "An optimized network is trained differently than the original one",
+        a.size() == b.size() && (a - b).cwiseAbs().maxCoeff() < 1e-5
+    );
+
+    delete net;
+    delete optimized;
+}
+
+void TestMerge::testOptimizeCells()
+{
+    // The gates of GRU whose recurrent Dense node is only read by them become
+    // DenseSum nodes: 5 nodes and 16 sub-nodes, 3 Dense nodes fused
+    compareOptimizedSequences(makeGRU(2, 8, 1, 1e-2), makeGRU(2, 8, 1, 1e-2), 21, 18);
+
+    // The forget and output gates of LSTM share their recurrent Dense node
+    // (and the one of the output gate is not read), only the input and input
+    // gate are fused: 6 nodes and 18 sub-nodes
+    compareOptimizedSequences(makeLSTM(2, 8, 1, 1e-2), makeLSTM(2, 8, 1, 1e-2), 24, 22);
+}
@@ -31,11 +31,15 @@ class TestMerge : public CppUnit::TestCase
     CPPUNIT_TEST_SUITE(TestMerge);
     CPPUNIT_TEST(testSum);
     CPPUNIT_TEST(testProduct);
+    CPPUNIT_TEST(testOptimize);
+    CPPUNIT_TEST(testOptimizeCells);
     CPPUNIT_TEST_SUITE_END();
 
     protected:
         void testSum();
         void testProduct();
+        void testOptimize();
+        void testOptimizeCells();
 };
 
 #endif
@@ -26,13 +26,15 @@
 #include <network.h>
 #include <dense.h>
 #include <activation.h>
+#include <denseactivation.h>
 
-void TestPerceptron::testLinear()
-{
-    // Try to approximate a linear function
-    std::vector<Vector> input;
-    std::vector<Vector> output;
+#include <stdlib.h>
 
+/**
+ * @brief Samples of a linear function
+ */
+static void linearSamples(std::vector<Vector> &input, std::vector<Vector> &output)
+{
     input.push_back(makeVector({-1.0}));
     input.push_back(makeVector({-0.6}));
     input.push_back(makeVector({-0.2}));
@@ -46,10 +48,23 @@ void TestPerceptron::testLinear()
     output.push_back(makeVector({5.0}));
     output.push_back(makeVector({6.0}));
     output.push_back(makeVector({7.0}));
+}
 
+void TestPerceptron::testLinear()
+{
+    // Try to approximate a linear function
+    std::vector<Vector> input;
+    std::vector<Vector> output;
+
+    linearSamples(input, output);
+
+    Network *net;
+    Dense *dense1;
+
+#ifndef NNETCPP_DOUBLE
     // Network with a single Dense layer
-    Network *net = new Network(1);
-    Dense *dense1 = new Dense(1, 0.05);
+    net = new Network(1);
+    dense1 = new Dense(1, 0.05);
 
     dense1->setInput(net->inputPort());
     net->addNode(dense1);
@@ -60,6 +75,7 @@ void TestPerceptron::testLinear()
     );
 
     delete net;
+#endif
 
     // Network a an hidden layer of 10 neurons
     Dense *dense2;
@@ -82,6 +98,30 @@ void TestPerceptron::testLinear()
     delete net;
 }
 
+void TestPerceptron::testLinearSmallSteps()
+{
+    // With a learning rate of 0.05, RMSprop makes the weights oscillate around
+    // the solution, to an MSE that depends on rounding. With double values, it
+    // stays above the target of testLinear, that this test replaces
+    std::vector<Vector> input;
+    std::vector<Vector> output;
+
+    linearSamples(input, output);
+
+    Network *net = new Network(1);
+    Dense *dense = new Dense(1, 0.01);
+
+    dense->setInput(net->inputPort());
+    net->addNode(dense);
+
+    CPPUNIT_ASSERT_MESSAGE(
+        "Learning a linear function using no hidden layer and small steps",
+        checkLearning(net, input, output, 0.002, 100)
+    );
+
+    delete net;
+}
+
 void TestPerceptron::testTanh()
 {
     testActivation<TanhActivation>();
@@ -92,6 +132,357 @@ void TestPerceptron::testSigmoid()
     testActivation<SigmoidActivation>();
 }
 
+void TestPerceptron::testMinibatch()
+{
+    // Approximate a linear function, the samples being forwarded and
+    // backpropagated 4 at a time
+    Matrix inputs(1, 10);
+    Matrix outputs(1, 10);
+
+    for (int i=0; i<10; ++i) {
+        float x = float(i) / 5.0f - 1.0f;
+
+        inputs(0, i) = x;
+        outputs(0, i) = 2.5f * x + 4.0f;
+    }
+
+    Network *net = new Network(1);
+    Dense *dense1 = new Dense(10, 0.01);
+    Dense *dense2 = new Dense(1, 0.01);
+
+    dense1->setInput(net->inputPort());
+    dense2->setInput(dense1->output());
+
+    net->addNode(dense1);
+    net->addNode(dense2);
+
+    net->train(inputs, outputs, 4, 500);
+
+    // Single-sample predictions must have learned the function
+    Float mse = 0.0f;
+
+    for (int i=0; i<10; ++i) {
+        mse += (net->predict(inputs.col(i)) - outputs.col(i)).array().square().mean();
+    }
+
+    CPPUNIT_ASSERT_MESSAGE(
+        "Learning a linear function using minibatches of 4 samples",
+        mse / 10.0f < 0.002
+    );
+
+    delete net;
+}
+
+void TestPerceptron::testPredictBatch()
+{
+    // Network with an hidden layer, whose random weights are not trained
+    Network *net = new Network(3);
+    Dense *dense1 = new Dense(20, 0.01);
+    TanhActivation *act1 = new TanhActivation;
+    Dense *dense2 = new Dense(2, 0.01);
+
+    dense1->setInput(net->inputPort());
+    act1->setInput(dense1->output());
+    dense2->setInput(act1->output());
+
+    net->addNode(dense1);
+    net->addNode(act1);
+    net->addNode(dense2);
+
+    // Predicting a batch must give the same results as predicting the samples
+    // one by one
+    Matrix inputs = Matrix::Random(3, 50);
+    Matrix outputs(2, 50);
+
+    net->predictBatch(inputs, outputs);
+
+    for (int i=0; i<inputs.cols(); ++i) {
+        Vector output = net->predict(inputs.col(i));
+
+        CPPUNIT_ASSERT_MESSAGE(
+            "A batched prediction differs from a single-sample prediction",
+            (output - outputs.col(i)).cwiseAbs().maxCoeff() < 1e-6
+        );
+    }
+
+    delete net;
+}
+
+void TestPerceptron::testActivationFunctions()
+{
+    // 1001 values, so that the last ones are computed without packets
+    Matrix x = Matrix::Random(1001, 1) * 10.0f;
+    Matrix tanh;
+    Matrix sigmoid;
+    Matrix precise_tanh;
+
+    for (ActivationFunctions::Approximation approximation : {ActivationFunctions::Precise, ActivationFunctions::Fast}) {
+        ActivationFunctions::approximation = approximation;
+
+        tanh = x.unaryExpr(nnetcppinternal::Tanh());
+        sigmoid = x.unaryExpr(nnetcppinternal::Sigmoid());
+
+        if (approximation == ActivationFunctions::Precise) {
+            precise_tanh = tanh;
+        }
+
+        for (int i=0; i<x.size(); ++i) {
+            CPPUNIT_ASSERT_MESSAGE(
+                "Vectorized tanh far from std::tanh",
+                std::abs(tanh(i) - std::tanh(double(x(i)))) < 5e-7
+            );
+            CPPUNIT_ASSERT_MESSAGE(
+                "Vectorized sigmoid far from the logistic function",
+                std::abs(sigmoid(i) - 1.0 / (1.0 + std::exp(-double(x(i))))) < 5e-7
+            );
+            CPPUNIT_ASSERT_MESSAGE(
+                "Vectorized and scalar tanh differ",
+                std::abs(tanh(i) - nnetcppinternal::Tanh()(x(i))) < 1e-6
+            );
+        }
+    }
+
+    // The approximation, accurate to a float, is not used for doubles
+    bool float_scalar = std::is_same<Float, float>::value;
+
+    CPPUNIT_ASSERT_EQUAL(float_scalar, ActivationFunctions::fast());
+    CPPUNIT_ASSERT(float_scalar || tanh == precise_tanh);
+
+    // The approximation used by the activation nodes can be changed at any time
+    ActivationFunctions::approximation = ActivationFunctions::Fast;
+    testActivation<TanhActivation>();
+    ActivationFunctions::approximation = ActivationFunctions::Precise;
+}
+
+void TestPerceptron::testDenseActivation()
+{
+    compareDenseActivation<TanhDense, TanhActivation>();
+    compareDenseActivation<SigmoidDense, SigmoidActivation>();
+}
+
+/**
+ * @brief Network with a hidden TanhDense layer, whose weights are between -1
+ *        and 1 instead of being close to zero
+ */
+static Network *makeQuantizable(NetworkSerializer &weights)
+{
+    Network *net = new Network(8);
+    TanhDense *dense1 = new TanhDense(32, 0.01);
+    Dense *dense2 = new Dense(4, 0.01);
+
+    dense1->setInput(net->inputPort());
+    dense2->setInput(dense1->output());
+
+    net->addNode(dense1);
+    net->addNode(dense2);
+
+    if (weights.size() == 0) {
+        net->serialize(weights);
+        Eigen::Map<Vector>(weights.data(), weights.size()).setRandom();
+    }
+
+    NetworkSerializer copy = weights;
+
+    net->deserialize(copy);
+
+    return net;
+}
+
+void TestPerceptron::testQuantize()
+{
+    NetworkSerializer weights;
+    Network *net = makeQuantizable(weights);
+    Network *reference = makeQuantizable(weights);
+    Matrix inputs = Matrix::Random(8, 100);
+    Matrix outputs;
+    Matrix reference_outputs;
+
+    reference->predictBatch(inputs, reference_outputs);
+
+    // The quantization changes the outputs by about 1% of their range
+    Network::QuantizationReport report = net->quantize(inputs);
+    Float range = reference_outputs.cwiseAbs().maxCoeff();
+
+    net->predictBatch(inputs, outputs);
+
+    CPPUNIT_ASSERT_EQUAL(2u, report.nodes);
+    CPPUNIT_ASSERT_DOUBLES_EQUAL((outputs - reference_outputs).cwiseAbs().maxCoeff(), report.max_error, 1e-6);
+    CPPUNIT_ASSERT_MESSAGE(
+        "A quantized network predicts too differently than the original one",
+        report.max_error > 0 && report.max_error < 0.02 * range
+    );
+
+    // A quantized network cannot be trained
+    CPPUNIT_ASSERT_THROW(net->setError(outputs.col(0)), std::logic_error);
+
+    // The 8-bit weights are serialized, in less than 1/4 of the space used
+    // by the weights and statistics of the original network
+    NetworkSerializer quantized;
+
+    net->serialize(quantized);
+    reference->quantize();
+    reference->deserialize(quantized);
+    reference->predictBatch(inputs, reference_outputs);
+
+    CPPUNIT_ASSERT(quantized.size() < weights.size() / 4);
+    CPPUNIT_ASSERT(outputs == reference_outputs);
+
+    delete net;
+    delete reference;
+}
+
+void TestPerceptron::testHalfPrecision()
+{
+    NetworkSerializer weights;
+    Network *reference = makeQuantizable(weights);
+    Matrix inputs = Matrix::Random(8, 100);
+    Matrix outputs;
+    Matrix reference_outputs;
+    Matrix copy_outputs;
+
+    reference->predictBatch(inputs, reference_outputs);
+
+    Float range = reference_outputs.cwiseAbs().maxCoeff();
+
+    for (AbstractNode::Precision precision : {AbstractNode::Half, AbstractNode::BFloat16}) {
+        // The 16-bit weights change the outputs by less than 1% of their range
+        Network *net = makeQuantizable(weights);
+
+        CPPUNIT_ASSERT_EQUAL(2u, net->setPrecision(precision));
+
+        net->predictBatch(inputs, outputs);
+
+        Float error = (outputs - reference_outputs).cwiseAbs().maxCoeff();
+
+        CPPUNIT_ASSERT_MESSAGE(
+            "A network with 16-bit weights predicts too differently than the original one",
+            error > 0 && error < 0.01 * range
+        );
+
+        // The weights and their statistics are serialized in 16 bits, and
+        // predict the same outputs once deserialized
+        NetworkSerializer half;
+        Network *copy = makeQuantizable(weights);
+
+        net->serialize(half);
+        copy->setPrecision(precision);
+        copy->freeze();
+        copy->deserialize(half);
+        copy->predictBatch(inputs, copy_outputs);
+
+        CPPUNIT_ASSERT(half.size() < weights.size() * 6 / 10);
+        CPPUNIT_ASSERT(outputs == copy_outputs);
+
+        // Back to Float, with the rounded weights
+        copy->setPrecision(AbstractNode::Full);
+        copy->predictBatch(inputs, copy_outputs);
+
+        CPPUNIT_ASSERT((outputs - copy_outputs).cwiseAbs().maxCoeff() < 1e-5 * range);
+
+        delete net;
+        delete copy;
+    }
+
+    delete reference;
+
+    // Training keeps a Float copy of the weights, so that the small updates
+    // are not lost by the rounding
+    std::vector<Vector> input;
+    std::vector<Vector> output;
+
+    for (int i=0; i<6; ++i) {
+        Float x = Float(-1.0 + 0.4 * i);
+
+        input.push_back(makeVector({x}));
+        output.push_back(makeVector({Float(4.5 + 2.5 * x)}));
+    }
+
+    Network *net = new Network(1);
+    Dense *dense = new Dense(1, 0.05);
+
+    dense->setInput(net->inputPort());
+    net->addNode(dense);
+    net->setPrecision(AbstractNode::Half);
+
+    CPPUNIT_ASSERT_MESSAGE(
+        "Learning a linear function with 16-bit weights",
+        checkLearning(net, input, output, 0.002, 100)
+    );
+
+    delete net;
+}
+
+template<typename Fused, typename Act>
+void TestPerceptron::compareDenseActivation()
+{
+    // Dense and activation
+    Network *composed = new Network(3);
+    Dense *dense1 = new Dense(20, 0.01);
+    Act *act1 = new Act;
+    Dense *dense2 = new Dense(2, 0.01);
+
+    dense1->setInput(composed->inputPort());
+    act1->setInput(dense1->output());
+    dense2->setInput(act1->output());
+
+    composed->addNode(dense1);
+    composed->addNode(act1);
+    composed->addNode(dense2);
+
+    // Fused node, with the weights of the composed network
+    Network *fused = new Network(3);
+    Fused *fused1 = new Fused(20, 0.01);
+
+    dense2 = new Dense(2, 0.01);
+    fused1->setInput(fused->inputPort());
+    dense2->setInput(fused1->output());
+
+    fused->addNode(fused1);
+    fused->addNode(dense2);
+
+    NetworkSerializer serializer;
+
+    composed->serialize(serializer);
+    fused->deserialize(serializer);
+
+    // Same predictions, and same weights after training
+    Matrix inputs = Matrix::Random(3, 40);
+    Matrix outputs = Matrix::Random(2, 40);
+    Matrix predicted_composed(2, 40);
+    Matrix predicted_fused(2, 40);
+
+    composed->predictBatch(inputs, predicted_composed);
+    fused->predictBatch(inputs, predicted_fused);
+
+    CPPUNIT_ASSERT_MESSAGE(
+        "A fused Dense and activation predicts differently than the Dense and activation nodes",
+        (predicted_composed - predicted_fused).cwiseAbs().maxCoeff() < 1e-6
+    );
+
+    // Network::train() shuffles the samples with rand(), the same order is used
+    srand(2);
+    composed->train(inputs, outputs, 4, 10);
+    srand(2);
+    fused->train(inputs, outputs, 4, 10);
+
+    NetworkSerializer weights_composed;
+    NetworkSerializer weights_fused;
+
+    composed->serialize(weights_composed);
+    fused->serialize(weights_fused);
+
+    Eigen::Map<Vector> a(weights_composed.data(), weights_composed.size());
+    Eigen::Map<Vector> b(weights_fused.data(), weights_fused.size());
+
+    CPPUNIT_ASSERT_MESSAGE(
+        "A fused Dense and activation is trained differently than the Dense and activation nodes",
+        a.size() == b.size() && (a - b).cwiseAbs().maxCoeff() < 1e-5
+    );
+
+    delete composed;
+    delete fused;
+}
+
 template<typename T>
 void TestPerceptron::testActivation()
 {
@@ -106,9 +497,12 @@ void TestPerceptron::testActivation()
         output.push_back(makeVector({std::cos(x)}));
     }
 
-    // Network with a single hidden layer (with tanh activation), N hidden neurons
+    // Network with a single hidden layer (with tanh activation), N hidden neurons.
+    // Its random weights don't depend on the tests run before this one.
     static const unsigned int N = 20;
 
+    srand(1);
+
     Network *net = new Network(1);
     Dense *dense1 = new Dense(N, 3e-3);
     T *act1 = new T;
@@ -30,17 +30,38 @@ class TestPerceptron : public CppUnit::TestCase
 {
     CPPUNIT_TEST_SUITE(TestPerceptron);
     CPPUNIT_TEST(testLinear);
+    CPPUNIT_TEST(testLinearSmallSteps);
     CPPUNIT_TEST(testTanh);
     CPPUNIT_TEST(testSigmoid);
+    CPPUNIT_TEST(testMinibatch);
+    CPPUNIT_TEST(testPredictBatch);
+    CPPUNIT_TEST(testActivationFunctions);
+    CPPUNIT_TEST(testDenseActivation);
+    CPPUNIT_TEST(testQuantize);
+    CPPUNIT_TEST(testHalfPrecision);
     CPPUNIT_TEST_SUITE_END();
 
     protected:
         void testLinear();
+        void testLinearSmallSteps();
         void testTanh();
         void testSigmoid();
+        void testMinibatch();
+        void testPredictBatch();
+        void testActivationFunctions();
+        void testDenseActivation();
+        void testQuantize();
+        void testHalfPrecision();
 
         template<typename T>
         void testActivation();
+
+        /**
+         * @brief Check that a @p Fused node predicts and is trained like a
+         *        Dense followed by an @p Act node
+         */
+        template<typename Fused, typename Act>
+        void compareDenseActivation();
 };
 
 #endif
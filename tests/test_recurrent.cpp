@@ -23,7 +23,10 @@
 #include "test_recurrent.h"
 #include "utils.h"
 
+#include <networkserializer.h>
+
 #include <iostream>
+#include <sstream>
 #include <stdlib.h>
 
 void TestRecurrent::testCWRNN()
@@ -39,6 +42,71 @@ void TestRecurrent::testCWRNN()
     testNetwork(net, 0.50);
 }
 
+void TestRecurrent::testCWRNNLegacy()
+{
+    // Weights of makeCWRNN(3, 1, 6, 1, 1e-2) trained for 3 epochs and saved by
+    // the CWRNN that had one Dense node per block, when files were only an
+    // array of floats
+    static const float weights[] = {
+        0.0359590128, -0.0058805896, -0.0179202929, -0.000179811264, 1.50935539e-05, 6.05780826e-07,
+        2.34660888e-07, 5.53948443e-09, 0.0817199275, -0.0295983106, 0.00122788688, 4.98923655e-05,
+        0.0321419276, -0.00877415389, -0.0231842287, -0.0064561055, 1.49784419e-05, 5.73542707e-07,
+        2.38095296e-07, 5.76421311e-09, 0.0749490857, -0.0252458174, 0.00121981418, 4.72128195e-05,
+        0.0420653298, -0.00535016134, -0.0175667778, -0.00565702468, 3.1173764e-05, 1.17311424e-06,
+        7.02717102e-07, 1.69564114e-08, 0.0849554986, -0.0308436099, 0.00121981418, 4.72128195e-05,
+        0.0369812921, -0.00259683654, -0.0176278949, -0.00438578054, 1.38606492e-05, 5.23882818e-07,
+        2.3006379e-07, 6.00770189e-09, 0.0881424323, -0.0221553184, 0.00113453425, 4.36583468e-05,
+        0.0493328869, -0.0145996306, -0.028239876, -0.0114028696, 2.88495139e-05, 1.06337848e-06,
+        6.77291837e-07, 1.74583494e-08, 0.0811419785, -0.0392739326, 0.00113453425, 4.36583468e-05,
+        0.0437194407, -0.0078501571, -0.0259485338, 0.00213433849, 5.16747896e-05, 1.95546477e-06,
+        1.53413851e-06, 4.21549586e-08, 0.0826200694, -0.0397502407, 0.00113453425, 4.36583468e-05,
+        -0.0432255864, 0.0192937311, 1.1068958e-05, 3.73733911e-07, 0.0907881856, -0.0277566817,
+        0.00122788688, 4.98923655e-05, 0.0630498677, -0.0164839569, 8.45250324e-05, 2.41761927e-06,
+        0.0850040317, -0.0342483819, 0.00121981418, 4.72128195e-05, 0.0567611307, -0.0198611356,
+        1.44917358e-05, 8.99130725e-07, 0.0807900354, -0.0229343437, 0.00113453425, 4.36583468e-05,
+        0.068209663, -0.0232449379, 0.000289324496, 5.05667522e-05, 0.0589690283, 0.00444993936
+    };
+    Matrix inputs(1, 8);
+    Matrix outputs(1, 8);
+    Vector predictions(8);
+    Vector trained_predictions(8);
+
+    inputs << 0.5, -0.25, 1.0, 0.0, -0.75, 0.25, 0.5, -1.0;
+    outputs << 0.0, 0.5, -0.5, 0.25, 0.0, -0.25, 0.75, 0.5;
+    predictions << 0.117674574, 0.117379524, 0.125466764, 0.122078463, 0.116066486, 0.119579881, 0.126040816, 0.120567434;
+
+    // Predictions after one more epoch. The error of the output of the former
+    // CWRNN was never cleared: these predictions were computed with it
+    // cleared at each time step, like it is now. The skip links of the units
+    // disabled at odd time steps receive their doubled error.
+    trained_predictions << 0.139461815, 0.139100507, 0.150005415, 0.145431548, 0.139758468, 0.144615978, 0.153200373, 0.145771027;
+
+    Network *net = makeCWRNN(3, 1, 6, 1, 1e-2);
+    NetworkSerializer serializer;
+    std::stringstream file;
+
+    file.write((const char *)weights, sizeof(weights));
+    serializer.loadLegacy(file);
+    net->deserialize(serializer);
+
+    for (int t=0; t<inputs.cols(); ++t) {
+        net->setCurrentTimestep(t);
+
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(predictions(t), net->predict(inputs.col(t))(0), 1e-6);
+    }
+
+    net->trainSequence(inputs, outputs, 1);
+    net->reset();
+
+    for (int t=0; t<inputs.cols(); ++t) {
+        net->setCurrentTimestep(t);
+
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(trained_predictions(t), net->predict(inputs.col(t))(0), 1e-5);
+    }
+
+    delete net;
+}
+
 void TestRecurrent::testGRU()
 {
     // Network with N GRU cells
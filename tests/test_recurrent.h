@@ -32,12 +32,14 @@ class TestRecurrent : public CppUnit::TestCase
 {
     CPPUNIT_TEST_SUITE(TestRecurrent);
     CPPUNIT_TEST(testCWRNN);
+    CPPUNIT_TEST(testCWRNNLegacy);
     CPPUNIT_TEST(testGRU);
     CPPUNIT_TEST(testLSTM);
     CPPUNIT_TEST_SUITE_END();
 
     protected:
         void testCWRNN();
+        void testCWRNNLegacy();
         void testGRU();
         void testLSTM();
 
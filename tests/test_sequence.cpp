@@ -0,0 +1,608 @@
+/*
+ * Copyright (c) 2015 Vrije Universiteit Brussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "test_sequence.h"
+#include "utils.h"
+
+#include <session.h>
+#include <sessioncache.h>
+#include <threadpool.h>
+
+#include <atomic>
+#include <cstdio>
+#include <stdexcept>
+
+/**
+ * @brief Weights of a network, as a single vector
+ */
+static Vector weightsOf(Network *net)
+{
+    NetworkSerializer serializer;
+
+    net->serialize(serializer);
+
+    return Eigen::Map<Vector>(serializer.data(), serializer.size()).cast<Float>();
+}
+
+/**
+ * @brief Give to @p to the same weights as @p from, that may be a network
+ *        of another structure storing its weights in the same way
+ */
+static void copyWeights(Network *from, Network *to)
+{
+    NetworkSerializer serializer;
+
+    from->serialize(serializer);
+    to->deserialize(serializer);
+}
+
+/**
+ * @brief Backpropagation through time performed using only the public API of
+ *        Network, re-forwarding every time step during the backward pass
+ */
+static void referenceTrainSequence(Network *net, const Matrix &inputs, const Matrix &outputs)
+{
+    Matrix errors(outputs.rows(), outputs.cols());
+
+    net->reset();
+
+    for (int t=0; t<inputs.cols(); ++t) {
+        net->setCurrentTimestep(t);
+        errors.col(t) = outputs.col(t) - net->predict(inputs.col(t));
+    }
+
+    for (int t=inputs.cols()-1; t>=0; --t) {
+        net->setCurrentTimestep(t);
+        net->predict(inputs.col(t));
+        net->setError(errors.col(t));
+    }
+
+    net->update();
+    net->reset();
+}
+
+void TestSequence::testHoisting()
+{
+    // The input projections of the GRU are hoisted out of the time loop
+    compareTraining(makeGRU(2, 10, 1, 1e-2), makeGRU(2, 10, 1, 1e-2));
+
+    // CWRNN reads the input port directly, nothing can be hoisted
+    compareTraining(makeCWRNN(3, 2, 12, 1, 1e-2), makeCWRNN(3, 2, 12, 1, 1e-2));
+}
+
+void TestSequence::testActivationMemory()
+{
+    std::size_t activation_memory = Network::activation_memory;
+
+    // Not enough memory to store all the time steps, the last ones are
+    // forwarded again during the backward pass
+    Network::activation_memory = 4096;
+    compareTraining(makeGRU(2, 10, 1, 1e-2), makeGRU(2, 10, 1, 1e-2));
+
+    // No memory at all, every time step is forwarded again
+    Network::activation_memory = 0;
+    compareTraining(makeGRU(2, 10, 1, 1e-2), makeGRU(2, 10, 1, 1e-2));
+
+    Network::activation_memory = activation_memory;
+}
+
+void TestSequence::testCheckpointing()
+{
+    std::size_t activation_memory = Network::activation_memory;
+
+    // Segments that don't divide the length of the sequence
+    compareTraining(makeGRU(2, 10, 1, 1e-2), makeGRU(2, 10, 1, 1e-2), 4);
+    compareTraining(makeCWRNN(3, 2, 12, 1, 1e-2), makeCWRNN(3, 2, 12, 1, 1e-2), 7);
+
+    // One checkpoint per time step
+    compareTraining(makeGRU(2, 10, 1, 1e-2), makeGRU(2, 10, 1, 1e-2), 1);
+
+    // Segments longer than what can be stored
+    Network::activation_memory = 2048;
+    compareTraining(makeGRU(2, 10, 1, 1e-2), makeGRU(2, 10, 1, 1e-2), 6);
+
+    Network::activation_memory = activation_memory;
+}
+
+void TestSequence::testStorageReuse()
+{
+    Network *net = makeGRU(2, 10, 1, 1e-2);
+    Network *fresh = makeGRU(2, 10, 1, 1e-2);
+    Matrix inputs = Matrix::Random(2, 40);
+    float momentum = Dense::momentum;
+
+    // The momentum is not serialized, disable it so that copying the weights
+    // copies the whole state of the network
+    Dense::momentum = 0.0f;
+
+    Matrix outputs = Matrix::Random(1, 40);
+
+    // The recurrent storage of net is kept after this sequence
+    net->trainSequence(inputs, outputs, 2);
+
+    // A shorter sequence must not see anything of the previous one
+    copyWeights(net, fresh);
+
+    net->trainSequence(inputs.leftCols(15), outputs.leftCols(15), 2);
+    fresh->trainSequence(inputs.leftCols(15), outputs.leftCols(15), 2);
+
+    CPPUNIT_ASSERT_MESSAGE(
+        "The recurrent storage of a previous sequence influences the training",
+        (weightsOf(net) - weightsOf(fresh)).cwiseAbs().maxCoeff() < 1e-6
+    );
+
+    Dense::momentum = momentum;
+
+    delete net;
+    delete fresh;
+}
+
+void TestSequence::testStreaming()
+{
+    compareStreaming(makeGRU(2, 10, 1, 1e-2));
+    compareStreaming(makeCWRNN(3, 2, 12, 1, 1e-2));
+}
+
+void TestSequence::testSessions()
+{
+    compareSessions(makeGRU(2, 10, 1, 1e-2));
+    compareSessions(makeCWRNN(3, 2, 12, 1, 1e-2));
+}
+
+void TestSequence::testSessionCache()
+{
+    const int num_sessions = 5;
+    const int length = 12;
+
+    Network *net = makeGRU(2, 10, 1, 1e-2);
+    std::vector<Matrix> inputs;
+    std::vector<Matrix> outputs;
+    std::vector<int> timesteps(num_sessions, 0);
+
+    // Reference outputs of each stream
+    for (int s=0; s<num_sessions; ++s) {
+        inputs.push_back(Matrix::Random(2, length));
+        outputs.push_back(Matrix(1, length));
+
+        net->reset();
+
+        for (int t=0; t<length; ++t) {
+            outputs[s].col(t) = net->step(inputs[s].col(t));
+        }
+    }
+
+    {
+        // Only two sessions fit in memory, the others are spilled
+        SessionCache cache(net, 2, "test_sessions.spill");
+
+        for (int round=0; round<(num_sessions * length) / 2; ++round) {
+            std::vector<SessionCache::Key> keys;
+            Matrix round_inputs(2, 2);
+            Matrix round_outputs;
+
+            // Pairs of sessions, in an order that makes them evicted and loaded again
+            for (int s : {round % num_sessions, (3 * round + 1) % num_sessions}) {
+                if (timesteps[s] < length && (keys.size() == 0 || keys[0] != (SessionCache::Key)s + 100)) {
+                    round_inputs.col(keys.size()) = inputs[s].col(timesteps[s]);
+                    keys.push_back(s + 100);
+                }
+            }
+
+            cache.step(keys, round_inputs.leftCols(keys.size()), round_outputs);
+
+            for (std::size_t i=0; i<keys.size(); ++i) {
+                int s = keys[i] - 100;
+
+                CPPUNIT_ASSERT_DOUBLES_EQUAL(outputs[s](0, timesteps[s]), round_outputs(0, i), 1e-5);
+                timesteps[s] += 1;
+            }
+        }
+
+        CPPUNIT_ASSERT_EQUAL(std::size_t(num_sessions), cache.size());
+        CPPUNIT_ASSERT(cache.evictions() > 0);
+        CPPUNIT_ASSERT(cache.hits() > 0);
+        // Misses either create a session or load an evicted one, and all the
+        // sessions but two end up evicted
+        CPPUNIT_ASSERT_EQUAL(
+            std::size_t(num_sessions) + cache.evictions() - (num_sessions - 2),
+            cache.misses()
+        );
+
+        // A removed session starts a new stream
+        cache.remove(100);
+        CPPUNIT_ASSERT_EQUAL(std::size_t(num_sessions - 1), cache.size());
+
+        // A session cannot be stepped twice at once
+        Matrix round_outputs;
+
+        CPPUNIT_ASSERT_THROW(
+            cache.step({101, 101}, Matrix::Random(2, 2), round_outputs),
+            std::invalid_argument
+        );
+
+        // More sessions than the capacity cannot be stepped at once
+        CPPUNIT_ASSERT_THROW(
+            cache.step({101, 102, 103}, Matrix::Zero(2, 3), round_outputs),
+            std::invalid_argument
+        );
+        CPPUNIT_ASSERT_EQUAL(std::size_t(num_sessions - 1), cache.size());
+    }
+
+    // A cache must be able to keep at least one session in memory
+    CPPUNIT_ASSERT_THROW(SessionCache(net, 0, "test_sessions.spill"), std::invalid_argument);
+
+    std::remove("test_sessions.spill");
+    delete net;
+}
+
+void TestSequence::testFreeze()
+{
+    Network *net = makeCWRNN(3, 2, 12, 1, 1e-2);
+    Network *copy = makeCWRNN(3, 2, 12, 1, 1e-2);
+    Matrix inputs = Matrix::Random(2, 20);
+    Matrix outputs(1, 20);
+
+    net->trainSequence(inputs, inputs.topRows(1), 2);
+    net->reset();
+
+    for (int t=0; t<inputs.cols(); ++t) {
+        net->setCurrentTimestep(t);
+        outputs.col(t) = net->predict(inputs.col(t));
+    }
+
+    // A frozen network predicts exactly like before
+    net->freeze();
+    net->reset();
+
+    for (int t=0; t<inputs.cols(); ++t) {
+        net->setCurrentTimestep(t);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(outputs(0, t), net->predict(inputs.col(t))(0), 1e-6);
+    }
+
+    net->reset();
+
+    for (int t=0; t<inputs.cols(); ++t) {
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(outputs(0, t), net->step(inputs.col(t))(0, 0), 1e-6);
+    }
+
+    // It cannot be trained anymore
+    CPPUNIT_ASSERT_THROW(net->update(), std::logic_error);
+    CPPUNIT_ASSERT_THROW(net->setError(outputs.col(0)), std::logic_error);
+    CPPUNIT_ASSERT_THROW(net->trainSequence(inputs, outputs, 1), std::logic_error);
+
+    // Its weights can be loaded in a network that is not frozen
+    copyWeights(net, copy);
+    copy->reset();
+
+    for (int t=0; t<inputs.cols(); ++t) {
+        copy->setCurrentTimestep(t);
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(outputs(0, t), copy->predict(inputs.col(t))(0), 1e-6);
+    }
+
+    delete net;
+    delete copy;
+}
+
+void TestSequence::testFusedGRU()
+{
+    compareFused(makeGRU<FusedGRU>(2, 8, 1, 1e-2), makeGRU(2, 8, 1, 1e-2));
+
+    // Also with checkpointing and in streaming mode
+    compareTraining(makeGRU<FusedGRU>(2, 8, 1, 1e-2), makeGRU<FusedGRU>(2, 8, 1, 1e-2), 7);
+    compareStreaming(makeGRU<FusedGRU>(2, 8, 1, 1e-2));
+    compareSessions(makeGRU<FusedGRU>(2, 8, 1, 1e-2));
+}
+
+void TestSequence::testFusedLSTM()
+{
+    compareFused(makeLSTM<FusedLSTM>(2, 8, 1, 1e-2), makeLSTM(2, 8, 1, 1e-2));
+
+    compareTraining(makeLSTM<FusedLSTM>(2, 8, 1, 1e-2), makeLSTM<FusedLSTM>(2, 8, 1, 1e-2), 7);
+    compareStreaming(makeLSTM<FusedLSTM>(2, 8, 1, 1e-2));
+    compareSessions(makeLSTM<FusedLSTM>(2, 8, 1, 1e-2));
+}
+
+/**
+ * @brief makeLSTM(), the output and LSTM nodes being added before the nodes
+ *        they read
+ */
+static Network *makeUnorderedLSTM(unsigned int nin, unsigned int nhidden, unsigned int nout, float learning_rate)
+{
+    Network *net = new Network(nin);
+    Dense *dense_in = new Dense(nhidden, learning_rate);
+    Dense *dense_ingate = new Dense(nhidden, learning_rate);
+    Dense *dense_outgate = new Dense(nhidden, learning_rate);
+    Dense *dense_forgetgate = new Dense(nhidden, learning_rate);
+    LSTM *lstm = new LSTM(nhidden, learning_rate);
+    Dense *out = new Dense(nout, learning_rate);
+
+    dense_in->setInput(net->inputPort());
+    dense_ingate->setInput(net->inputPort());
+    dense_outgate->setInput(net->inputPort());
+    dense_forgetgate->setInput(net->inputPort());
+    lstm->addInput(dense_in->output());
+    lstm->addInGate(dense_ingate->output());
+    lstm->addOutGate(dense_outgate->output());
+    lstm->addForgetGate(dense_forgetgate->output());
+    out->setInput(lstm->output());
+
+    net->addNode(out);
+    net->addNode(lstm);
+    net->addNode(dense_in);
+    net->addNode(dense_ingate);
+    net->addNode(dense_outgate);
+    net->addNode(dense_forgetgate);
+
+    return net;
+}
+
+void TestSequence::testParallelForward()
+{
+    ThreadPool pool(3);
+    Network *reference = makeLSTM(2, 8, 1, 1e-2);
+    Network *net = makeUnorderedLSTM(2, 8, 1, 1e-2);
+
+    // The nodes are put back in the order of makeLSTM, the weights can be copied
+    net->sortNodes();
+    net->setThreadPool(&pool);
+
+    copyWeights(reference, net);
+
+    Matrix inputs = Matrix::Random(2, 30);
+
+    for (int t=0; t<inputs.cols(); ++t) {
+        net->setCurrentTimestep(t);
+        reference->setCurrentTimestep(t);
+
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(
+            reference->predict(inputs.col(t))(0),
+            net->predict(inputs.col(t))(0),
+            1e-6
+        );
+    }
+
+    delete reference;
+
+    // Streams and sessions are also forwarded level by level
+    compareSessions(net);
+
+    net = makeGRU(2, 10, 1, 1e-2);
+    net->setThreadPool(&pool);
+    compareStreaming(net);
+
+    // Two nodes reading each other cannot be ordered
+    net = new Network(2);
+    Dense *dense1 = new Dense(2, 1e-2);
+    Dense *dense2 = new Dense(2, 1e-2);
+
+    dense1->setInput(dense2->output());
+    dense2->setInput(dense1->output());
+    net->addNode(dense1);
+    net->addNode(dense2);
+
+    CPPUNIT_ASSERT_THROW(net->sortNodes(), std::logic_error);
+
+    delete net;
+
+    // Two nodes that no node reads could both produce the output
+    net = new Network(2);
+    dense1 = new Dense(2, 1e-2);
+    dense2 = new Dense(2, 1e-2);
+
+    dense1->setInput(net->inputPort());
+    dense2->setInput(net->inputPort());
+    net->addNode(dense1);
+    net->addNode(dense2);
+
+    CPPUNIT_ASSERT_THROW(net->sortNodes(), std::logic_error);
+
+    delete net;
+
+    // The exception of a task is thrown by run(), and the pool still works
+    std::atomic<unsigned int> executed(0);
+
+    CPPUNIT_ASSERT_THROW(pool.run(20, [](unsigned int i) {
+        if (i == 7) {
+            throw std::runtime_error("task");
+        }
+    }), std::runtime_error);
+
+    pool.run(20, [&executed](unsigned int i) {
+        (void) i;
+        executed += 1;
+    });
+
+    CPPUNIT_ASSERT_EQUAL(20u, executed.load());
+}
+
+void TestSequence::compareTraining(Network *net, Network *reference, unsigned int checkpoint_interval)
+{
+    Matrix inputs = Matrix::Random(2, 30);
+    Matrix outputs = Matrix::Random(1, 30);
+
+    copyWeights(net, reference);
+
+    for (int epoch=0; epoch<5; ++epoch) {
+        AbstractRecurrentNetworkNode::checkpoint_interval = checkpoint_interval;
+        net->trainSequence(inputs, outputs, 1);
+
+        AbstractRecurrentNetworkNode::checkpoint_interval = 0;
+        referenceTrainSequence(reference, inputs, outputs);
+    }
+
+    CPPUNIT_ASSERT_MESSAGE(
+        "trainSequence does not produce the same weights as step-by-step BPTT",
+        (weightsOf(net) - weightsOf(reference)).cwiseAbs().maxCoeff() < 1e-4
+    );
+
+    delete net;
+    delete reference;
+}
+
+void TestSequence::compareStreaming(Network *net)
+{
+    Matrix inputs = Matrix::Random(2, 40);
+    Matrix outputs(1, 40);
+    Matrix negated_outputs(1, 40);
+
+    // Two streams in lockstep
+    Matrix stream_inputs(2, 2);
+
+    // Reference outputs, all the time steps being stored in the network
+    net->reset();
+
+    for (int t=0; t<inputs.cols(); ++t) {
+        net->setCurrentTimestep(t);
+        outputs.col(t) = net->predict(inputs.col(t));
+    }
+
+    net->reset();
+
+    for (int t=0; t<inputs.cols(); ++t) {
+        net->setCurrentTimestep(t);
+        negated_outputs.col(t) = net->predict(-inputs.col(t));
+    }
+
+    // Streams, the second one being the first one negated. The sequence is
+    // longer than two periods of CWRNN, after which the time step of the
+    // stream goes back to the beginning of its period.
+    for (int repeat=0; repeat<2; ++repeat) {
+        for (int t=0; t<inputs.cols(); ++t) {
+            stream_inputs.col(0) = inputs.col(t);
+            stream_inputs.col(1) = -inputs.col(t);
+
+            Matrix stream_outputs = net->step(stream_inputs);
+
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(outputs(0, t), stream_outputs(0, 0), 1e-5);
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(negated_outputs(0, t), stream_outputs(0, 1), 1e-5);
+
+            // The time step stays bounded, and never goes back to zero
+            CPPUNIT_ASSERT(t == 0 || net->currentTimestep() != 0);
+            CPPUNIT_ASSERT(net->currentTimestep() < 2 * net->period());
+        }
+
+        // A new stream starts after reset()
+        net->reset();
+    }
+
+    delete net;
+}
+
+void TestSequence::compareSessions(Network *net)
+{
+    const int num_sessions = 5;
+    const int length = 20;
+
+    std::vector<Matrix> inputs;
+    std::vector<Matrix> outputs;
+    std::vector<Session> sessions(num_sessions);
+
+    // Reference outputs of each stream
+    for (int s=0; s<num_sessions; ++s) {
+        inputs.push_back(Matrix::Random(2, length));
+        outputs.push_back(Matrix(1, length));
+
+        net->reset();
+
+        for (int t=0; t<length; ++t) {
+            outputs[s].col(t) = net->step(inputs[s].col(t));
+        }
+    }
+
+    // Step the sessions together, some of them being skipped at some rounds
+    // so that they are at different time steps
+    for (int round=0; ; ++round) {
+        std::vector<Session *> stepped;
+        Matrix round_inputs(2, num_sessions);
+        Matrix round_outputs;
+
+        for (int s=0; s<num_sessions; ++s) {
+            if ((round + s) % 3 != 1 && sessions[s].timestep() < (unsigned int)length) {
+                round_inputs.col(stepped.size()) = inputs[s].col(sessions[s].timestep());
+                stepped.push_back(&sessions[s]);
+            }
+        }
+
+        if (stepped.size() == 0) {
+            // All the streams are finished (no round skips all the sessions)
+            break;
+        }
+
+        net->step(stepped, round_inputs.leftCols(stepped.size()), round_outputs);
+
+        for (std::size_t i=0; i<stepped.size(); ++i) {
+            int s = stepped[i] - &sessions[0];
+            int t = stepped[i]->timestep() - 1;
+
+            CPPUNIT_ASSERT_DOUBLES_EQUAL(outputs[s](0, t), round_outputs(0, i), 1e-5);
+        }
+    }
+
+    // A session cannot be stepped twice at once
+    Matrix round_outputs;
+
+    CPPUNIT_ASSERT_THROW(
+        net->step({&sessions[0], &sessions[0]}, Matrix::Zero(2, 2), round_outputs),
+        std::invalid_argument
+    );
+    CPPUNIT_ASSERT_EQUAL(std::uint64_t(length), sessions[0].timestep());
+
+    delete net;
+}
+
+void TestSequence::compareFused(Network *fused, Network *composed)
+{
+    Matrix inputs = Matrix::Random(2, 30);
+    Matrix outputs = Matrix::Random(1, 30);
+
+    // The fused node loads the weights of the composed one, and computes the same thing
+    copyWeights(composed, fused);
+
+    for (int t=0; t<inputs.cols(); ++t) {
+        fused->setCurrentTimestep(t);
+        composed->setCurrentTimestep(t);
+
+        CPPUNIT_ASSERT_DOUBLES_EQUAL(
+            composed->predict(inputs.col(t))(0),
+            fused->predict(inputs.col(t))(0),
+            1e-6
+        );
+    }
+
+    // It is trained in the same way
+    for (int epoch=0; epoch<5; ++epoch) {
+        fused->trainSequence(inputs, outputs, 1);
+        composed->trainSequence(inputs, outputs, 1);
+
+        Vector fused_weights = weightsOf(fused);
+        Vector composed_weights = weightsOf(composed);
+
+        // The gradient statistics are small, compare relative differences
+        CPPUNIT_ASSERT_MESSAGE(
+            "The fused and composed nodes do not produce the same weights",
+            ((fused_weights - composed_weights).array().abs() / (composed_weights.array().abs() + 1e-6)).maxCoeff() < 1e-4
+        );
+    }
+
+    delete fused;
+    delete composed;
+}
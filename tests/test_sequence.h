@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2015 Vrije Universiteit Brussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __TEST_SEQUENCE_H__
+#define __TEST_SEQUENCE_H__
+
+#include <cppunit/TestCase.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+class Network;
+
+class TestSequence : public CppUnit::TestCase
+{
+    CPPUNIT_TEST_SUITE(TestSequence);
+    CPPUNIT_TEST(testHoisting);
+    CPPUNIT_TEST(testActivationMemory);
+    CPPUNIT_TEST(testCheckpointing);
+    CPPUNIT_TEST(testStorageReuse);
+    CPPUNIT_TEST(testStreaming);
+    CPPUNIT_TEST(testSessions);
+    CPPUNIT_TEST(testSessionCache);
+    CPPUNIT_TEST(testFreeze);
+    CPPUNIT_TEST(testFusedGRU);
+    CPPUNIT_TEST(testFusedLSTM);
+    CPPUNIT_TEST(testParallelForward);
+    CPPUNIT_TEST_SUITE_END();
+
+    protected:
+        void testHoisting();
+        void testActivationMemory();
+        void testCheckpointing();
+        void testStorageReuse();
+        void testStreaming();
+        void testSessions();
+        void testSessionCache();
+        void testFreeze();
+        void testFusedGRU();
+        void testFusedLSTM();
+        void testParallelForward();
+
+    private:
+        /**
+         * @brief Check that trainSequence() updates the weights of @p net
+         *        exactly like a plain step-by-step BPTT loop does on @p reference
+         *
+         * @param checkpoint_interval Checkpoint interval used when training @p net
+         */
+        void compareTraining(Network *net, Network *reference, unsigned int checkpoint_interval = 0);
+
+        /**
+         * @brief Check that Network::step() produces the same outputs as
+         *        predicting the time steps of a sequence one after the other
+         */
+        void compareStreaming(Network *net);
+
+        /**
+         * @brief Check that sessions stepped together, at different time steps,
+         *        produce the same outputs as streams processed one at a time
+         */
+        void compareSessions(Network *net);
+
+        /**
+         * @brief Check that @p fused predicts and is trained like @p composed
+         *        when it is given the weights of @p composed
+         */
+        void compareFused(Network *fused, Network *composed);
+};
+
+#endif
@@ -0,0 +1,660 @@
+/*
+ * Copyright (c) 2015 Vrije Universiteit Brussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "test_serializer.h"
+#include "utils.h"
+
+#include <network.h>
+#include <networkserializer.h>
+#include <checkpointer.h>
+#include <dense.h>
+#include <denseactivation.h>
+#include <mergesum.h>
+#include <gru.h>
+#include <fusedlstm.h>
+
+#include <algorithm>
+#include <cstring>
+#include <sstream>
+#include <fstream>
+#include <cstdio>
+#include <stdexcept>
+#include <type_traits>
+
+/**
+ * @brief Small network with a hidden layer
+ */
+static Network *makeNetwork()
+{
+    Network *net = new Network(4);
+    TanhDense *dense1 = new TanhDense(16, 0.01);
+    Dense *dense2 = new Dense(3, 0.01);
+
+    dense1->setInput(net->inputPort());
+    dense2->setInput(dense1->output());
+
+    net->addNode(dense1);
+    net->addNode(dense2);
+
+    return net;
+}
+
+/**
+ * @brief Serialize @p net into @p weights, and give it back its weights as
+ *        they are serialized (single-precision floats)
+ */
+static void serialize(Network *net, NetworkSerializer &weights)
+{
+    net->serialize(weights);
+
+    NetworkSerializer copy = weights;
+
+    net->deserialize(copy);
+}
+
+void TestSerializer::testSaveLoad()
+{
+    Network *net = makeNetwork();
+    Network *copy = makeNetwork();
+    Matrix inputs = Matrix::Random(4, 10);
+    Matrix outputs;
+    Matrix copy_outputs;
+    NetworkSerializer weights;
+    NetworkSerializer loaded;
+    std::stringstream file;
+
+    serialize(net, weights);
+    net->predictBatch(inputs, outputs);
+
+    // Save then load the weights
+    weights.save(file);
+    loaded.load(file);
+
+    CPPUNIT_ASSERT_EQUAL(weights.size(), loaded.size());
+    CPPUNIT_ASSERT(
+        Eigen::Map<Vector>(weights.data(), weights.size()) ==
+        Eigen::Map<Vector>(loaded.data(), loaded.size())
+    );
+
+    copy->deserialize(loaded);
+    copy->predictBatch(inputs, copy_outputs);
+
+    CPPUNIT_ASSERT(outputs == copy_outputs);
+
+    // Files that are only an array of floats can still be loaded, but only
+    // when asked for
+    Network *old = makeNetwork();
+    NetworkSerializer bare;
+    std::stringstream bare_file;
+
+    Eigen::VectorXf floats = Eigen::Map<Vector>(weights.data(), weights.size()).cast<float>();
+
+    bare_file.write((const char *)floats.data(), floats.size() * sizeof(float));
+
+    CPPUNIT_ASSERT_THROW(bare.load(bare_file), std::runtime_error);
+
+    bare.loadLegacy(bare_file.seekg(0));
+
+    CPPUNIT_ASSERT_EQUAL(weights.size(), bare.size());
+
+    // The same outputs, the weights being rounded to floats if Float is double
+    old->deserialize(bare);
+    old->predictBatch(inputs, copy_outputs);
+
+    CPPUNIT_ASSERT((outputs - copy_outputs).cwiseAbs().maxCoeff() < 1e-5);
+
+    delete net;
+    delete copy;
+    delete old;
+}
+
+void TestSerializer::testInvalidFiles()
+{
+    Network *net = makeNetwork();
+    NetworkSerializer weights;
+    NetworkSerializer loaded;
+    std::stringstream file;
+
+    net->serialize(weights);
+    weights.save(file);
+
+    // Truncated file
+    std::string contents = file.str();
+    std::stringstream truncated(contents.substr(0, contents.size() - 1));
+
+    CPPUNIT_ASSERT_THROW(loaded.load(truncated), std::runtime_error);
+
+    // Unknown version
+    std::string version = contents;
+
+    version[8] = 4;
+
+    std::stringstream unknown(version);
+
+    CPPUNIT_ASSERT_THROW(loaded.load(unknown), std::runtime_error);
+
+    // Values that are neither floats nor doubles
+    std::string scalar = contents;
+
+    scalar[36] = 2;
+
+    std::stringstream invalid_scalar(scalar);
+
+    CPPUNIT_ASSERT_THROW(loaded.load(invalid_scalar), std::runtime_error);
+
+    // Damaged magic number, that would otherwise be an array of floats
+    std::string magic = contents;
+
+    magic[0] = 'n';
+
+    std::stringstream damaged(magic);
+
+    CPPUNIT_ASSERT_THROW(loaded.load(damaged), std::runtime_error);
+
+    // Array of floats whose size is not a multiple of the size of a float
+    std::stringstream bare(std::string(4 * 10 + 1, '\0'));
+
+    CPPUNIT_ASSERT_THROW(loaded.loadLegacy(bare), std::runtime_error);
+
+    // Corrupted weight
+    std::string corrupted = contents;
+
+    corrupted[corrupted.size() - 2] ^= 1;
+
+    std::stringstream corrupted_file(corrupted);
+
+    CPPUNIT_ASSERT_THROW(loaded.load(corrupted_file), std::runtime_error);
+
+    // The complete file can be loaded
+    file.seekg(0);
+    loaded.load(file);
+
+    CPPUNIT_ASSERT_EQUAL(weights.size(), loaded.size());
+
+    // The weights do not fit a network of another shape
+    Network *other = new Network(4);
+    Dense *dense = new Dense(3, 0.01);
+
+    dense->setInput(other->inputPort());
+    other->addNode(dense);
+
+    CPPUNIT_ASSERT_THROW(other->deserialize(loaded), std::runtime_error);
+
+    // A network described differently, whose first weights fit
+    Network *smaller = new Network(4);
+    TanhDense *hidden = new TanhDense(16, 0.01);
+
+    hidden->setInput(smaller->inputPort());
+    smaller->addNode(hidden);
+
+    loaded.load(file.seekg(0));
+    CPPUNIT_ASSERT_THROW(smaller->deserialize(loaded), std::runtime_error);
+
+    // A file without description, whose weights left unread are detected
+    Eigen::VectorXf floats = Eigen::Map<Vector>(weights.data(), weights.size()).cast<float>();
+    std::stringstream bare_file;
+
+    bare_file.write((const char *)floats.data(), floats.size() * sizeof(float));
+    loaded.loadLegacy(bare_file);
+    CPPUNIT_ASSERT_THROW(smaller->deserialize(loaded), std::runtime_error);
+
+    // A frozen node does not map transposed weights, that have as many values
+    Network *transposed = new Network(8);
+    Dense *transposed_dense = new Dense(2, 0.01);
+    NetworkSerializer transposed_weights;
+
+    transposed_dense->setInput(transposed->inputPort());
+    transposed->addNode(transposed_dense);
+    transposed->freeze();
+
+    transposed_weights.writeTensor(Matrix::Zero(8, 2));
+    transposed_weights.writeTensor(Matrix::Zero(2, 8));
+    transposed_weights.writeTensor(Vector::Zero(2));
+    transposed_weights.writeTensor(Vector::Zero(2));
+
+    {
+        std::ofstream mapped_file("test_serializer.nnet", std::ios::binary);
+
+        transposed_weights.save(mapped_file);
+    }
+
+    loaded.map("test_serializer.nnet");
+    CPPUNIT_ASSERT_THROW(transposed->deserialize(loaded), std::runtime_error);
+
+    std::remove("test_serializer.nnet");
+
+    delete net;
+    delete other;
+    delete smaller;
+    delete transposed;
+}
+
+/**
+ * @brief Write @p value at @p pos in @p contents
+ */
+template<typename T>
+static void put(std::string &contents, std::size_t pos, T value)
+{
+    std::memcpy(&contents[pos], &value, sizeof(value));
+}
+
+/**
+ * @brief Checksum of the tensors of the network files, for tensors of 8 words
+ *        of 32 bits at most
+ */
+static uint64_t fileChecksum(const std::string &contents, std::size_t pos, std::size_t size)
+{
+    uint32_t words[8] = {0};
+    uint64_t rs = size / sizeof(uint32_t);
+
+    std::memcpy(words, &contents[pos], size);
+
+    // The sum of a single block of words, and the sum of this sum, are the words
+    for (int j=0; j<8; ++j) {
+        rs = (rs * 0x100000001b3ULL) ^ ((uint64_t(words[j]) << 32) | words[j]);
+    }
+
+    return rs;
+}
+
+void TestSerializer::testConvert()
+{
+    // File written by the library built with the other Float type, with a
+    // tensor of 3 values and a tensor of 5 bytes. The header takes 40 bytes,
+    // each tensor of the table 40 bytes, and the tensors are aligned on 64
+    typedef std::conditional<sizeof(Float) == sizeof(float), double, float>::type Other;
+
+    const Other values[3] = {Other(0.5), Other(-1.25), Other(1e-3)};
+    const char bytes[5] = {1, 2, 3, 4, 5};
+    std::string contents(200, '\0');
+
+    contents.replace(0, 8, std::string("NNETCPP\0", 8));
+    put<uint32_t>(contents, 8, 1);
+    put<uint32_t>(contents, 12, 64);
+    put<uint64_t>(contents, 16, 2);
+    put<uint64_t>(contents, 24, 0);
+    put<uint32_t>(contents, 32, NetworkSerializer::Export);
+    put<uint32_t>(contents, 36, sizeof(Other));
+
+    std::memcpy(&contents[128], values, sizeof(values));
+    std::memcpy(&contents[192], bytes, sizeof(bytes));
+
+    put<uint64_t>(contents, 40, 128);
+    put<uint64_t>(contents, 48, 3);
+    put<uint32_t>(contents, 56, 3);
+    put<uint32_t>(contents, 60, 1);
+    put<uint64_t>(contents, 64, fileChecksum(contents, 128, sizeof(values)));
+    put<uint64_t>(contents, 72, 0);
+
+    put<uint64_t>(contents, 80, 192);
+    put<uint64_t>(contents, 88, 8 / sizeof(Other));
+    put<uint32_t>(contents, 96, 8 / sizeof(Other));
+    put<uint32_t>(contents, 100, 1);
+    put<uint64_t>(contents, 104, fileChecksum(contents, 192, 8));
+    put<uint64_t>(contents, 112, sizeof(bytes));
+
+    // Loaded or mapped, the values are converted and the bytes unchanged
+    for (int mapped=0; mapped<2; ++mapped) {
+        NetworkSerializer serializer;
+        Vector read_values(3);
+        char read_bytes[5];
+
+        if (mapped) {
+            std::ofstream("test_serializer.nnet", std::ios::binary) << contents;
+            serializer.map("test_serializer.nnet");
+            std::remove("test_serializer.nnet");
+
+            // The values cannot be read in place
+            CPPUNIT_ASSERT(!serializer.mapping());
+        } else {
+            std::stringstream file(contents);
+
+            serializer.load(file);
+        }
+
+        CPPUNIT_ASSERT_EQUAL(NetworkSerializer::Export, serializer.mode());
+
+        serializer.readTensor(read_values);
+        serializer.readBytes(read_bytes, sizeof(read_bytes));
+
+        for (int i=0; i<3; ++i) {
+            CPPUNIT_ASSERT_EQUAL(Float(values[i]), read_values(i));
+        }
+
+        CPPUNIT_ASSERT(std::equal(bytes, bytes + sizeof(bytes), read_bytes));
+        CPPUNIT_ASSERT_EQUAL(std::size_t(0), serializer.remaining());
+    }
+
+    // The checksums of the values of the file are verified
+    NetworkSerializer serializer;
+
+    contents[129] ^= 1;
+    std::ofstream("test_serializer.nnet", std::ios::binary) << contents;
+
+    std::stringstream corrupted(contents);
+
+    CPPUNIT_ASSERT_THROW(serializer.load(corrupted), std::runtime_error);
+    CPPUNIT_ASSERT_THROW(serializer.map("test_serializer.nnet"), std::runtime_error);
+
+    std::remove("test_serializer.nnet");
+}
+
+void TestSerializer::testMap()
+{
+    Network *net = makeNetwork();
+    Network *mapped = makeNetwork();
+    Matrix inputs = Matrix::Random(4, 10);
+    Matrix outputs;
+    Matrix mapped_outputs;
+    NetworkSerializer weights;
+
+    serialize(net, weights);
+    net->predictBatch(inputs, outputs);
+
+    {
+        std::ofstream file("test_serializer.nnet", std::ios::binary);
+
+        weights.save(file);
+    }
+
+    // The frozen nodes keep the file mapped once the serializer is destroyed
+    {
+        NetworkSerializer serializer;
+
+        serializer.map("test_serializer.nnet");
+        mapped->freeze();
+        mapped->deserialize(serializer);
+    }
+
+    std::remove("test_serializer.nnet");
+
+    mapped->predictBatch(inputs, mapped_outputs);
+
+    CPPUNIT_ASSERT(outputs == mapped_outputs);
+
+    // The mapped weights are serialized as the original ones
+    NetworkSerializer again;
+
+    mapped->serialize(again);
+
+    CPPUNIT_ASSERT_EQUAL(weights.size(), again.size());
+
+    // The file does not exist anymore
+    NetworkSerializer serializer;
+
+    CPPUNIT_ASSERT_THROW(serializer.map("test_serializer.nnet"), std::runtime_error);
+
+    delete net;
+    delete mapped;
+}
+
+void TestSerializer::testRebuild()
+{
+    Network *net = new Network(4);
+    TanhDense *hidden = new TanhDense(8, 0.01);
+    Dense *dense1 = new Dense(8, 0.02, 0.95);
+    Dense *dense2 = new Dense(8, 0.02, 0.95);
+    MergeSum *sum = new MergeSum;
+    TanhActivation *activation = new TanhActivation;
+    GRU *gru = new GRU(8, 0.03);
+    FusedLSTM *lstm = new FusedLSTM(8, 0.04, 0.8);
+    SigmoidDense *output = new SigmoidDense(3, 0.01);
+    Matrix inputs = Matrix::Random(4, 10);
+    Matrix outputs;
+    Matrix rebuilt_outputs;
+
+    hidden->setInput(net->inputPort());
+    dense1->setInput(net->inputPort());
+    dense2->setInput(hidden->output());
+    sum->addInput(dense1->output());
+    sum->addInput(dense2->output());
+    activation->setInput(sum->output());
+    gru->addInput(activation->output());
+    gru->addZ(hidden->output());
+    lstm->addInput(gru->output());
+    lstm->addForgetGate(hidden->output());
+    output->setInput(lstm->output());
+
+    net->addNode(hidden);
+    net->addNode(dense1);
+    net->addNode(dense2);
+    net->addNode(sum);
+    net->addNode(activation);
+    net->addNode(gru);
+    net->addNode(lstm);
+    net->addNode(output);
+
+    // dense1, dense2 and sum become a DenseSum
+    net->optimize();
+
+    // The file describes the network and its hyperparameters
+    NetworkSerializer weights;
+    NetworkSerializer loaded;
+    std::stringstream file;
+
+    Dense::momentum = 0.2f;
+    serialize(net, weights);
+    net->predictBatch(inputs, outputs);
+    weights.save(file);
+
+    Dense::momentum = 0.1f;
+    loaded.load(file);
+
+    Float momentum = 0;
+    Network *rebuilt = Network::rebuild(loaded, &momentum);
+
+    rebuilt->predictBatch(inputs, rebuilt_outputs);
+
+    // The momentum of the file is given, not applied to all the networks
+    CPPUNIT_ASSERT_EQUAL(Float(0.2f), momentum);
+    CPPUNIT_ASSERT_EQUAL(Float(0.1f), Dense::momentum);
+    CPPUNIT_ASSERT_EQUAL(net->topology(), rebuilt->topology());
+    CPPUNIT_ASSERT(outputs == rebuilt_outputs);
+
+    Dense::momentum = 0.1f;
+    delete rebuilt;
+
+    // A quantized network is rebuilt quantized, from a mapped file
+    NetworkSerializer quantized;
+
+    net->quantize();
+    serialize(net, quantized);
+    net->reset();
+    net->predictBatch(inputs, outputs);
+
+    {
+        std::ofstream file("test_serializer.nnet", std::ios::binary);
+
+        quantized.save(file);
+    }
+
+    NetworkSerializer mapped;
+
+    mapped.map("test_serializer.nnet");
+    mapped.verify();
+    rebuilt = Network::rebuild(mapped);
+    std::remove("test_serializer.nnet");
+
+    rebuilt->predictBatch(inputs, rebuilt_outputs);
+
+    CPPUNIT_ASSERT_EQUAL(net->topology(), rebuilt->topology());
+    CPPUNIT_ASSERT(outputs == rebuilt_outputs);
+
+    // Serializers without a description cannot be rebuilt
+    NetworkSerializer empty;
+
+    CPPUNIT_ASSERT_THROW(Network::rebuild(empty), std::runtime_error);
+
+    delete net;
+    delete rebuilt;
+}
+
+void TestSerializer::testExport()
+{
+    Network *net = makeNetwork();
+    Matrix inputs = Matrix::Random(4, 10);
+    Matrix outputs;
+    Matrix exported_outputs;
+    NetworkSerializer checkpoint;
+    NetworkSerializer exported;
+    NetworkSerializer loaded;
+    std::stringstream checkpoint_file;
+    std::stringstream file;
+
+    // Train a bit so that the statistics are not zero
+    for (int i=0; i<10; ++i) {
+        net->trainSample(inputs.col(i), Vector::Ones(3));
+    }
+
+    serialize(net, checkpoint);
+    net->predictBatch(inputs, outputs);
+
+    // The export contains the weights without their statistics
+    exported.setMode(NetworkSerializer::Export);
+    net->serialize(exported);
+
+    CPPUNIT_ASSERT_EQUAL(checkpoint.size(), 2 * exported.size());
+
+    checkpoint.save(checkpoint_file);
+    exported.save(file);
+
+    CPPUNIT_ASSERT(file.str().size() < checkpoint_file.str().size());
+
+    // An export is loaded, mapped or rebuilt like a checkpoint
+    loaded.load(file);
+
+    CPPUNIT_ASSERT_EQUAL(NetworkSerializer::Export, loaded.mode());
+
+    Network *copy = makeNetwork();
+
+    copy->deserialize(loaded);
+    copy->predictBatch(inputs, exported_outputs);
+
+    CPPUNIT_ASSERT(outputs == exported_outputs);
+
+    loaded.load(file.seekg(0));
+
+    Network *rebuilt = Network::rebuild(loaded);
+
+    rebuilt->predictBatch(inputs, exported_outputs);
+
+    CPPUNIT_ASSERT(outputs == exported_outputs);
+
+    // The checkpoint, with the statistics, can still be loaded
+    loaded.load(checkpoint_file.seekg(0));
+
+    CPPUNIT_ASSERT_EQUAL(NetworkSerializer::Checkpoint, loaded.mode());
+
+    delete net;
+    delete copy;
+    delete rebuilt;
+}
+
+static bool exists(const std::string &filename)
+{
+    return std::ifstream(filename).good();
+}
+
+void TestSerializer::testCheckpointer()
+{
+    Network *net = makeNetwork();
+    Matrix inputs = Matrix::Random(4, 10);
+    NetworkSerializer reference;
+    NetworkSerializer loaded;
+    std::string filename;
+
+    // Checkpoints left by a previous run would be continued
+    for (int i=1; i<=5; ++i) {
+        std::remove(("test_checkpointer.nnet." + std::to_string(i)).c_str());
+    }
+
+    {
+        Checkpointer checkpointer("test_checkpointer.nnet", 2);
+
+        for (int i=0; i<4; ++i) {
+            reference.clear();
+            net->serialize(reference);
+
+            filename = checkpointer.save(net);
+
+            // Training goes on while the checkpoint is written
+            for (int j=0; j<10; ++j) {
+                net->trainSample(inputs.col(j), Vector::Ones(3));
+            }
+        }
+
+        checkpointer.wait();
+
+        CPPUNIT_ASSERT_EQUAL(std::string("test_checkpointer.nnet.4"), filename);
+        CPPUNIT_ASSERT_EQUAL(filename, checkpointer.latest());
+    }
+
+    // The last two checkpoints are kept, and were renamed
+    CPPUNIT_ASSERT(!exists("test_checkpointer.nnet.1"));
+    CPPUNIT_ASSERT(!exists("test_checkpointer.nnet.2"));
+    CPPUNIT_ASSERT(exists("test_checkpointer.nnet.3"));
+    CPPUNIT_ASSERT(exists("test_checkpointer.nnet.4"));
+    CPPUNIT_ASSERT(!exists("test_checkpointer.nnet.4.tmp"));
+
+    // The checkpoint contains the weights at the time of save()
+    std::ifstream file(filename, std::ios::binary);
+
+    loaded.load(file);
+
+    CPPUNIT_ASSERT_EQUAL(reference.size(), loaded.size());
+    CPPUNIT_ASSERT(std::equal(reference.data(), reference.data() + reference.size(), loaded.data()));
+
+    Network *rebuilt = Network::rebuild(loaded);
+
+    CPPUNIT_ASSERT(rebuilt != nullptr);
+
+    // A training that is resumed continues after the checkpoints on the disk
+    {
+        Checkpointer checkpointer("test_checkpointer.nnet", 2);
+
+        CPPUNIT_ASSERT_EQUAL(std::string("test_checkpointer.nnet.4"), checkpointer.latest());
+        CPPUNIT_ASSERT_EQUAL(std::string("test_checkpointer.nnet.5"), checkpointer.save(net));
+
+        checkpointer.wait();
+
+        CPPUNIT_ASSERT_EQUAL(std::string("test_checkpointer.nnet.5"), checkpointer.latest());
+    }
+
+    CPPUNIT_ASSERT(!exists("test_checkpointer.nnet.3"));
+    CPPUNIT_ASSERT(exists("test_checkpointer.nnet.4"));
+    CPPUNIT_ASSERT(exists("test_checkpointer.nnet.5"));
+
+    // An error is reported by the next call
+    {
+        Checkpointer checkpointer("nonexistent_directory/test_checkpointer.nnet");
+
+        checkpointer.save(net);
+        CPPUNIT_ASSERT_THROW(checkpointer.wait(), std::runtime_error);
+        CPPUNIT_ASSERT(checkpointer.latest().empty());
+    }
+
+    std::remove("test_checkpointer.nnet.4");
+    std::remove("test_checkpointer.nnet.5");
+
+    delete net;
+    delete rebuilt;
+}
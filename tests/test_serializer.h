@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2015 Vrije Universiteit Brussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __TEST_SERIALIZER_H__
+#define __TEST_SERIALIZER_H__
+
+#include <cppunit/TestCase.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+class TestSerializer : public CppUnit::TestCase
+{
+    CPPUNIT_TEST_SUITE(TestSerializer);
+    CPPUNIT_TEST(testSaveLoad);
+    CPPUNIT_TEST(testInvalidFiles);
+    CPPUNIT_TEST(testConvert);
+    CPPUNIT_TEST(testMap);
+    CPPUNIT_TEST(testRebuild);
+    CPPUNIT_TEST(testExport);
+    CPPUNIT_TEST(testCheckpointer);
+    CPPUNIT_TEST_SUITE_END();
+
+    protected:
+        void testSaveLoad();
+        void testInvalidFiles();
+        void testConvert();
+        void testMap();
+        void testRebuild();
+        void testExport();
+        void testCheckpointer();
+};
+
+#endif
@@ -23,6 +23,8 @@
 #include "test_perceptron.h"
 #include "test_merge.h"
 #include "test_recurrent.h"
+#include "test_sequence.h"
+#include "test_serializer.h"
 
 #include <iostream>
 
@@ -58,6 +60,8 @@ int main(int argc, char **argv)
     TESTSUITE(TestPerceptron, "perceptron");
     TESTSUITE(TestMerge, "merge");
     TESTSUITE(TestRecurrent, "recurrent");
+    TESTSUITE(TestSequence, "sequence");
+    TESTSUITE(TestSerializer, "serializer");
 
     if(!has_suite)
     {
@@ -28,18 +28,24 @@
 #include <networkserializer.h>
 #include <dense.h>
 #include <gru.h>
+#include <fusedgru.h>
 #include <lstm.h>
+#include <fusedlstm.h>
 #include <cwrnn.h>
 
 #include <iostream>
 
+/**
+ * @brief Make a network with a GRU layer, @p Cell being GRU or FusedGRU
+ */
+template<typename Cell = GRU>
 inline Network *makeGRU(unsigned int nin, unsigned int nhidden, unsigned int nout, float learning_rate)
 {
     Network *net = new Network(nin);
     Dense *dense_in = new Dense(nhidden, learning_rate);
     Dense *dense_z = new Dense(nhidden, learning_rate);
     Dense *dense_r = new Dense(nhidden, learning_rate);
-    GRU *gru = new GRU(nhidden, learning_rate);
+    Cell *gru = new Cell(nhidden, learning_rate);
     Dense *out = new Dense(nout, learning_rate);
 
     dense_in->setInput(net->inputPort());
@@ -59,6 +65,10 @@ inline Network *makeGRU(unsigned int nin, unsigned int nhidden, unsigned int nou
     return net;
 }
 
+/**
+ * @brief Make a network with a LSTM layer, @p Cell being LSTM or FusedLSTM
+ */
+template<typename Cell = LSTM>
 inline Network *makeLSTM(unsigned int nin, unsigned int nhidden, unsigned int nout, float learning_rate)
 {
     Network *net = new Network(nin);
@@ -66,7 +76,7 @@ inline Network *makeLSTM(unsigned int nin, unsigned int nhidden, unsigned int no
     Dense *dense_ingate = new Dense(nhidden, learning_rate);
     Dense *dense_outgate = new Dense(nhidden, learning_rate);
     Dense *dense_forgetgate = new Dense(nhidden, learning_rate);
-    LSTM *lstm = new LSTM(nhidden, learning_rate);
+    Cell *lstm = new Cell(nhidden, learning_rate);
     Dense *out = new Dense(nout, learning_rate);
 
     dense_in->setInput(net->inputPort());
@@ -144,8 +154,8 @@ inline float trainNetwork(Network *network,
                           bool sequence = false,
                           bool test_serialize = false)
 {
-    Eigen::MatrixXf inputs(input[0].rows(), input.size());
-    Eigen::MatrixXf outputs(output[0].rows(), output.size());
+    Matrix inputs(input[0].rows(), input.size());
+    Matrix outputs(output[0].rows(), output.size());
 
     // Copy the vectors into their matrices
     for (std::size_t i=0; i<input.size(); ++i) {
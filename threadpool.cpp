@@ -0,0 +1,149 @@
+/*
+ * Copyright (c) 2015 Vrije Universiteit Brussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#include "threadpool.h"
+
+/**
+ * @brief Whether the current thread is executing tasks of a pool, in which
+ *        case a nested run() must not wait for the pool
+ */
+static thread_local bool in_pool = false;
+
+ThreadPool::ThreadPool(unsigned int threads)
+: _task(nullptr),
+  _count(0),
+  _next(0),
+  _running(0),
+  _generation(0),
+  _stop(false)
+{
+    for (unsigned int i=0; i<threads; ++i) {
+        _threads.push_back(std::thread(&ThreadPool::work, this));
+    }
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        _stop = true;
+    }
+
+    _start.notify_all();
+
+    for (std::thread &thread : _threads) {
+        thread.join();
+    }
+}
+
+void ThreadPool::run(unsigned int count, const std::function<void(unsigned int)> &task)
+{
+    if (in_pool || _threads.empty() || count < 2) {
+        // Nothing to gain from waking up the threads
+        for (unsigned int i=0; i<count; ++i) {
+            task(i);
+        }
+
+        return;
+    }
+
+    std::lock_guard<std::mutex> run_lock(_run_mutex);
+
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        _task = &task;
+        _count = count;
+        _next = 0;
+        _running = _threads.size();
+        _generation += 1;
+    }
+
+    _start.notify_all();
+
+    // The calling thread executes tasks too, then waits for the other threads
+    in_pool = true;
+    execute();
+    in_pool = false;
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    _done.wait(lock, [this]() { return _running == 0; });
+    _task = nullptr;
+
+    // No thread executes the task anymore, its exception can be thrown
+    std::exception_ptr error = _error;
+
+    _error = nullptr;
+
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void ThreadPool::work()
+{
+    unsigned long generation = 0;
+
+    in_pool = true;
+
+    std::unique_lock<std::mutex> lock(_mutex);
+
+    while (true) {
+        _start.wait(lock, [&]() { return _stop || _generation != generation; });
+
+        if (_stop) {
+            return;
+        }
+
+        generation = _generation;
+
+        lock.unlock();
+        execute();
+        lock.lock();
+
+        if (--_running == 0) {
+            _done.notify_one();
+        }
+    }
+}
+
+void ThreadPool::execute()
+{
+    unsigned int index;
+
+    while ((index = _next++) < _count) {
+        try {
+            (*_task)(index);
+        } catch (...) {
+            std::lock_guard<std::mutex> lock(_mutex);
+
+            // Keep the first exception, and skip the tasks not started yet
+            if (!_error) {
+                _error = std::current_exception();
+            }
+
+            _next = _count;
+        }
+    }
+}
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2015 Vrije Universiteit Brussel
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+
+#ifndef __THREADPOOL_H__
+#define __THREADPOOL_H__
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <exception>
+#include <functional>
+
+/**
+ * @brief Threads that execute the independent nodes of a network in parallel
+ *
+ * The threads wait for work between calls to run(), so that executing a few
+ * tasks does not cost the creation of threads. A pool can be shared by several
+ * networks, but run() is executed by one thread at a time.
+ */
+class ThreadPool
+{
+    public:
+        /**
+         * @param threads Number of threads created by the pool. The thread
+         *        calling run() also executes tasks.
+         */
+        ThreadPool(unsigned int threads);
+        ~ThreadPool();
+
+        ThreadPool(const ThreadPool &) = delete;
+        ThreadPool &operator=(const ThreadPool &) = delete;
+
+        /**
+         * @brief Call @p task with every index from 0 to @p count - 1, in
+         *        parallel, and return when all the calls have returned
+         *
+         * When called from a task, the calls are simply executed in sequence.
+         *
+         * @throw The first exception thrown by a task, once the calls that
+         *        had started have returned. The remaining indexes are not
+         *        executed.
+         */
+        void run(unsigned int count, const std::function<void(unsigned int)> &task);
+
+    private:
+        /**
+         * @brief Main loop of a thread of the pool
+         */
+        void work();
+
+        /**
+         * @brief Execute tasks of the current run until none is left
+         */
+        void execute();
+
+    private:
+        std::vector<std::thread> _threads;
+
+        std::mutex _run_mutex;                  /*!< @brief Held by the thread calling run() */
+        std::mutex _mutex;                      /*!< @brief Protects the members below */
+        std::condition_variable _start;
+        std::condition_variable _done;
+
+        const std::function<void(unsigned int)> *_task;
+        unsigned int _count;
+        std::atomic<unsigned int> _next;        /*!< @brief Index of the next task to execute */
+        unsigned int _running;                  /*!< @brief Threads of the pool that have not finished the current run */
+        unsigned long _generation;              /*!< @brief Incremented at every run, wakes up the threads */
+        std::exception_ptr _error;              /*!< @brief First exception thrown by a task of the current run */
+        bool _stop;
+};
+
+#endif